@@ -6,8 +6,10 @@
 #include <map>
 #include <NTL/ZZ_pE.h>
 #include <NTL/mat_ZZ_pE.h>
+#include <NTL/lzz_pX.h>
 #include <helib/Ptxt.h>
 #include <sstream>
+#include <numeric>
 #include <iomanip>
 
 using namespace he_cmp;
@@ -90,7 +92,7 @@ map<unsigned long, vector<vector<long>>> fcoefs{
 	  {-5, 9},
 	  {-1}}}};
 
-DoubleCRT Comparator::create_shift_mask(double &size, long shift)
+zzX Comparator::create_shift_mask(double &size, long shift, const vector<long> &borders)
 {
 	cout << "Mask for shift " << shift << " is being created" << endl;
 	// get EncryptedArray
@@ -99,68 +101,125 @@ DoubleCRT Comparator::create_shift_mask(double &size, long shift)
 	// extract slots
 	long nSlots = ea.size();
 
-	// number of batches in one slot
-	long batch_size = nSlots / m_expansionLen;
-
-	// create a mask vector
-	vector<long> mask_vec(nSlots, 1);
-
-	// starting position of all batches
-	long start = 0;
-
-	// set zeros in the unused slots
-	long nEndZeros = nSlots - batch_size * m_expansionLen;
-	for (int i = 1; i <= nEndZeros; i++)
-	{
-		long indx = (start + nSlots - i) % nSlots;
-		mask_vec[indx] = 0;
-	}
+	// create a mask vector, the slots behind the last batch are unused
+	vector<long> mask_vec(nSlots, 0);
 
 	// masking values rotated outside their batches
-	for (long i = 0; i < batch_size; i++)
+	for (size_t i = 0; i + 1 < borders.size(); i++)
 	{
+		long batch_start = borders[i];
+		long batch_end = borders[i + 1];
 		if (shift < 0)
-		{
-			for (long j = 0; j < -shift; j++)
-			{
-				long indx = (start + (i + 1) * m_expansionLen - j - 1) % nSlots;
-				mask_vec[indx] = 0;
-			}
-		}
-		else if (shift > 0)
-		{
-			for (long j = 0; j < shift; j++)
-			{
-				long indx = (start + i * m_expansionLen + j) % nSlots;
-				mask_vec[indx] = 0;
-			}
-		}
+			batch_end = max(batch_start, batch_end + shift);
+		else
+			batch_start = min(batch_end, batch_start + shift);
+
+		for (long indx = batch_start; indx < batch_end; indx++)
+			mask_vec[indx] = 1;
 	}
 	ZZX mask_zzx;
 	ea.encode(mask_zzx, mask_vec);
 
 	size = conv<double>(embeddingLargestCoeff(mask_zzx, m_context.getZMStar()));
 
-	DoubleCRT mask_crt = DoubleCRT(mask_zzx, m_context, m_context.allPrimes());
-	return mask_crt;
+	// coefficients of encoded 0/1 vectors are reduced mod p
+	zzX mask;
+	convert(mask, mask_zzx);
+	return mask;
 }
 
-void Comparator::create_all_shift_masks()
+zzX Comparator::create_first_slot_mask(double &size, const vector<long> &borders)
+{
+	const EncryptedArray &ea = m_context.getEA();
+
+	vector<long> mask_vec(ea.size(), 0);
+	for (size_t i = 0; i + 1 < borders.size(); i++)
+		mask_vec[borders[i]] = 1;
+	ZZX mask_zzx;
+	ea.encode(mask_zzx, mask_vec);
+
+	size = conv<double>(embeddingLargestCoeff(mask_zzx, m_context.getZMStar()));
+
+	zzX mask;
+	convert(mask, mask_zzx);
+	return mask;
+}
+
+long Comparator::create_layout(const vector<long> &borders)
 {
+	BatchLayout layout;
+	layout.borders = borders;
+	layout.max_len = 1;
+	for (size_t i = 0; i + 1 < borders.size(); i++)
+		layout.max_len = max(layout.max_len, borders[i + 1] - borders[i]);
+	layout.first_mask = m_mulMasks.size();
+
+	// masks of the shifts by 2^k within the batches
 	long shift = 1;
-	while (shift < m_expansionLen)
+	while (shift < layout.max_len)
 	{
-		cout << "Expansion: " << m_expansionLen << endl;
+		cout << "Expansion: " << layout.max_len << endl;
 		double size;
-		DoubleCRT mask_ptxt = create_shift_mask(size, -shift);
-		m_mulMasks.push_back(mask_ptxt);
+		zzX mask = create_shift_mask(size, -shift, borders);
+		m_mulMasks.push_back(mask);
 		m_mulMasksSize.push_back(size);
 
 		shift <<= 1;
 	}
+
+	layout.first_slot_mask = -1;
+	if (layout.max_len > 1)
+	{
+		double size;
+		layout.first_slot_mask = m_mulMasks.size();
+		m_mulMasks.push_back(create_first_slot_mask(size, borders));
+		m_mulMasksSize.push_back(size);
+	}
+
+	m_layouts.push_back(layout);
+	return m_layouts.size() - 1;
+}
+
+vector<long> Comparator::uniform_borders() const
+{
+	long batch_num = m_context.getEA().size() / m_expansionLen;
+	vector<long> borders(batch_num + 1);
+	for (long i = 0; i <= batch_num; i++)
+		borders[i] = i * m_expansionLen;
+	return borders;
+}
+
+void Comparator::create_all_shift_masks()
+{
+	create_layout(uniform_borders());
 	cout << "All masks are created" << endl;
 }
 
+long Comparator::add_batch_layout(const vector<long> &batch_lengths)
+{
+	if (m_type == PSM || m_type == PSMS)
+		throw helib::LogicError("Batch layouts are not supported by the membership circuits");
+
+	vector<long> borders(1, 0);
+	for (long len : batch_lengths)
+	{
+		if (len < 1)
+			throw helib::LogicError("Batches must contain at least one slot");
+		borders.push_back(borders.back() + len);
+	}
+	if (borders.back() > m_context.getEA().size())
+		throw helib::LogicError("The batches do not fit into one ciphertext");
+
+	long layout = create_layout(borders);
+	fit_constant_cache();
+	return layout;
+}
+
+long Comparator::batch_len(long layout) const
+{
+	return m_layouts[layout].max_len;
+}
+
 void Comparator::create_psm_masks()
 {
 	if (m_type == PSM)
@@ -182,8 +241,9 @@ void Comparator::create_psm_masks()
 			ZZX mask_zzx;
 			ea.encode(mask_zzx, mask_v[i]);
 			double size = conv<double>(embeddingLargestCoeff(mask_zzx, m_context.getZMStar()));
-			DoubleCRT mask_crt = DoubleCRT(mask_zzx, m_context, m_context.allPrimes());
-			m_mulMasks.push_back(mask_crt);
+			zzX mask;
+			convert(mask, mask_zzx);
+			m_mulMasks.push_back(mask);
 			m_mulMasksSize.push_back(size);
 		}
 	}
@@ -231,11 +291,6 @@ void Comparator::compute_psm_ss()
 		//{
 		//	throw invalid_argument("Currently PSM does not work for large search spaces (bigger then slot size) if expansion Len is bigger than 1\n");
 		//}
-		double pow = log2(m_expansionLen);
-		if (floor(pow) != pow)
-		{
-			throw invalid_argument("Currently PSM expansion factor must a power of 2\n");
-		}
 		long size = xss_size > vslots ? vslots : xss_size;
 		cout << "SS Size: " << ss_size << endl;
 		m_ss.resize(ss_size);
@@ -277,12 +332,9 @@ void Comparator::compute_psm_ss()
 	cout << "Pattern is created" << endl;
 }
 
-void Comparator::compute_poly_params()
+// number of baby steps of the Paterson-Stockmeyer evaluation of the univariate polynomials of the given degree
+static long univar_baby_steps(long p, long degree)
 {
-	// get p
-	ZZ p = ZZ(m_context.getP());
-	long p_long = conv<long>(p);
-
 	// hardcoded babysteps sizes
 	map<unsigned long, unsigned long> bs_nums{
 		{5, 1},
@@ -309,41 +361,35 @@ void Comparator::compute_poly_params()
 		{659, 11}  // 11 (41), 11..12
 	};
 
-	m_bs_num_comp = -1;
-	m_bs_num_min = -1;
-	if (bs_nums.count(p_long) > 0)
-	{
-		m_bs_num_comp = bs_nums[p_long];
-		m_bs_num_min = bs_nums[p_long];
-	}
-
-	// if p > 3, d = (p-3)/2
-	long d_comp = deg(m_univar_less_poly);
-	// if p > 3, d = (p-1)/2
-	long d_min = deg(m_univar_min_max_poly);
+	if (bs_nums.count(p) > 0)
+		return bs_nums[p];
 
 	// How many baby steps: set sqrt(d/2), rounded up/down to a power of two
 
 	// FIXME: There may be some room for optimization here: it may be possible to choose this number as something other than a power of two and still maintain optimal depth, in principle we can try all possible values of m_babystep_num between two consecutive powers of two and choose the one that gives the least number of multiplies, conditioned on minimum depth.
 
-	if (m_bs_num_comp <= 0)
-	{
-		long kk = static_cast<long>(sqrt(d_comp / 2.0)); // sqrt(d/2)
-		m_bs_num_comp = 1L << NextPowerOfTwo(kk);
+	long kk = static_cast<long>(sqrt(degree / 2.0)); // sqrt(d/2)
+	long bs_num = 1L << NextPowerOfTwo(kk);
 
-		// heuristic: if #baby_steps >> kk then use a smaler power of two
-		if ((m_bs_num_comp == 16 && d_comp > 167) || (m_bs_num_comp > 16 && m_bs_num_comp > (1.44 * kk)))
-			m_bs_num_comp /= 2;
-	}
-	if (m_bs_num_min <= 0)
-	{
-		long kk = static_cast<long>(sqrt(d_min / 2.0)); // sqrt(d/2)
-		m_bs_num_min = 1L << NextPowerOfTwo(kk);
+	// heuristic: if #baby_steps >> kk then use a smaler power of two
+	if ((bs_num == 16 && degree > 167) || (bs_num > 16 && bs_num > (1.44 * kk)))
+		bs_num /= 2;
+	return bs_num;
+}
 
-		// heuristic: if #baby_steps >> kk then use a smaler power of two
-		if ((m_bs_num_min == 16 && d_min > 167) || (m_bs_num_min > 16 && m_bs_num_min > (1.44 * kk)))
-			m_bs_num_min /= 2;
-	}
+void Comparator::compute_poly_params()
+{
+	// get p
+	ZZ p = ZZ(m_context.getP());
+	long p_long = conv<long>(p);
+
+	// if p > 3, d = (p-3)/2
+	long d_comp = deg(m_univar_less_poly);
+	// if p > 3, d = (p-1)/2
+	long d_min = deg(m_univar_min_max_poly);
+
+	m_bs_num_comp = univar_baby_steps(p_long, d_comp);
+	m_bs_num_min = univar_baby_steps(p_long, d_min);
 
 	if (m_verbose)
 	{
@@ -486,6 +532,10 @@ void Comparator::create_poly()
 
 		m_univar_min_max_poly = m_univar_less_poly * ZZX(INIT_MONO, 1, 1);
 
+		// compute_poly_params makes both polynomials monic, keep them as they are for multiPolyEval
+		m_univar_less_poly_raw = m_univar_less_poly;
+		m_univar_min_max_poly_raw = m_univar_min_max_poly;
+
 		/*
 		cout << "Min-max poly: ";
 		printZZX(cout, m_univar_min_max_poly, p);
@@ -689,7 +739,7 @@ void Comparator::extraction_init()
 	// cout << "Extraction consts: " << endl;
 	for (long iCoef = 0; iCoef < d; iCoef++)
 	{
-		vector<DoubleCRT> tmp_crt_vec;
+		vector<zzX> tmp_const_vec;
 		vector<double> size_vec;
 
 		for (long iFrob = 0; iFrob < d; iFrob++)
@@ -701,18 +751,27 @@ void Comparator::extraction_init()
 			vector<ZZX> vec_const(nslots, tmp);
 			ea.encode(tmp, vec_const);
 
-			DoubleCRT tmp_crt(tmp, m_context, m_context.allPrimes());
+			zzX tmp_const;
+			convert(tmp_const, tmp);
 
 			double const_size = conv<double>(embeddingLargestCoeff(tmp, m_context.getZMStar()));
 			size_vec.push_back(const_size);
 
-			tmp_crt_vec.push_back(tmp_crt);
+			tmp_const_vec.push_back(tmp_const);
 		}
-		m_extraction_const.push_back(tmp_crt_vec);
+		m_extraction_const.push_back(tmp_const_vec);
 		m_extraction_const_size.push_back(size_vec);
 	}
 }
 
+shared_ptr<const DoubleCRT> Comparator::get_extraction_const(double &size, long iCoef, long iFrob, const IndexSet &primes) const
+{
+	size = m_extraction_const_size[iCoef][iFrob];
+	// extraction constants have negative ids in the cache, so masks of new layouts can be appended
+	long id = -1 - (iCoef * static_cast<long>(m_extraction_const[iCoef].size()) + iFrob);
+	return m_constCache.get(id, m_extraction_const[iCoef][iFrob], primes);
+}
+
 void Comparator::extract_mod_p(vector<Ctxt> &mod_p_coefs, const Ctxt &ctxt_x) const
 {
 	HELIB_NTIMER_START(Extraction);
@@ -731,32 +790,76 @@ void Comparator::extract_mod_p(vector<Ctxt> &mod_p_coefs, const Ctxt &ctxt_x) co
 	long d = m_context.getOrdP();
 
 	// TODO: how to use key switching hoisting from CRYPTO'18?
-	vector<Ctxt> ctxt_frob(d - 1, ctxt_x);
+	vector<ScratchCtxt> ctxt_frob;
+	ctxt_frob.reserve(d - 1);
 	for (long iFrob = 1; iFrob < d; iFrob++)
 	{
-		ctxt_frob[iFrob - 1].frobeniusAutomorph(iFrob);
+		ctxt_frob.emplace_back(ctxt_x);
+		ctxt_frob.back()->frobeniusAutomorph(iFrob);
 	}
+	m_keySwitches += d - 1;
 
+	// the same scratch ciphertext is used for all products with extraction constants
+	ScratchCtxt tmp(ctxt_x);
+	mod_p_coefs.reserve(m_slotDeg);
 	for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
 	{
 		// cout << "Extract coefficient " << iCoef << endl;
-		Ctxt mod_p_ctxt = ctxt_x;
+		mod_p_coefs.emplace_back(ctxt_x);
+		Ctxt &mod_p_ctxt = mod_p_coefs.back();
 
-		mod_p_ctxt.multByConstant(m_extraction_const[iCoef][0], m_extraction_const_size[iCoef][0]);
+		double size;
+		shared_ptr<const DoubleCRT> coef_const = get_extraction_const(size, iCoef, 0, mod_p_ctxt.getPrimeSet());
+		mod_p_ctxt.multByConstant(*coef_const, size);
 
 		for (long iFrob = 1; iFrob < d; iFrob++)
 		{
-			Ctxt tmp = ctxt_frob[iFrob - 1];
-			tmp.multByConstant(m_extraction_const[iCoef][iFrob], m_extraction_const_size[iCoef][iFrob]);
-			mod_p_ctxt += tmp;
+			*tmp = *ctxt_frob[iFrob - 1];
+			coef_const = get_extraction_const(size, iCoef, iFrob, tmp->getPrimeSet());
+			tmp->multByConstant(*coef_const, size);
+			mod_p_ctxt += *tmp;
 		}
-		mod_p_coefs.push_back(mod_p_ctxt);
 	}
 	HELIB_NTIMER_STOP(Extraction);
 }
 
-Comparator::Comparator(const Context &context, CircuitType type, unsigned long d, unsigned long expansion_len, const SecKey &sk, bool verbose, unsigned long ss_size) : m_context(context), m_type(type), m_slotDeg(d), m_expansionLen(expansion_len), m_sk(sk), m_pk(sk), m_verbose(verbose), m_ss_size(ss_size)
+void Comparator::extract_mod_p(vector<vector<long>> &mod_p_coefs, const Ptxt<BGV> &ptxt_x) const
+{
+	mod_p_coefs.clear();
+
+	long p = m_context.getP();
+	long nslots = m_context.getEA().size();
+
+	// the coefficients of slot polynomials are the digits
+	for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+	{
+		vector<long> coefs(nslots, 0);
+		for (long iSlot = 0; iSlot < nslots; iSlot++)
+		{
+			long coef = rem(coeff(ptxt_x.getSlotRepr()[iSlot].getData(), iCoef), p);
+			coefs[iSlot] = coef;
+		}
+		mod_p_coefs.push_back(coefs);
+	}
+}
+
+Comparator::Comparator(const Context &context, CircuitType type, unsigned long d, unsigned long expansion_len, const PubKey &pk, bool verbose, unsigned long ss_size) : m_context(context), m_type(type), m_slotDeg(d), m_expansionLen(expansion_len), m_sk(nullptr), m_pk(pk), m_verbose(verbose), m_ss_size(ss_size), m_lazyRelin(true), m_levelPlanner(false), m_capacityCheck(false), m_constCache(context, 32), m_constCacheSize(0), m_keySwitches(0)
 {
+	long memory_before = resident_memory_kb();
+
+	// batches that lie in the rows of one hypercube dimension are shifted by 1D rotations along it
+	const PAlgebra &zms = context.getZMStar();
+	m_rotationDim = expansion_len > 1 ? batch_rotation_dim(zms, expansion_len) : -1;
+	m_shiftKeySwitches = rotation_key_switches(zms, m_rotationDim);
+	if (expansion_len > 1)
+	{
+		if (m_rotationDim >= 0)
+			cout << "Batch shifts along dimension " << m_rotationDim << " of size " << zms.OrderOf(m_rotationDim) << (zms.SameOrd(m_rotationDim) ? " (native)" : " (not native)") << endl;
+		else
+			cout << "Batch shifts by rotations of all slots" << endl;
+		cout << "Key switches per batch shift: " << m_shiftKeySwitches << endl;
+	}
+
 	// determine the order of p in (Z/mZ)*
 	unsigned long ord_p = context.getOrdP();
 	// check that the extension degree divides the order of p
@@ -774,15 +877,94 @@ Comparator::Comparator(const Context &context, CircuitType type, unsigned long d
 	}
 	else
 	{
+		// the membership circuits use the uniform batches without shift masks
+		BatchLayout layout;
+		layout.borders = uniform_borders();
+		layout.max_len = m_expansionLen;
+		layout.first_mask = -1;
+		layout.first_slot_mask = -1;
+		m_layouts.push_back(layout);
+
 		create_psm_masks();
 		compute_psm_ss();
 	}
+
+	fit_constant_cache();
+
+	cout << "Resident memory before precomputation: " << memory_before << " KB, after: " << resident_memory_kb() << " KB" << endl;
+}
+
+Comparator::Comparator(const Context &context, CircuitType type, unsigned long d, unsigned long expansion_len, const SecKey &sk, bool verbose, unsigned long ss_size) : Comparator(context, type, d, expansion_len, static_cast<const PubKey &>(sk), verbose, ss_size)
+{
+	m_sk = &sk;
+}
+
+const SecKey &Comparator::secret_key() const
+{
+	if (m_sk == nullptr)
+		throw helib::LogicError("Decryption needs a comparator created from the secret key");
+	return *m_sk;
+}
+
+void Comparator::set_lazy_relin(bool lazy_relin)
+{
+	m_lazyRelin = lazy_relin;
+}
+
+void Comparator::set_level_planner(bool level_planner)
+{
+	m_levelPlanner = level_planner;
+}
+
+void Comparator::set_capacity_check(bool capacity_check)
+{
+	m_capacityCheck = capacity_check;
 }
 
-const DoubleCRT &Comparator::get_mask(double &size, long index) const
+shared_ptr<const DoubleCRT> Comparator::get_mask(double &size, long index, const IndexSet &primes) const
 {
 	size = m_mulMasksSize[index];
-	return m_mulMasks[index];
+	return m_constCache.get(index, m_mulMasks[index], primes);
+}
+
+long Comparator::get_key_switches() const
+{
+	return m_keySwitches;
+}
+
+void Comparator::reset_key_switches() const
+{
+	m_keySwitches = 0;
+}
+
+void Comparator::set_constant_cache_size(size_t size)
+{
+	m_constCacheSize = size;
+	fit_constant_cache();
+}
+
+void Comparator::fit_constant_cache()
+{
+	// every comparison cycles through all extraction constants and the shift masks, so an LRU cache smaller than
+	// this working set misses on every lookup. The constants are usually multiplied at two prime sets.
+	size_t const_num = m_mulMasks.size();
+	long zzx_bytes = 0;
+	for (const zzX &mask : m_mulMasks)
+		zzx_bytes += mask.length() * sizeof(long);
+	for (const vector<zzX> &row : m_extraction_const)
+	{
+		const_num += row.size();
+		for (const zzX &extraction_const : row)
+			zzx_bytes += extraction_const.length() * sizeof(long);
+	}
+
+	size_t capacity = (m_constCacheSize > 0) ? m_constCacheSize : 2 * const_num;
+	m_constCache.set_capacity(capacity);
+
+	// the same constants as DoubleCRT over all primes, as they were stored before the cache
+	long crt_bytes = static_cast<long>(const_num) * m_context.getPhiM() * m_context.allPrimes().card() * sizeof(long);
+	cout << "Constants: " << const_num << ", " << zzx_bytes / 1024 << " KB as zzX, "
+		 << crt_bytes / 1024 << " KB as DoubleCRT over all primes, cache capacity " << capacity << endl;
 }
 
 const ZZX &Comparator::get_less_than_poly() const
@@ -803,9 +985,16 @@ void Comparator::print_decrypted(const Ctxt &ctxt) const
 	// get order of p
 	unsigned long ord_p = m_context.getOrdP();
 
+	// an evaluator cannot look inside ciphertexts
+	if (m_sk == nullptr)
+	{
+		cout << "<encrypted>";
+		return;
+	}
+
 	long nSlots = ea.size();
 	vector<ZZX> decrypted(nSlots);
-	ea.decrypt(ctxt, m_sk, decrypted);
+	ea.decrypt(ctxt, *m_sk, decrypted);
 
 	for (int i = 0; i < nSlots; i++)
 	{
@@ -821,9 +1010,15 @@ void Comparator::print_decrypted(const Ctxt &ctxt, unsigned int blocsize) const
 	// get order of p
 	unsigned long ord_p = m_context.getOrdP();
 
+	if (m_sk == nullptr)
+	{
+		cout << "<encrypted>";
+		return;
+	}
+
 	long nSlots = ea.size();
 	vector<ZZX> decrypted(nSlots);
-	ea.decrypt(ctxt, m_sk, decrypted);
+	ea.decrypt(ctxt, *m_sk, decrypted);
 	for(int i=0; i < nSlots; i++) {
 		printZZX(cout, decrypted[i], ord_p);
 		if((i+1)%blocsize==0) std::cout << std::endl;
@@ -845,44 +1040,61 @@ void Comparator::pd(const Ctxt &ctxt, string preamble, int i) const
 	cout << endl;
 }
 
-void Comparator::batch_shift(Ctxt &ctxt, long start, long shift) const
+void Comparator::rotate_in_batches(Ctxt &ctxt, long shift, long layout) const
 {
-	HELIB_NTIMER_START(BatchShift);
-	// get EncryptedArray
-	const EncryptedArray &ea = m_context.getEA();
+	// slots coming from other rows of the dimension are never used, like those coming from other batches
+	// (other layouts need not be aligned with the rows)
+	if (layout != 0)
+	{
+		rotate_slots(ctxt, shift);
+		return;
+	}
+
+	if (m_rotationDim >= 0)
+		m_context.getEA().rotate1D(ctxt, m_rotationDim, shift);
+	else
+		m_context.getEA().rotate(ctxt, shift);
+	m_keySwitches += m_shiftKeySwitches;
+}
+
+void Comparator::rotate_slots(Ctxt &ctxt, long shift) const
+{
+	m_context.getEA().rotate(ctxt, shift);
+	m_keySwitches += rotation_key_switches(m_context.getZMStar(), -1);
+}
 
+void Comparator::batch_shift(Ctxt &ctxt, long start, long shift, long layout) const
+{
+	HELIB_NTIMER_START(BatchShift);
 	// if shift is zero, do nothing
 	if (shift == 0)
 		return;
 
 	// left cyclic rotation
-	ea.rotate(ctxt, shift);
+	rotate_in_batches(ctxt, shift, layout);
 
 	// masking elements shifted out of batch
-	long index = static_cast<long>(intlog(2, -shift));
+	long index = m_layouts[layout].first_mask + static_cast<long>(intlog(2, -shift));
 	// cout << "Mask index: " << index << endl;
 	double size;
-	DoubleCRT mask = get_mask(size, index);
-	ctxt.multByConstant(mask, size);
+	shared_ptr<const DoubleCRT> mask = get_mask(size, index, ctxt.getPrimeSet());
+	ctxt.multByConstant(*mask, size);
 	HELIB_NTIMER_STOP(BatchShift);
 }
 
-void Comparator::batch_shift_for_mul(Ctxt &ctxt, long start, long shift) const
+void Comparator::batch_shift_for_mul(Ctxt &ctxt, long start, long shift, long layout) const
 {
 	HELIB_NTIMER_START(BatchShiftForMul);
-	// get EncryptedArray
-	const EncryptedArray &ea = m_context.getEA();
-
 	// if shift is zero, do nothing
 	if (shift == 0)
 		return;
 	// left cyclic rotation
-	ea.rotate(ctxt, shift);
+	rotate_in_batches(ctxt, shift, layout);
 
-	long index = static_cast<long>(intlog(2, -shift));
+	long index = m_layouts[layout].first_mask + static_cast<long>(intlog(2, -shift));
 	// cout << "Mask index: " << index << endl;
 	double mask_size;
-	DoubleCRT mask = get_mask(mask_size, index);
+	DoubleCRT mask = *get_mask(mask_size, index, ctxt.getPrimeSet());
 	ctxt.multByConstant(mask, mask_size);
 
 	// add 1 to masked slots
@@ -893,7 +1105,7 @@ void Comparator::batch_shift_for_mul(Ctxt &ctxt, long start, long shift) const
 	HELIB_NTIMER_STOP(BatchShiftForMul);
 }
 
-void Comparator::shift_and_add(Ctxt &x, long start, long shift_direction) const
+void Comparator::shift_and_add(Ctxt &x, long start, long shift_direction, long layout) const
 {
 	HELIB_NTIMER_START(ShiftAdd);
 	long shift_sign = -1;
@@ -902,18 +1114,21 @@ void Comparator::shift_and_add(Ctxt &x, long start, long shift_direction) const
 
 	long e = 1;
 
+	// the rotated copies are only masked, so they are rotated with as few primes as the noise allows
+	drop_to_base(x);
+
 	// shift and add
-	while (e < m_expansionLen)
+	while (e < batch_len(layout))
 	{
-		Ctxt tmp = x;
-		batch_shift(tmp, start, e * shift_sign);
-		x += tmp;
+		ScratchCtxt tmp(x);
+		batch_shift(*tmp, start, e * shift_sign, layout);
+		x += *tmp;
 		e <<= 1;
 	}
 	HELIB_NTIMER_STOP(ShiftAdd);
 }
 
-void Comparator::shift_and_mul(Ctxt &x, long start, long shift_direction) const
+void Comparator::shift_and_mul(Ctxt &x, long start, long shift_direction, long layout) const
 {
 	HELIB_NTIMER_START(ShiftMul);
 	long shift_sign = -1;
@@ -923,11 +1138,13 @@ void Comparator::shift_and_mul(Ctxt &x, long start, long shift_direction) const
 	long e = 1;
 
 	// shift and add
-	while (e < m_expansionLen)
+	while (e < batch_len(layout))
 	{
-		Ctxt tmp = x;
-		batch_shift_for_mul(tmp, start, e * shift_sign);
-		x.multiplyBy(tmp);
+		// the product of the previous step carries more primes than its noise needs
+		drop_to_base(x);
+		ScratchCtxt tmp(x);
+		batch_shift_for_mul(*tmp, start, e * shift_sign, layout);
+		x.multiplyBy(*tmp);
 		e <<= 1;
 	}
 	HELIB_NTIMER_STOP(ShiftMul);
@@ -1125,7 +1342,8 @@ void Comparator::less_than_mod_any(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctx
 		{
 			simplePolyEval(fx, fpolys[iPoly], x_powers);
 			Ypow = Y_powers.getPower(iPoly);
-			fx.multiplyBy(Ypow);
+			// the products f_i(x) * Y^i are relinearized together
+			multiplyLazy(fx, Ypow, m_lazyRelin);
 			ctxt_res += fx;
 		}
 	}
@@ -1136,9 +1354,11 @@ void Comparator::less_than_mod_any(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctx
 	ctxt_res += fx;
 
 	// (x+1)*f(x)
-	ctxt_res.multiplyBy(x_plus_1);
+	multiplyLazy(ctxt_res, x_plus_1, m_lazyRelin);
 	// Y*(x+1)*f(x)
-	ctxt_res.multiplyBy(Y);
+	multiplyLazy(ctxt_res, Y, m_lazyRelin);
+	if (!ctxt_res.inCanonicalForm())
+		ctxt_res.reLinearize();
 
 	if (m_verbose)
 	{
@@ -1148,6 +1368,15 @@ void Comparator::less_than_mod_any(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctx
 }
 
 void Comparator::evaluate_univar_less_poly(Ctxt &ret, Ctxt &ctxt_p_1, const Ctxt &x) const
+{
+	// z^2
+	Ctxt x2 = x;
+	x2.square();
+
+	evaluate_univar_less_poly(ret, ctxt_p_1, x, x2);
+}
+
+void Comparator::evaluate_univar_less_poly(Ctxt &ret, Ctxt &ctxt_p_1, const Ctxt &x, const Ctxt &x2) const
 {
 	HELIB_NTIMER_START(ComparisonCircuitUnivar);
 	// get p
@@ -1155,10 +1384,6 @@ void Comparator::evaluate_univar_less_poly(Ctxt &ret, Ctxt &ctxt_p_1, const Ctxt
 
 	if (p > ZZ(3)) // if p > 3, use the generic Paterson-Stockmeyer strategy
 	{
-		// z^2
-		Ctxt x2 = x;
-		x2.square();
-
 		DynamicCtxtPowers babyStep(x2, m_bs_num_comp);
 		const Ctxt &x2k = babyStep.getPower(m_bs_num_comp);
 
@@ -1168,11 +1393,11 @@ void Comparator::evaluate_univar_less_poly(Ctxt &ret, Ctxt &ctxt_p_1, const Ctxt
 		if (m_gs_num_comp == (1L << NextPowerOfTwo(m_gs_num_comp)))
 		{
 			// cout << "I'm computing degPowerOfTwo" << endl;
-			degPowerOfTwo(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep);
+			degPowerOfTwo(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep, m_lazyRelin);
 		}
 		else
 		{
-			recursivePolyEval(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep);
+			recursivePolyEval(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep, m_lazyRelin);
 
 			if (!IsOne(m_top_coef_comp))
 			{
@@ -1186,7 +1411,7 @@ void Comparator::evaluate_univar_less_poly(Ctxt &ret, Ctxt &ctxt_p_1, const Ctxt
 				ret -= topTerm;
 			}
 		}
-		ret.multiplyBy(x);
+		multiplyLazy(ret, x, m_lazyRelin);
 
 		// TODO: depth here is not optimal
 		Ctxt top_term = babyStep.getPower(m_baby_index);
@@ -1198,6 +1423,10 @@ void Comparator::evaluate_univar_less_poly(Ctxt &ret, Ctxt &ctxt_p_1, const Ctxt
 
 		ret += top_term;
 
+		// relinearize the sum of products once
+		if (!ret.inCanonicalForm())
+			ret.reLinearize();
+
 		/*
 		cout << "Computed baby steps" << endl;
 		for(int i = 0; i < babyStep.size(); i++)
@@ -1216,8 +1445,7 @@ void Comparator::evaluate_univar_less_poly(Ctxt &ret, Ctxt &ctxt_p_1, const Ctxt
 	{
 		ret = x;
 
-		ctxt_p_1 = x;
-		ctxt_p_1.square();
+		ctxt_p_1 = x2;
 
 		Ctxt top_term = ctxt_p_1;
 		top_term.multByConstant(ZZ(2));
@@ -1262,11 +1490,11 @@ void Comparator::evaluate_min_max_poly(Ctxt &ctxt_min, Ctxt &ctxt_max, const Ctx
 		if (m_gs_num_min == (1L << NextPowerOfTwo(m_gs_num_min)))
 		{
 			// cout << "I'm computing degPowerOfTwo" << endl;
-			degPowerOfTwo(g_z2, m_univar_min_max_poly, m_bs_num_min, babyStep, giantStep);
+			degPowerOfTwo(g_z2, m_univar_min_max_poly, m_bs_num_min, babyStep, giantStep, m_lazyRelin);
 		}
 		else
 		{
-			recursivePolyEval(g_z2, m_univar_min_max_poly, m_bs_num_min, babyStep, giantStep);
+			recursivePolyEval(g_z2, m_univar_min_max_poly, m_bs_num_min, babyStep, giantStep, m_lazyRelin);
 
 			if (!IsOne(m_top_coef_min))
 			{
@@ -1281,6 +1509,10 @@ void Comparator::evaluate_min_max_poly(Ctxt &ctxt_min, Ctxt &ctxt_max, const Ctx
 			}
 		}
 
+		// relinearize the sum of products once
+		if (!g_z2.inCanonicalForm())
+			g_z2.reLinearize();
+
 		// last term: ((p+1)/2) * (x + y)
 		Ctxt last_term = ctxt_x;
 		last_term += ctxt_y;
@@ -1395,114 +1627,355 @@ void Comparator::less_than_bivar_tan(Ctxt &ctxt_res, const Ctxt &ctxt_x, const C
 			tmp.multByConstant(m_bivar_less_coefs[i][j]);
 			sum += tmp;
 		}
-		sum.multiplyBy(x_powers.getPower(i));
+		// the products with powers of x are relinearized together
+		multiplyLazy(sum, x_powers.getPower(i), m_lazyRelin);
 		ctxt_res += sum;
 	}
+
+	if (!ctxt_res.inCanonicalForm())
+		ctxt_res.reLinearize();
 }
 
-void Comparator::is_zero(Ctxt &ctxt_res, const Ctxt &ctxt_z, long pow) const
+void Comparator::evaluate_slot_poly(Ctxt &ctxt_res, const vector<vector<long>> &coefs, DynamicCtxtPowers &x_powers, long baby_num) const
 {
-	HELIB_NTIMER_START(EqualityCircuit);
-
-	ctxt_res = ctxt_z;
-
-	// compute mapTo01: (z_i)^{p^d-1}
-	// cout << "Mapping to 0 and 1" << endl;
-	mapTo01_subfield(ctxt_res, pow);
-
-	if (m_verbose)
-	{
-		print_decrypted(ctxt_res);
-		cout << endl;
-	}
+	const EncryptedArray &ea = m_context.getEA();
 
-	// cout << "Computing NOT" << endl;
-	// compute 1 - mapTo01(z_i)
-	ctxt_res.negate();
-	ctxt_res.addConstant(ZZ(1));
+	// degree of the polynomial
+	long degree = coefs.size() - 1;
 
-	if (m_verbose)
-	{
-		print_decrypted(ctxt_res);
-		cout << endl;
-	}
+	// zero ciphertext
+	ctxt_res = Ctxt(x_powers.getPower(1).getPubKey());
 
-	HELIB_NTIMER_STOP(EqualityCircuit);
-}
+	// check that a coefficient is zero in all slots
+	auto is_zero_coef = [](const vector<long> &coef) {
+		for (size_t iSlot = 0; iSlot < coef.size(); iSlot++)
+			if (coef[iSlot] != 0)
+				return false;
+		return true;
+	};
 
-void Comparator::expandProd(Ctxt &ctxt_res, unsigned long p) const {
+	// check that a coefficient is the same in all slots, e.g. for a bound shared by all numbers
+	auto is_scalar_coef = [](const vector<long> &coef) {
+		for (size_t iSlot = 1; iSlot < coef.size(); iSlot++)
+			if (coef[iSlot] != coef[0])
+				return false;
+		return true;
+	};
 
-	const EncryptedArray &ea = m_context.getEA();
+	// multiply by a coefficient, scalars need no encoding
+	auto mult_by_coef = [&](Ctxt &ctxt, const vector<long> &coef) {
+		if (is_scalar_coef(coef))
+		{
+			ctxt.multByConstant(ZZ(coef[0]));
+			return;
+		}
+		ZZX coef_poly;
+		ea.encode(coef_poly, coef);
+		ctxt.multByConstant(coef_poly);
+	};
 
-	HELIB_NTIMER_START(Map);
-	if (m_slotDeg > 1) {
-		mapTo01(ea, ctxt_res);
-	} else {
-		ctxt_res.power(p - 1);
-	}
-	HELIB_NTIMER_STOP(Map);
+	// add a coefficient, scalars need no encoding
+	auto add_coef = [&](Ctxt &ctxt, const vector<long> &coef) {
+		if (is_scalar_coef(coef))
+		{
+			ctxt.addConstant(ZZ(coef[0]));
+			return;
+		}
+		ZZX coef_poly;
+		ea.encode(coef_poly, coef);
+		ctxt.addConstant(coef_poly);
+	};
 
-	if (m_verbose) {
-		cout << "map done" << endl;
-		cout << "Capacity: " << ctxt_res.bitCapacity() << endl;
-	}
-	ctxt_res.negate();
-	ctxt_res.addConstant(ZZ(1));
+	// sum_g (sum_b c_{g*k+b} x^b) * x^{g*k} where k is the number of baby steps
+	for (long giant = 0; giant * baby_num <= degree; giant++)
+	{
+		// baby-step polynomial without the constant term
+		Ctxt ctxt_baby = Ctxt(ctxt_res.getPubKey());
+		for (long baby = 1; baby < baby_num && giant * baby_num + baby <= degree; baby++)
+		{
+			const vector<long> &coef = coefs[giant * baby_num + baby];
+			if (is_zero_coef(coef))
+				continue;
+			Ctxt tmp = x_powers.getPower(baby);
+			mult_by_coef(tmp, coef);
+			ctxt_baby += tmp;
+		}
 
+		const vector<long> &const_coef = coefs[giant * baby_num];
+		bool zero_const = is_zero_coef(const_coef);
 
-	for (long irot = m_expansionLen >> 1; irot > 0; irot >>= 1){
-		Ctxt tmp = ctxt_res;
-		ea.rotate(ctxt_res, -irot);
-		ctxt_res *= tmp;
+		if (giant == 0)
+		{
+			ctxt_res += ctxt_baby;
+			if (!zero_const)
+				add_coef(ctxt_res, const_coef);
+		}
+		else if (ctxt_baby.isEmpty())
+		{
+			// the constant term multiplies the giant step
+			if (zero_const)
+				continue;
+			Ctxt tmp = x_powers.getPower(giant * baby_num);
+			mult_by_coef(tmp, const_coef);
+			ctxt_res += tmp;
+		}
+		else
+		{
+			if (!zero_const)
+				add_coef(ctxt_baby, const_coef);
+			ctxt_baby.multiplyBy(x_powers.getPower(giant * baby_num));
+			ctxt_res += ctxt_baby;
+		}
 	}
 }
 
-void Comparator::psm(Ctxt &ctxt_res, Ctxt ctxt, const vector<Ptxt<BGV>> &ss) const
+// generator of the multiplicative group of Z_p
+static long prim_root_mod(long p)
 {
-
-	int rot;
-	Ctxt ctxt_pattern(m_pk);
-	bool first = true;
-
-	unsigned long p = m_context.getP();
-	unsigned long slots = m_context.getZMStar().getNSlots();
-	unsigned long vslots = m_expansionLen * floor(slots / m_expansionLen);
-	// unsigned long enc_base = (p - 1) >> 1;
-	const EncryptedArray &ea = m_context.getEA();
-	unsigned long size = m_ss_size * m_expansionLen > vslots ? vslots : m_ss_size * m_expansionLen;
-	std::cout << "Slots    : " << floor(slots / m_expansionLen) << std::endl;
-	std::cout << "MultiSlot: " << m_expansionLen << std::endl;
-	std::cout << "InSlot   : " << m_slotDeg << std::endl;
-	HELIB_NTIMER_START(Comparison);
-	if (m_verbose)
+	// prime divisors of p-1
+	vector<long> facts;
+	long rest = p - 1;
+	for (long q = 2; q * q <= rest; q++)
 	{
-		cout << "Initial capacity: " << ctxt.bitCapacity() << endl;
+		if (rest % q)
+			continue;
+		facts.push_back(q);
+		while (rest % q == 0)
+			rest /= q;
 	}
-	HELIB_NTIMER_START(Rotation);
-	for (rot = m_expansionLen; rot <= size; rot = rot << 1)
+	if (rest > 1)
+		facts.push_back(rest);
+
+	for (long g = 2; g < p; g++)
 	{
-		if (rot & size)
+		bool is_gen = true;
+		for (long q : facts)
 		{
-			if (first)
-			{ // spare one unecessary rotation and addition;
-				ctxt_pattern = ctxt;
-				first = false;
-			}
-			else
+			if (PowerMod(g, (p - 1) / q, p) == 1)
 			{
-				ea.rotate(ctxt_pattern, rot);
-				ctxt_pattern += ctxt;
+				is_gen = false;
+				break;
 			}
 		}
-		if (rot << 1 <= size)
-		{ // spare one extra rotation
-
-			Ctxt tmp = ctxt;
-			ea.rotate(ctxt, rot);
-			ctxt += tmp;
-		}
+		if (is_gen)
+			return g;
 	}
-	HELIB_NTIMER_STOP(Rotation);
+	return 1;
+}
+
+void Comparator::plain_less_row(vector<long> &row, long y) const
+{
+	long p = m_context.getP();
+
+	// [x < y] = sum_{a < y} 1 - (x - a)^{p-1} = [y > 0] - sum_{j=1}^{p-1} (sum_{a < y} a^{p-1-j}) x^j
+	// The power sums S_m = sum_{0 < a < y} a^m, m = 0, ..., p-2, form the DFT of the indicator of [1, y-1]
+	// on the powers a = g^i of a generator g. With i*m = T(i+m) - T(i) - T(m), T(k) = k(k-1)/2,
+	// S_m = g^{-T(m)} sum_i [g^i < y] g^{-T(i)} g^{T(i+m)} is one polynomial product (Bluestein),
+	// so a row costs O(p log p) instead of O(p*y)
+	row.assign(p, 0);
+	if (y > 0)
+	{
+		zz_pPush push(p);
+
+		long n = p - 1;
+		long g = prim_root_mod(p);
+		long g_inv = InvMod(g, p);
+
+		// a_i = [g^i < y] g^{-T(i)} in reversed order
+		zz_pX a_pol;
+		a_pol.SetLength(n);
+		// b_k = g^{T(k)}
+		zz_pX b_pol;
+		b_pol.SetLength(2 * n - 1);
+		// g^{-T(m)}
+		vector<long> g_neg_tri(n);
+
+		long g_i = 1;		// g^i
+		long g_tri = 1;		// g^{T(i)}
+		long g_inv_tri = 1; // g^{-T(i)}
+		long g_inv_i = 1;	// g^{-i}
+		for (long k = 0; k < 2 * n - 1; k++)
+		{
+			b_pol[k] = g_tri;
+			if (k < n)
+			{
+				g_neg_tri[k] = g_inv_tri;
+				if (g_i < y)
+					a_pol[n - 1 - k] = g_inv_tri;
+			}
+			g_tri = MulMod(g_tri, g_i, p);
+			g_inv_tri = MulMod(g_inv_tri, g_inv_i, p);
+			g_i = MulMod(g_i, g, p);
+			g_inv_i = MulMod(g_inv_i, g_inv, p);
+		}
+		a_pol.normalize();
+		b_pol.normalize();
+
+		zz_pX prod_pol;
+		mul(prod_pol, a_pol, b_pol);
+
+		row[0] = 1;
+		for (long j = 1; j < p; j++)
+		{
+			long m = p - 1 - j;
+			long sum = MulMod(rep(coeff(prod_pol, n - 1 + m)), g_neg_tri[m], p);
+			// a = 0 only contributes 0^0 = 1
+			if (m == 0)
+				sum = AddMod(sum, 1, p);
+			row[j] = NegateMod(sum, p);
+		}
+	}
+}
+
+void Comparator::digit_predicates_plain(vector<Ctxt> &ctxt_less, vector<Ctxt> &ctxt_eq, const Ctxt &ctxt_x, const vector<vector<long>> &bounds) const
+{
+	HELIB_NTIMER_START(DigitPredicatesPlain);
+
+	ctxt_less.clear();
+	ctxt_eq.clear();
+
+	long p = m_context.getP();
+
+	// baby steps of the Paterson-Stockmeyer algorithm
+	long baby_num = static_cast<long>(ceil(sqrt(static_cast<double>(p))));
+
+	// the powers of x are shared among all bounds and predicates
+	DynamicCtxtPowers x_powers(ctxt_x, p - 1);
+
+	for (size_t iBound = 0; iBound < bounds.size(); iBound++)
+	{
+		const vector<long> &y = bounds[iBound];
+		long nslots = y.size();
+
+		// coefficients of x < y
+		vector<vector<long>> less_coefs(p, vector<long>(nslots));
+		// coefficients of x == y, 1 - (x - y)^{p-1} = [y == 0] - sum_{j=1}^{p-1} y^{p-1-j} x^j
+		vector<vector<long>> eq_coefs(p, vector<long>(nslots));
+
+		// rows are computed once per distinct value of y and not kept after the call
+		map<long, long> first_slot;
+		vector<long> less_row;
+		for (long iSlot = 0; iSlot < nslots; iSlot++)
+		{
+			auto it = first_slot.find(y[iSlot]);
+			if (it != first_slot.end())
+			{
+				for (long j = 0; j < p; j++)
+					less_coefs[j][iSlot] = less_coefs[j][it->second];
+			}
+			else
+			{
+				first_slot[y[iSlot]] = iSlot;
+				plain_less_row(less_row, y[iSlot]);
+				for (long j = 0; j < p; j++)
+					less_coefs[j][iSlot] = less_row[j];
+			}
+
+			eq_coefs[0][iSlot] = (y[iSlot] == 0) ? 1 : 0;
+			for (long j = 1; j < p; j++)
+				eq_coefs[j][iSlot] = (p - PowerMod(y[iSlot], p - 1 - j, p)) % p;
+		}
+
+		Ctxt ctxt_tmp = Ctxt(ctxt_x.getPubKey());
+		evaluate_slot_poly(ctxt_tmp, less_coefs, x_powers, baby_num);
+		ctxt_less.push_back(ctxt_tmp);
+
+		evaluate_slot_poly(ctxt_tmp, eq_coefs, x_powers, baby_num);
+		ctxt_eq.push_back(ctxt_tmp);
+	}
+
+	HELIB_NTIMER_STOP(DigitPredicatesPlain);
+}
+
+void Comparator::is_zero(Ctxt &ctxt_res, const Ctxt &ctxt_z, long pow) const
+{
+	HELIB_NTIMER_START(EqualityCircuit);
+
+	ctxt_res = ctxt_z;
+
+	// compute mapTo01: (z_i)^{p^d-1}
+	// cout << "Mapping to 0 and 1" << endl;
+	mapTo01_subfield(ctxt_res, pow);
+
+	if (m_verbose)
+	{
+		print_decrypted(ctxt_res);
+		cout << endl;
+	}
+
+	// cout << "Computing NOT" << endl;
+	// compute 1 - mapTo01(z_i)
+	ctxt_res.negate();
+	ctxt_res.addConstant(ZZ(1));
+
+	if (m_verbose)
+	{
+		print_decrypted(ctxt_res);
+		cout << endl;
+	}
+
+	HELIB_NTIMER_STOP(EqualityCircuit);
+}
+
+void Comparator::expandProd(Ctxt &ctxt_res, unsigned long p) const {
+
+	const EncryptedArray &ea = m_context.getEA();
+
+	HELIB_NTIMER_START(Map);
+	if (m_slotDeg > 1) {
+		mapTo01(ea, ctxt_res);
+	} else {
+		ctxt_res.power(p - 1);
+	}
+	HELIB_NTIMER_STOP(Map);
+
+	if (m_verbose) {
+		cout << "map done" << endl;
+		cout << "Capacity: " << ctxt_res.bitCapacity() << endl;
+	}
+	ctxt_res.negate();
+	ctxt_res.addConstant(ZZ(1));
+
+
+	// product of the slots of every batch in its first slot
+	rotate_and_combine(ctxt_res, m_expansionLen, 1, true);
+}
+
+void Comparator::psm(Ctxt &ctxt_res, const Ctxt &ctxt, const vector<Ptxt<BGV>> &ss) const
+{
+	// the rotations work on a copy of the input
+	psm(ctxt_res, Ctxt(ctxt), ss);
+}
+
+void Comparator::psm(Ctxt &ctxt_res, Ctxt &&ctxt, const vector<Ptxt<BGV>> &ss) const
+{
+
+	// with a single set element the pattern is built in the result, otherwise it is kept for every element
+	Ctxt ctxt_pattern_set(m_pk);
+	Ctxt &ctxt_pattern = ss.size() > 1 ? ctxt_pattern_set : ctxt_res;
+
+	unsigned long p = m_context.getP();
+	unsigned long slots = m_context.getZMStar().getNSlots();
+	unsigned long vslots = m_expansionLen * floor(slots / m_expansionLen);
+	// unsigned long enc_base = (p - 1) >> 1;
+	const EncryptedArray &ea = m_context.getEA();
+	unsigned long size = m_ss_size * m_expansionLen > vslots ? vslots : m_ss_size * m_expansionLen;
+	std::cout << "Slots    : " << floor(slots / m_expansionLen) << std::endl;
+	std::cout << "MultiSlot: " << m_expansionLen << std::endl;
+	std::cout << "InSlot   : " << m_slotDeg << std::endl;
+	HELIB_NTIMER_START(Comparison);
+	if (m_verbose)
+	{
+		cout << "Initial capacity: " << ctxt.bitCapacity() << endl;
+	}
+	// rotations are cheaper without the primes that only carry noise
+	drop_to_base(ctxt);
+	// number of batches filled with set elements
+	long batch_num = size / m_expansionLen;
+	HELIB_NTIMER_START(Rotation);
+	replicate_batches(ctxt, batch_num);
+	ctxt_pattern = ctxt;
+	HELIB_NTIMER_STOP(Rotation);
 	if (m_verbose)
 	{
 		cout << "pattern done" << endl;
@@ -1511,22 +1984,24 @@ void Comparator::psm(Ctxt &ctxt_res, Ctxt ctxt, const vector<Ptxt<BGV>> &ss) con
 
 	HELIB_NTIMER_START(Sub);
 	Ctxt ctxt_prev(m_pk);
-	ctxt_res = ctxt_pattern;
+	if (&ctxt_pattern != &ctxt_res)
+		ctxt_res = ctxt_pattern;
 	ctxt_res -= ss[0];
 
 	if( ss.size() > 1) {
 		if(m_expansionLen>1) expandProd(ctxt_res, p);
 		// Product
+		ScratchCtxt tmp(ctxt_pattern);
 		for (uint t = 1; t < ss.size(); t++)
 		{ // for ss size bigger than 1, expansion len must be 1
-			Ctxt tmp = ctxt_pattern;
-			tmp -= ss[t];
+			*tmp = ctxt_pattern;
+			*tmp -= ss[t];
 			ctxt_prev = ctxt_res;
 			if(m_expansionLen>1) {
-				expandProd(tmp, p);
-				ctxt_res += tmp;
+				expandProd(*tmp, p);
+				ctxt_res += *tmp;
 			} else {
-				ctxt_res *= tmp;
+				ctxt_res *= *tmp;
 			}
 		}
 	} 
@@ -1534,18 +2009,18 @@ void Comparator::psm(Ctxt &ctxt_res, Ctxt ctxt, const vector<Ptxt<BGV>> &ss) con
 	if (m_ss_size > slots && m_ss_size % slots)
 	{ // for ss size bigger than 1, expansion len must be 1
 		double size;
-		DoubleCRT mask = get_mask(size, 0);
+		shared_ptr<const DoubleCRT> mask = get_mask(size, 0, ctxt_res.getPrimeSet());
 		  //std::cout << "Res: " << std::endl;
 		  //print_decrypted(ctxt_res,m_expansionLen);
 		  //std::cout << std::endl;
 		  //std::cout << std::endl;
-		ctxt_res.multByConstant(mask, size);
+		ctxt_res.multByConstant(*mask, size);
 		  //std::cout << "Res After kill Mask: " << std::endl;
 		  //print_decrypted(ctxt_res,m_expansionLen);
 		  //std::cout << std::endl;
 		  //std::cout << std::endl;
-		mask = get_mask(size, 1);
-		ctxt_prev.multByConstant(mask, size);
+		mask = get_mask(size, 1, ctxt_prev.getPrimeSet());
+		ctxt_prev.multByConstant(*mask, size);
 		  //std::cout << "Prev After Kill Mask: " << std::endl;
 		  //print_decrypted(ctxt_prev,m_expansionLen);
 		  //std::cout << std::endl;
@@ -1587,35 +2062,15 @@ void Comparator::psm(Ctxt &ctxt_res, Ctxt ctxt, const vector<Ptxt<BGV>> &ss) con
 	}
 
 	if (ss.size() == 1 && m_expansionLen > 1 )
-	{ // if > 1 must be power of 2
-		for (long irot = m_expansionLen >> 1; irot > 0; irot >>= 1)
-		{
-			Ctxt tmp = ctxt_res;
-			ea.rotate(ctxt_res, -irot);
-			ctxt_res *= tmp;
-		}
+	{
+		// product of the slots of every batch in its first slot
+		rotate_and_combine(ctxt_res, m_expansionLen, 1, true);
 	}
 
-	// Add every element in the vector, by adding half of the vetor slots with the other half for ceil(log(size)) times
-	Ctxt ctxt_res_remain = ctxt_res; // When size is not a power of 2, result size will be bigger than 2^rot
-									 // ctxt_res_remain will contain the remaining  z slots z = size - 2^rot,
-									 // z may be split in powers of two z= 2^n_1 + ...  + 2^n_m,
-									 // each 2^n_i slots will be added in turn whenever rot_i == n_i
-	long nextrot = rot >> 1;		 // The first rotation of _result is performed only inf size is not a power of 2
+	// Add the first slots of all batches
+	drop_to_base(ctxt_res);
 	HELIB_NTIMER_START(Rotation1);
-
-	for (rot >>= 2; rot > m_expansionLen - 1; rot >>= 1)
-	{
-		Ctxt tmp = ctxt_res;
-		ea.rotate(ctxt_res, -rot);
-		ctxt_res += tmp;
-		if (rot & size)
-		{
-			ea.rotate(ctxt_res_remain, -nextrot);
-			nextrot = rot;
-			ctxt_res += ctxt_res_remain;
-		}
-	}
+	rotate_and_combine(ctxt_res, batch_num, m_expansionLen, false);
 	HELIB_NTIMER_STOP(Rotation1);
 	if (m_verbose)
 	{
@@ -1648,139 +2103,167 @@ void Comparator::psm(Ctxt &ctxt_res, Ctxt ctxt, const vector<Ptxt<BGV>> &ss) con
 	HELIB_NTIMER_STOP(Comparison);
 }
 
-void Comparator::compare(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctxt &ctxt_y) const
+void Comparator::combine_digits(Ctxt &ctxt_less, Ctxt &ctxt_eq, vector<Ctxt> &ctxt_less_p, vector<Ctxt> &ctxt_eq_p) const
 {
-	HELIB_NTIMER_START(Comparison);
-
-	vector<Ctxt> ctxt_less_p;
-	vector<Ctxt> ctxt_eq_p;
-
-	// bivariate circuit
-	if (m_type == BI || m_type == TAN)
+	// the ith entries correspond to the ith digit, the last digit is the most significant one
+	// two adjacent blocks of digits are merged by
+	// less = less_hi + eq_hi * less_lo
+	// eq = eq_hi * eq_lo
+	// the blocks are merged pairwise, which results in depth ceil(log2(d)) instead of d-1
+	long cur_len = ctxt_less_p.size();
+	while (cur_len > 1)
 	{
-		// cout << "Extraction" << endl;
-		//  extract mod p coefficients
-		vector<Ctxt> ctxt_x_p;
-		extract_mod_p(ctxt_x_p, ctxt_x);
-
-		if (m_verbose)
+		long pair_num = cur_len >> 1;
+		NTL_EXEC_RANGE(pair_num, first, last)
+		for (long i = first; i < last; i++)
 		{
-			for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
-			{
-				cout << "Ctxt x with coefficient " << iCoef << endl;
-				print_decrypted(ctxt_x_p[iCoef]);
-				cout << endl;
-			}
-		}
+			long lo = 2 * i;
+			long hi = 2 * i + 1;
 
-		vector<Ctxt> ctxt_y_p;
-		extract_mod_p(ctxt_y_p, ctxt_y);
+			ctxt_less_p[lo].multiplyBy(ctxt_eq_p[hi]);
+			ctxt_less_p[lo] += ctxt_less_p[hi];
 
-		if (m_verbose)
-		{
-			for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
-			{
-				cout << "Ctxt y with coefficient " << iCoef << endl;
-				print_decrypted(ctxt_y_p[iCoef]);
-				cout << endl;
-			}
+			ctxt_eq_p[lo].multiplyBy(ctxt_eq_p[hi]);
 		}
+		NTL_EXEC_RANGE_END
 
-		// cout << "Compute the less-than function modulo p" << endl;
-		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+		// move the merged blocks to the beginning, an unpaired most significant block is kept as is
+		for (long i = 1; i < pair_num; i++)
+		{
+			ctxt_less_p[i] = ctxt_less_p[2 * i];
+			ctxt_eq_p[i] = ctxt_eq_p[2 * i];
+		}
+		if (cur_len % 2)
 		{
-			Ctxt ctxt_tmp = Ctxt(ctxt_x.getPubKey());
-			less_than_bivar(ctxt_tmp, ctxt_x_p[iCoef], ctxt_y_p[iCoef]);
-			ctxt_less_p.push_back(ctxt_tmp);
+			ctxt_less_p[pair_num] = ctxt_less_p[cur_len - 1];
+			ctxt_eq_p[pair_num] = ctxt_eq_p[cur_len - 1];
 		}
 
-		// cout << "Compute the equality function modulo p" << endl;
+		cur_len = pair_num + (cur_len % 2);
+	}
+
+	ctxt_less = ctxt_less_p[0];
+	ctxt_eq = ctxt_eq_p[0];
+}
+
+void Comparator::less_eq_digits_univar(vector<Ctxt> &ctxt_less_p, vector<Ctxt> &ctxt_eq_p, const Ctxt &ctxt_z) const
+{
+	// extract mod p coefficients
+	// cout << "Extraction" << endl;
+	vector<Ctxt> ctxt_z_p;
+	extract_mod_p(ctxt_z_p, ctxt_z);
+
+	if (m_verbose)
+	{
 		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
 		{
-			// Subtraction z = x - y
-			// cout << "Subtraction" << endl;
-			Ctxt ctxt_z = ctxt_x_p[iCoef];
-			ctxt_z -= ctxt_y_p[iCoef];
-			Ctxt ctxt_tmp = Ctxt(ctxt_z.getPubKey());
-			is_zero(ctxt_tmp, ctxt_z);
-			ctxt_eq_p.push_back(ctxt_tmp);
+			cout << "Ctxt x with coefficient " << iCoef << endl;
+			print_decrypted(ctxt_z_p[iCoef]);
+			cout << endl;
 		}
 	}
-	else // univariate circuit
+
+	// cout << "Compute the less-than and equality functions modulo p" << endl;
+	for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
 	{
-		// Subtraction z = x - y
-		// cout << "Subtraction" << endl;
-		Ctxt ctxt_z = ctxt_x;
-		ctxt_z -= ctxt_y;
+		// the results are computed in place instead of being copied into the digit vectors
+		ctxt_less_p.emplace_back(ctxt_z.getPubKey());
+		ctxt_eq_p.emplace_back(ctxt_z.getPubKey());
+		Ctxt &ctxt_tmp = ctxt_less_p.back();
+		Ctxt &ctxt_tmp_eq = ctxt_eq_p.back();
+
+		// compute polynomial function for 'z < 0'
+		// cout << "Compute univariate comparison polynomial" << endl;
+		evaluate_univar_less_poly(ctxt_tmp, ctxt_tmp_eq, ctxt_z_p[iCoef]);
 
 		if (m_verbose)
 		{
-			print_decrypted(ctxt_z);
+			cout << "Result of the less-than function" << endl;
+			print_decrypted(ctxt_tmp);
 			cout << endl;
 		}
 
-		// extract mod p coefficients
-		// cout << "Extraction" << endl;
-		vector<Ctxt> ctxt_z_p;
-		extract_mod_p(ctxt_z_p, ctxt_z);
+		// cout << "Computing NOT" << endl;
+		// compute 1 - mapTo01(r_i*(x_i - y_i))
+		ctxt_tmp_eq.negate();
+		ctxt_tmp_eq.addConstant(ZZ(1));
 
 		if (m_verbose)
 		{
-			for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
-			{
-				cout << "Ctxt x with coefficient " << iCoef << endl;
-				print_decrypted(ctxt_z_p[iCoef]);
-				cout << endl;
-			}
+			cout << "Result of the equality function" << endl;
+			print_decrypted(ctxt_tmp_eq);
+			cout << endl;
 		}
+	}
+}
 
-		// cout << "Compute the less-than and equality functions modulo p" << endl;
-		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
-		{
-			Ctxt ctxt_tmp = Ctxt(ctxt_z.getPubKey());
-			Ctxt ctxt_tmp_eq = Ctxt(ctxt_z.getPubKey());
-
-			// compute polynomial function for 'z < 0'
-			// cout << "Compute univariate comparison polynomial" << endl;
-			evaluate_univar_less_poly(ctxt_tmp, ctxt_tmp_eq, ctxt_z_p[iCoef]);
+void Comparator::less_eq_digits_univar_plain(vector<vector<Ctxt>> &ctxt_less_p, vector<vector<Ctxt>> &ctxt_eq_p, const Ctxt &ctxt_x, const vector<vector<vector<long>>> &bounds_p) const
+{
+	const EncryptedArray &ea = m_context.getEA();
+	long p = m_context.getP();
+	long bound_num = bounds_p.size();
 
-			if (m_verbose)
-			{
-				cout << "Result of the less-than function" << endl;
-				print_decrypted(ctxt_tmp);
-				cout << endl;
-			}
+	// extract mod p coefficients of x once for all bounds
+	vector<Ctxt> ctxt_x_p;
+	extract_mod_p(ctxt_x_p, ctxt_x);
 
-			ctxt_less_p.push_back(ctxt_tmp);
+	// squares of the digits of x
+	vector<Ctxt> ctxt_x2_p(ctxt_x_p);
+	NTL_EXEC_RANGE(m_slotDeg, first, last)
+	for (long iCoef = first; iCoef < last; iCoef++)
+		ctxt_x2_p[iCoef].square();
+	NTL_EXEC_RANGE_END
 
-			// cout << "Computing NOT" << endl;
-			// compute 1 - mapTo01(r_i*(x_i - y_i))
-			ctxt_tmp_eq.negate();
-			ctxt_tmp_eq.addConstant(ZZ(1));
+	ctxt_less_p.assign(bound_num, vector<Ctxt>(m_slotDeg, Ctxt(m_pk)));
+	ctxt_eq_p.assign(bound_num, vector<Ctxt>(m_slotDeg, Ctxt(m_pk)));
 
-			if (m_verbose)
-			{
-				cout << "Result of the equality function" << endl;
-				print_decrypted(ctxt_tmp_eq);
-				cout << endl;
-			}
+	// every digit of every bound is an independent univariate circuit
+	NTL_EXEC_RANGE(bound_num * m_slotDeg, first, last)
+	for (long idx = first; idx < last; idx++)
+	{
+		long k = idx / m_slotDeg;
+		long iCoef = idx % m_slotDeg;
+		const vector<long> &y = bounds_p[k][iCoef];
 
-			ctxt_eq_p.push_back(ctxt_tmp_eq);
+		// -y, -2y and y^2 in every slot
+		vector<long> neg_y(y.size()), neg_2y(y.size()), y_sq(y.size());
+		for (size_t iSlot = 0; iSlot < y.size(); iSlot++)
+		{
+			neg_y[iSlot] = NegateMod(y[iSlot] % p, p);
+			neg_2y[iSlot] = AddMod(neg_y[iSlot], neg_y[iSlot], p);
+			y_sq[iSlot] = MulMod(y[iSlot] % p, y[iSlot] % p, p);
 		}
+		ZZX neg_y_poly, neg_2y_poly, y_sq_poly;
+		ea.encode(neg_y_poly, neg_y);
+		ea.encode(neg_2y_poly, neg_2y);
+		ea.encode(y_sq_poly, y_sq);
+
+		// z = x - y
+		Ctxt ctxt_z = ctxt_x_p[iCoef];
+		ctxt_z.addConstant(neg_y_poly);
+
+		// z^2 = x^2 - 2xy + y^2
+		Ctxt ctxt_z2 = ctxt_x_p[iCoef];
+		ctxt_z2.multByConstant(neg_2y_poly);
+		ctxt_z2 += ctxt_x2_p[iCoef];
+		ctxt_z2.addConstant(y_sq_poly);
+
+		Ctxt &ctxt_eq = ctxt_eq_p[k][iCoef];
+		evaluate_univar_less_poly(ctxt_less_p[k][iCoef], ctxt_eq, ctxt_z, ctxt_z2);
+
+		// 1 - z^{p-1}
+		ctxt_eq.negate();
+		ctxt_eq.addConstant(ZZ(1));
 	}
+	NTL_EXEC_RANGE_END
+}
 
+void Comparator::compare_from_digits(Ctxt &ctxt_res, Ctxt *ctxt_res_eq, vector<Ctxt> &ctxt_less_p, vector<Ctxt> &ctxt_eq_p, long layout) const
+{
 	// cout << "Compare digits" << endl;
-	Ctxt ctxt_less = ctxt_less_p[m_slotDeg - 1];
-	Ctxt ctxt_eq = ctxt_eq_p[m_slotDeg - 1];
-
-	for (long iCoef = m_slotDeg - 2; iCoef >= 0; iCoef--)
-	{
-		Ctxt tmp = ctxt_eq;
-		tmp.multiplyBy(ctxt_less_p[iCoef]);
-		ctxt_less += tmp;
-
-		ctxt_eq.multiplyBy(ctxt_eq_p[iCoef]);
-	}
+	Ctxt ctxt_less = Ctxt(ctxt_less_p[0].getPubKey());
+	Ctxt ctxt_eq = Ctxt(ctxt_less_p[0].getPubKey());
+	combine_digits(ctxt_less, ctxt_eq, ctxt_less_p, ctxt_eq_p);
 
 	if (m_verbose)
 	{
@@ -1793,15 +2276,20 @@ void Comparator::compare(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctxt &ctxt_y)
 		cout << endl;
 	}
 
-	if (m_expansionLen == 1)
+	if (batch_len(layout) == 1)
 	{
 		ctxt_res = ctxt_less;
+		if (ctxt_res_eq != nullptr)
+			*ctxt_res_eq = ctxt_eq;
 		return;
 	}
 
+	// the less-than results wait for the running products, so they can wait at their base level
+	drop_to_base(ctxt_less);
+
 	// compute running products: prod_i 1 - (x_i - y_i)^{p^d-1}
 	// cout << "Rotating and multiplying slots with equalities" << endl;
-	shift_and_mul(ctxt_eq, 0);
+	shift_and_mul(ctxt_eq, 0, false, layout);
 
 	if (m_verbose)
 	{
@@ -1809,9 +2297,14 @@ void Comparator::compare(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctxt &ctxt_y)
 		cout << endl;
 	}
 
+	// the first slot of every batch contains the product of all equalities, i.e. the equality of whole vectors
+	if (ctxt_res_eq != nullptr)
+		*ctxt_res_eq = ctxt_eq;
+
 	// Remove the least significant digit and shift to the left
 	// cout << "Remove the least significant digit" << endl;
-	batch_shift_for_mul(ctxt_eq, 0, -1);
+	drop_to_base(ctxt_eq);
+	batch_shift_for_mul(ctxt_eq, 0, -1, layout);
 
 	if (m_verbose)
 	{
@@ -1823,13 +2316,43 @@ void Comparator::compare(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctxt &ctxt_y)
 
 	ctxt_res = ctxt_eq;
 	ctxt_res.multiplyBy(ctxt_less);
-	shift_and_add(ctxt_res, 0);
+	shift_and_add(ctxt_res, 0, false, layout);
 
 	if (m_verbose)
 	{
 		print_decrypted(ctxt_res);
 		cout << endl;
 	}
+}
+
+void Comparator::compare(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctxt &ctxt_y, long layout) const
+{
+	ScratchCtxt ctxt_work(ctxt_x);
+	compare_in_place(ctxt_res, nullptr, *ctxt_work, ctxt_y, layout);
+}
+
+void Comparator::compare(Ctxt &ctxt_res, Ctxt &&ctxt_x, const Ctxt &ctxt_y, long layout) const
+{
+	compare_in_place(ctxt_res, nullptr, ctxt_x, ctxt_y, layout);
+}
+
+void Comparator::compare_full(Ctxt &ctxt_res, Ctxt &ctxt_res_eq, const Ctxt &ctxt_x, const Ctxt &ctxt_y, long layout) const
+{
+	ScratchCtxt ctxt_work(ctxt_x);
+	compare_in_place(ctxt_res, &ctxt_res_eq, *ctxt_work, ctxt_y, layout);
+}
+
+void Comparator::compare_full(Ctxt &ctxt_res, Ctxt &ctxt_res_eq, Ctxt &&ctxt_x, const Ctxt &ctxt_y, long layout) const
+{
+	compare_in_place(ctxt_res, &ctxt_res_eq, ctxt_x, ctxt_y, layout);
+}
+
+void Comparator::compare_in_place(Ctxt &ctxt_res, Ctxt *ctxt_res_eq, Ctxt &ctxt_x, const Ctxt &ctxt_y, long layout) const
+{
+	if (layout < 0 || layout >= static_cast<long>(m_layouts.size()))
+		throw helib::LogicError("Unknown batch layout");
+
+	HELIB_NTIMER_START(Comparison);
 
 	if (m_verbose)
 	{
@@ -1841,120 +2364,425 @@ void Comparator::compare(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ctxt &ctxt_y)
 		cout << endl;
 	}
 
-	HELIB_NTIMER_STOP(Comparison);
-}
-
-void Comparator::min_max_digit(Ctxt &ctxt_min, Ctxt &ctxt_max, const Ctxt &ctxt_x, const Ctxt &ctxt_y) const
-{
-	HELIB_NTIMER_START(MinMaxDigit);
-	if (m_type != UNI)
-		throw helib::LogicError("Min/Max is not implemented with the bivariate circuit");
-
-	if (m_expansionLen != 1 || m_slotDeg != 1)
-		throw helib::LogicError("Min/Max is not implemented for vectors over F_p");
+	// a single digit: less-than and equality share the powers of (x-y)^2
+	if (m_type == UNI && m_expansionLen == 1 && m_slotDeg == 1 && batch_len(layout) == 1)
+	{
+		digit_predicates(&ctxt_res, ctxt_res_eq, nullptr, nullptr, ctxt_x, ctxt_y);
+		HELIB_NTIMER_STOP(Comparison);
+		return;
+	}
 
-	// get EncryptedArray
-	const EncryptedArray &ea = m_context.getEA();
-	// extract slots
-	long nSlots = ea.size();
+	vector<Ctxt> ctxt_less_p;
+	vector<Ctxt> ctxt_eq_p;
 
-	vector<Ctxt> ctxt_min_p;
-	vector<Ctxt> ctxt_max_p;
+	// bivariate circuit
+	if (m_type == BI || m_type == TAN)
+	{
+		// the extraction applies Frobenius automorphisms to the inputs, so bring them to their base level first
+		ScratchCtxt ctxt_y_low(ctxt_y);
+		drop_to_base(ctxt_x);
+		drop_to_base(*ctxt_y_low);
 
-	// extract mod p coefficients
-	cout << "Extraction" << endl;
-	vector<Ctxt> ctxt_x_p;
-	extract_mod_p(ctxt_x_p, ctxt_x);
+		// cout << "Extraction" << endl;
+		//  extract mod p coefficients
+		vector<Ctxt> ctxt_x_p;
+		extract_mod_p(ctxt_x_p, ctxt_x);
 
-	if (m_verbose)
-	{
-		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+		if (m_verbose)
 		{
-			cout << "Ctxt x with coefficient " << iCoef << endl;
-			print_decrypted(ctxt_x_p[iCoef]);
-			cout << endl;
+			for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+			{
+				cout << "Ctxt x with coefficient " << iCoef << endl;
+				print_decrypted(ctxt_x_p[iCoef]);
+				cout << endl;
+			}
 		}
-	}
 
-	vector<Ctxt> ctxt_y_p;
-	extract_mod_p(ctxt_y_p, ctxt_y);
+		vector<Ctxt> ctxt_y_p;
+		extract_mod_p(ctxt_y_p, *ctxt_y_low);
 
-	if (m_verbose)
-	{
+		if (m_verbose)
+		{
+			for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+			{
+				cout << "Ctxt y with coefficient " << iCoef << endl;
+				print_decrypted(ctxt_y_p[iCoef]);
+				cout << endl;
+			}
+		}
+
+		// cout << "Compute the less-than function modulo p" << endl;
+		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+		{
+			ctxt_less_p.emplace_back(ctxt_x.getPubKey());
+			less_than_bivar(ctxt_less_p.back(), ctxt_x_p[iCoef], ctxt_y_p[iCoef]);
+		}
+
+		// cout << "Compute the equality function modulo p" << endl;
 		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
 		{
-			cout << "Ctxt y with coefficient " << iCoef << endl;
-			print_decrypted(ctxt_y_p[iCoef]);
+			// Subtraction z = x - y, the digits of x are not needed anymore
+			// cout << "Subtraction" << endl;
+			Ctxt &ctxt_z = ctxt_x_p[iCoef];
+			ctxt_z -= ctxt_y_p[iCoef];
+			ctxt_eq_p.emplace_back(ctxt_z.getPubKey());
+			is_zero(ctxt_eq_p.back(), ctxt_z);
+		}
+	}
+	else // univariate circuit
+	{
+		// Subtraction z = x - y
+		// cout << "Subtraction" << endl;
+		Ctxt &ctxt_z = ctxt_x;
+		ctxt_z -= ctxt_y;
+
+		if (m_verbose)
+		{
+			print_decrypted(ctxt_z);
 			cout << endl;
 		}
+
+		// the extraction applies Frobenius automorphisms to z, so bring it to its base level first
+		drop_to_base(ctxt_z);
+
+		// compute the less-than and equality functions of every digit
+		less_eq_digits_univar(ctxt_less_p, ctxt_eq_p, ctxt_z);
 	}
 
-	cout << "Compute min/max functions modulo p" << endl;
-	for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+	compare_from_digits(ctxt_res, ctxt_res_eq, ctxt_less_p, ctxt_eq_p, layout);
+
+	HELIB_NTIMER_STOP(Comparison);
+}
+
+void Comparator::compare(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ptxt<BGV> &ptxt_y) const
+{
+	Ctxt ctxt_eq(m_pk);
+	compare_full(ctxt_res, ctxt_eq, ctxt_x, ptxt_y);
+}
+
+void Comparator::compare_full(Ctxt &ctxt_res, Ctxt &ctxt_res_eq, const Ctxt &ctxt_x, const Ptxt<BGV> &ptxt_y) const
+{
+	HELIB_NTIMER_START(ComparisonPlain);
+
+	vector<Ctxt> ctxt_less_p;
+	vector<Ctxt> ctxt_eq_p;
+
+	// bivariate circuit
+	if (m_type == BI || m_type == TAN)
 	{
-		Ctxt ctxt_tmp_min = Ctxt(ctxt_x.getPubKey());
-		Ctxt ctxt_tmp_max = Ctxt(ctxt_x.getPubKey());
+		// extract mod p coefficients
+		vector<Ctxt> ctxt_x_p;
+		extract_mod_p(ctxt_x_p, ctxt_x);
 
-		// compute polynomial function for 'z < 0'
-		cout << "Compute univariate min/max polynomial" << endl;
-		evaluate_min_max_poly(ctxt_tmp_min, ctxt_tmp_max, ctxt_x_p[iCoef], ctxt_y_p[iCoef]);
+		// the digits of y are extracted in the clear
+		vector<vector<long>> y_p;
+		extract_mod_p(y_p, ptxt_y);
 
-		if (m_verbose)
+		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
 		{
-			cout << "Result of the min function" << endl;
-			print_decrypted(ctxt_tmp_min);
-			cout << endl;
+			// x < y and x == y are univariate polynomials in x sharing the powers of x
+			vector<Ctxt> ctxt_less, ctxt_eq;
+			digit_predicates_plain(ctxt_less, ctxt_eq, ctxt_x_p[iCoef], vector<vector<long>>(1, y_p[iCoef]));
+			ctxt_less_p.push_back(ctxt_less[0]);
+			ctxt_eq_p.push_back(ctxt_eq[0]);
 		}
+	}
+	else // univariate circuit
+	{
+		// Subtraction z = x - y without encrypting y
+		ScratchCtxt ctxt_z(ctxt_x);
+		*ctxt_z -= ptxt_y;
 
 		if (m_verbose)
 		{
-			cout << "Result of the max function" << endl;
-			print_decrypted(ctxt_tmp_max);
+			print_decrypted(*ctxt_z);
 			cout << endl;
 		}
 
-		ctxt_min_p.push_back(ctxt_tmp_min);
-		ctxt_max_p.push_back(ctxt_tmp_max);
+		// compute the less-than and equality functions of every digit
+		less_eq_digits_univar(ctxt_less_p, ctxt_eq_p, *ctxt_z);
+	}
+
+	compare_from_digits(ctxt_res, &ctxt_res_eq, ctxt_less_p, ctxt_eq_p);
+
+	HELIB_NTIMER_STOP(ComparisonPlain);
+}
+
+void Comparator::compare_batch(vector<Ctxt> &ctxt_res, const vector<Ctxt> &ctxt_x, const vector<Ctxt> &ctxt_y, vector<Ctxt> *ctxt_res_eq) const
+{
+	HELIB_NTIMER_START(ComparisonBatch);
+
+	if (ctxt_x.size() != ctxt_y.size())
+		throw helib::LogicError("Input vectors must have the same length");
+
+	long n = ctxt_x.size();
+	ctxt_res.assign(n, Ctxt(m_pk));
+	if (ctxt_res_eq != nullptr)
+		ctxt_res_eq->assign(n, Ctxt(m_pk));
+
+	// the bivariate circuits are evaluated independently for every pair
+	if (m_type != UNI)
+	{
+		NTL_EXEC_RANGE(n, first, last)
+		for (long i = first; i < last; i++)
+		{
+			if (ctxt_res_eq != nullptr)
+				compare_full(ctxt_res[i], (*ctxt_res_eq)[i], ctxt_x[i], ctxt_y[i]);
+			else
+				compare(ctxt_res[i], ctxt_x[i], ctxt_y[i]);
+		}
+		NTL_EXEC_RANGE_END
+	}
+	else
+	{
+		compare_batch_univar(ctxt_res, ctxt_res_eq, ctxt_x, ctxt_y);
 	}
 
-	ctxt_min = ctxt_min_p[0];
-	ctxt_max = ctxt_max_p[0];
+	// a single exit, so the throughput benchmarks of all circuit types read a stopped timer
+	HELIB_NTIMER_STOP(ComparisonBatch);
+}
+
+void Comparator::compare_batch_univar(vector<Ctxt> &ctxt_res, vector<Ctxt> *ctxt_res_eq, const vector<Ctxt> &ctxt_x, const vector<Ctxt> &ctxt_y) const
+{
+	long n = ctxt_x.size();
+	long p = m_context.getP();
 
-	for (long iCoef = 1; iCoef < m_slotDeg; iCoef++)
+	// stage 1: digits of the differences z = x - y
+	vector<vector<Ctxt>> ctxt_z_p(n);
+	NTL_EXEC_RANGE(n, first, last)
+	for (long i = first; i < last; i++)
+	{
+		Ctxt ctxt_z = ctxt_x[i];
+		ctxt_z -= ctxt_y[i];
+		extract_mod_p(ctxt_z_p[i], ctxt_z);
+	}
+	NTL_EXEC_RANGE_END
+
+	// stage 2: squares of all digits
+	long digit_num = n * m_slotDeg;
+	vector<Ctxt> ctxt_z2(digit_num, Ctxt(m_pk));
+	NTL_EXEC_RANGE(digit_num, first, last)
+	for (long k = first; k < last; k++)
+	{
+		ctxt_z2[k] = ctxt_z_p[k / m_slotDeg][k % m_slotDeg];
+		ctxt_z2[k].square();
+	}
+	NTL_EXEC_RANGE_END
+
+	// stage 3: f(z^2) and z^{p-1} of all digits following the same schedule
+	vector<ZZX> polys;
+	polys.push_back(m_univar_less_poly_raw);
+	polys.push_back(ZZX(INIT_MONO, (p - 1) >> 1, 1));
+	vector<vector<Ctxt>> ctxt_polys;
+	batchPolyEval(ctxt_polys, polys, ctxt_z2, 0, m_lazyRelin);
+
+	// stage 4: less-than and equality of digits and their combination
+	ZZ half = ZZ((p + 1) >> 1);
+	NTL_EXEC_RANGE(n, first, last)
+	for (long i = first; i < last; i++)
 	{
-		vector<ZZX> x_power(nSlots, ZZX(INIT_MONO, iCoef, 1));
-		ZZX x_power_ptxt;
-		ea.encode(x_power_ptxt, x_power);
+		vector<Ctxt> ctxt_less_p;
+		vector<Ctxt> ctxt_eq_p;
+		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+		{
+			vector<Ctxt> &ctxt_vals = ctxt_polys[i * m_slotDeg + iCoef];
+			for (size_t j = 0; j < ctxt_vals.size(); j++)
+			{
+				if (!ctxt_vals[j].inCanonicalForm())
+					ctxt_vals[j].reLinearize();
+			}
+
+			// z * f(z^2) + (p+1)/2 * z^{p-1}
+			Ctxt ctxt_less = ctxt_vals[0];
+			ctxt_less.multiplyBy(ctxt_z_p[i][iCoef]);
+			Ctxt top_term = ctxt_vals[1];
+			top_term.multByConstant(half);
+			ctxt_less += top_term;
+			ctxt_less_p.push_back(ctxt_less);
+
+			// 1 - z^{p-1}
+			Ctxt ctxt_eq = ctxt_vals[1];
+			ctxt_eq.negate();
+			ctxt_eq.addConstant(ZZ(1));
+			ctxt_eq_p.push_back(ctxt_eq);
+		}
+		compare_from_digits(ctxt_res[i], ctxt_res_eq != nullptr ? &(*ctxt_res_eq)[i] : nullptr, ctxt_less_p, ctxt_eq_p);
+	}
+	NTL_EXEC_RANGE_END
+}
+
+void Comparator::compare_wide(Ctxt &ctxt_res, const vector<Ctxt> &ctxt_x, const vector<Ctxt> &ctxt_y, Ctxt *ctxt_res_eq) const
+{
+	if (ctxt_x.empty())
+		throw helib::LogicError("Wide integers need at least one chunk");
+
+	// less-than and equality of all chunks stage by stage on the thread pool
+	vector<Ctxt> ctxt_less_c;
+	vector<Ctxt> ctxt_eq_c;
+	compare_batch(ctxt_less_c, ctxt_x, ctxt_y, &ctxt_eq_c);
+
+	HELIB_NTIMER_START(ComparisonWide);
+	// chunks are combined like the digits of a slot by a tree of depth ceil(log2(chunk number))
+	Ctxt ctxt_eq(m_pk);
+	combine_digits(ctxt_res, ctxt_eq, ctxt_less_c, ctxt_eq_c);
+	if (ctxt_res_eq != nullptr)
+		*ctxt_res_eq = ctxt_eq;
+	HELIB_NTIMER_STOP(ComparisonWide);
+}
+
+void Comparator::min_max_digit(Ctxt &ctxt_min, Ctxt &ctxt_max, const Ctxt &ctxt_x, const Ctxt &ctxt_y) const
+{
+	HELIB_NTIMER_START(MinMaxDigit);
 
-		// agregate minimum values
-		Ctxt tmp = ctxt_min_p[iCoef];
-		tmp.multByConstant(x_power_ptxt);
-		ctxt_min += tmp;
+	// z^2 and its powers are shared by the minimum and the maximum
+	digit_predicates(nullptr, nullptr, &ctxt_min, &ctxt_max, ctxt_x, ctxt_y);
 
-		// agregate maximum values
-		tmp = ctxt_max_p[iCoef];
-		tmp.multByConstant(x_power_ptxt);
-		ctxt_max += tmp;
+	if (m_verbose)
+	{
+		cout << "Result of the min function" << endl;
+		print_decrypted(ctxt_min);
+		cout << endl;
+		cout << "Result of the max function" << endl;
+		print_decrypted(ctxt_max);
+		cout << endl;
 	}
 
 	HELIB_NTIMER_STOP(MinMaxDigit);
 }
 
+void Comparator::digit_predicates(Ctxt *ctxt_less, Ctxt *ctxt_eq, Ctxt *ctxt_min, Ctxt *ctxt_max, const Ctxt &ctxt_x, const Ctxt &ctxt_y) const
+{
+	HELIB_NTIMER_START(DigitPredicates);
+	if (m_type != UNI)
+		throw helib::LogicError("Digit predicates are only implemented with the univariate circuit");
+
+	if (m_expansionLen != 1 || m_slotDeg != 1)
+		throw helib::LogicError("Digit predicates are not implemented for vectors over F_p");
+
+	bool want_cmp = ctxt_less != nullptr || ctxt_eq != nullptr;
+	bool want_min_max = ctxt_min != nullptr || ctxt_max != nullptr;
+
+	// a single kind of predicate is evaluated by its Paterson-Stockmeyer circuit,
+	// the shared baby-step giant-step schedule below is deeper and pays off only for several kinds
+	if (!want_min_max)
+	{
+		Ctxt ctxt_z = ctxt_x;
+		ctxt_z -= ctxt_y;
+		Ctxt ctxt_res(m_pk);
+		Ctxt ctxt_p_1(m_pk);
+		evaluate_univar_less_poly(ctxt_res, ctxt_p_1, ctxt_z);
+		if (ctxt_less != nullptr)
+			*ctxt_less = ctxt_res;
+		if (ctxt_eq != nullptr)
+		{
+			// 1 - z^{p-1}
+			*ctxt_eq = ctxt_p_1;
+			ctxt_eq->negate();
+			ctxt_eq->addConstant(ZZ(1));
+		}
+		HELIB_NTIMER_STOP(DigitPredicates);
+		return;
+	}
+	if (!want_cmp)
+	{
+		// the outputs may alias the inputs
+		Ctxt ctxt_res_min(m_pk);
+		Ctxt ctxt_res_max(m_pk);
+		evaluate_min_max_poly(ctxt_res_min, ctxt_res_max, ctxt_x, ctxt_y);
+		if (ctxt_min != nullptr)
+			*ctxt_min = ctxt_res_min;
+		if (ctxt_max != nullptr)
+			*ctxt_max = ctxt_res_max;
+		HELIB_NTIMER_STOP(DigitPredicates);
+		return;
+	}
+
+	long p = m_context.getP();
+	ZZ half = ZZ((p + 1) >> 1);
+
+	// Subtraction z = x - y
+	Ctxt ctxt_z = ctxt_x;
+	ctxt_z -= ctxt_y;
+
+	// all predicates are polynomials in z^2
+	Ctxt ctxt_z2 = ctxt_z;
+	ctxt_z2.square();
+
+	// (p+1)/2 * (x + y) of min/max, the inputs are not read after this point, so the outputs may alias them
+	Ctxt last_term = ctxt_x;
+	last_term += ctxt_y;
+	last_term.multByConstant(half);
+
+	// f(z^2) for less-than, z^{p-1} for less-than and equality, z^2 * f(z^2) for min/max
+	vector<ZZX> polys;
+	long f_index = -1;
+	if (ctxt_less != nullptr)
+	{
+		f_index = polys.size();
+		polys.push_back(m_univar_less_poly_raw);
+	}
+	long top_index = polys.size();
+	polys.push_back(ZZX(INIT_MONO, (p - 1) >> 1, 1));
+	long g_index = polys.size();
+	polys.push_back(m_univar_min_max_poly_raw);
+
+	// the powers of z^2 are computed once for all polynomials
+	vector<Ctxt> ctxt_polys;
+	multiPolyEval(ctxt_polys, polys, ctxt_z2, 0, m_lazyRelin);
+	for (size_t i = 0; i < ctxt_polys.size(); i++)
+	{
+		if (!ctxt_polys[i].inCanonicalForm())
+			ctxt_polys[i].reLinearize();
+	}
+
+	if (ctxt_less != nullptr)
+	{
+		// z * f(z^2) + (p+1)/2 * z^{p-1}
+		*ctxt_less = ctxt_polys[f_index];
+		ctxt_less->multiplyBy(ctxt_z);
+		Ctxt top_term = ctxt_polys[top_index];
+		top_term.multByConstant(half);
+		*ctxt_less += top_term;
+	}
+
+	if (ctxt_eq != nullptr)
+	{
+		// 1 - z^{p-1}
+		*ctxt_eq = ctxt_polys[top_index];
+		ctxt_eq->negate();
+		ctxt_eq->addConstant(ZZ(1));
+	}
+
+	if (ctxt_min != nullptr)
+	{
+		*ctxt_min = last_term;
+		*ctxt_min += ctxt_polys[g_index];
+	}
+	if (ctxt_max != nullptr)
+	{
+		*ctxt_max = last_term;
+		*ctxt_max -= ctxt_polys[g_index];
+	}
+
+	HELIB_NTIMER_STOP(DigitPredicates);
+}
+
 void Comparator::min_max(Ctxt &ctxt_min, Ctxt &ctxt_max, const Ctxt &ctxt_x, const Ctxt &ctxt_y) const
 {
 	HELIB_NTIMER_START(MinMax);
 	if (m_type == UNI && m_expansionLen == 1 && m_slotDeg == 1)
 	{
 		min_max_digit(ctxt_min, ctxt_max, ctxt_x, ctxt_y);
+		HELIB_NTIMER_STOP(MinMax);
 		return;
 	}
 
-	Ctxt ctxt_z = ctxt_x;
-	ctxt_z -= ctxt_y;
+	ScratchCtxt ctxt_z(ctxt_x);
+	*ctxt_z -= ctxt_y;
 
-	Ctxt ctxt_tmp = Ctxt(ctxt_z.getPubKey());
+	Ctxt ctxt_tmp = Ctxt(ctxt_z->getPubKey());
 	compare(ctxt_tmp, ctxt_x, ctxt_y);
-	ctxt_tmp.multiplyBy(ctxt_z);
+	ctxt_tmp.multiplyBy(*ctxt_z);
 
 	ctxt_min = ctxt_y;
 	ctxt_min += ctxt_tmp;
@@ -1988,415 +2816,2510 @@ void Comparator::min_max(Ctxt &ctxt_min, Ctxt &ctxt_max, const Ctxt &ctxt_x, con
 	HELIB_NTIMER_STOP(MinMax);
 }
 
-void Comparator::array_min(Ctxt &ctxt_res, const vector<Ctxt> &ctxt_in, long depth) const
+void Comparator::min_max_in_place(Ctxt &ctxt_x, Ctxt &ctxt_y) const
 {
-	HELIB_NTIMER_START(ArrayMin);
-
-	if (depth < 0)
-		throw helib::LogicError("depth parameter must be non-negative");
-
-	cout << "Computing the minimum of an array" << endl;
-
-	size_t input_len = ctxt_in.size();
+	HELIB_NTIMER_START(MinMax);
+	if (m_type == UNI && m_expansionLen == 1 && m_slotDeg == 1)
+	{
+		min_max_digit(ctxt_x, ctxt_y, ctxt_x, ctxt_y);
+		HELIB_NTIMER_STOP(MinMax);
+		return;
+	}
 
-	vector<Ctxt> ctxt_res_vec;
-	for (size_t i = 0; i < input_len; i++)
+	// c = y < x
+	Ctxt ctxt_tmp = Ctxt(m_pk);
 	{
-		ctxt_res_vec.push_back(ctxt_in[i]);
+		ScratchCtxt ctxt_work(ctxt_y);
+		compare_in_place(ctxt_tmp, nullptr, *ctxt_work, ctxt_x);
 	}
 
-	size_t cur_len = input_len;
-	long level = depth;
+	// c * (y - x)
+	ScratchCtxt ctxt_diff(ctxt_y);
+	*ctxt_diff -= ctxt_x;
+	ctxt_tmp.multiplyBy(*ctxt_diff);
 
-	while (cur_len > 1 && level > 0)
+	// min = x + c * (y - x), max = y - c * (y - x)
+	ctxt_x += ctxt_tmp;
+	ctxt_y -= ctxt_tmp;
+
+	if (m_verbose)
 	{
-		cout << "Comparison level: " << depth - level << endl;
-		// compare x[i] and x[n-1-i] where n is the length of ctxt_res_vec
-		for (size_t i = 0; i < (cur_len >> 1); i++)
-		{
-			if (i != cur_len - 1 - i)
-			{
-				cout << "Comparing ciphertexts " << i << " and " << cur_len - 1 - i << endl;
-				min_max(ctxt_res_vec[i], ctxt_res_vec[cur_len - 1 - i], ctxt_res_vec[i], ctxt_res_vec[cur_len - 1 - i]);
-			}
-		}
-		cur_len = (cur_len >> 1) + (cur_len % 2);
-		ctxt_res_vec.resize(cur_len, Ctxt(m_pk));
-		level--;
+		cout << "Minimum" << endl;
+		print_decrypted(ctxt_x);
+		cout << endl;
+		cout << "Maximum" << endl;
+		print_decrypted(ctxt_y);
+		cout << endl;
 	}
+	HELIB_NTIMER_STOP(MinMax);
+}
 
-	if (cur_len > 1)
-	{
-		// plaintext modulus
-		long p = m_context.getP();
-		// multiplications in the equality circuit
-		long eq_mul_num = static_cast<long>(floor(log2(p - 1))) + weight(ZZ(p - 1)) - 1;
-		long eq_depth = static_cast<long>(ceil(log2(p - 1)));
-		long prod_depth = static_cast<long>(ceil(log2(cur_len - 1)));
+void Comparator::min_max(Ctxt &ctxt_min, Ctxt &ctxt_max, const Ctxt &ctxt_x, const Ptxt<BGV> &ptxt_y) const
+{
+	HELIB_NTIMER_START(MinMaxPlain);
 
-		if ((((cur_len - 2 > eq_mul_num) && (eq_depth == prod_depth)) || (eq_depth < prod_depth)) && cur_len <= p)
-		{
-			cout << "Computing minimum via equality" << endl;
-			cout << "Mult. of equality: " << eq_mul_num << endl;
-			cout << "Depth of equality: " << eq_depth << endl;
-			cout << "Depth of product: " << prod_depth << endl;
-			// create a table with all pairwise comparisons and compute the Hamming weight of every row
-			vector<Ctxt> ham_weights;
-			get_sorting_index(ham_weights, ctxt_res_vec);
+	Ctxt ctxt_z = ctxt_x;
+	ctxt_z -= ptxt_y;
 
-			cout << "Computing the minimum" << endl;
-			ctxt_res = Ctxt(m_pk);
-			for (size_t i = 0; i < ctxt_res_vec.size(); i++)
-			{
-				// compare the Hamming weight of the jth row with i
-				Ctxt tmp_prod = ham_weights[i];
-				tmp_prod.addConstant(ZZX(-(cur_len - 1)));
-				mapTo01_subfield(tmp_prod, 1);
-				tmp_prod.negate();
-				tmp_prod.addConstant(ZZX(1));
+	Ctxt ctxt_tmp = Ctxt(ctxt_z.getPubKey());
+	compare(ctxt_tmp, ctxt_x, ptxt_y);
+	ctxt_tmp.multiplyBy(ctxt_z);
 
-				// multiply by the jth input ciphertext
-				tmp_prod.multiplyBy(ctxt_res_vec[i]);
-				if (i == 0)
-					ctxt_res = tmp_prod;
-				else
-					ctxt_res += tmp_prod;
-			}
-		}
-		else
-		{
-			cout << "Computing minimum via punctured products" << endl;
-			cout << "Mult. of equality: " << eq_mul_num << endl;
-			cout << "Depth of equality: " << eq_depth << endl;
-			cout << "Depth of product: " << prod_depth << endl;
-			vector<vector<Ctxt>> ctxt_products;
-			// compute the product of every row
-			for (size_t i = 0; i < ctxt_res_vec.size(); i++)
-			{
-				vector<Ctxt> ctxt_vec;
-				ctxt_products.push_back(ctxt_vec);
-			}
+	// min = y + (x < y) * (x - y)
+	ctxt_min = ctxt_tmp;
+	ctxt_min += ptxt_y;
 
-			cout << "Computing the comparison table" << endl;
-			for (size_t i = 0; i < ctxt_res_vec.size() - 1; i++)
-			{
-				cout << "Computing Row " << i << endl;
-				for (size_t j = i + 1; j < ctxt_res_vec.size(); j++)
-				{
-					cout << "Computing Column " << j << endl;
-					// compute upper diagonal entries of the comparison table and multiply them
-					Ctxt comp_col = Ctxt(m_pk);
-					compare(comp_col, ctxt_res_vec[i], ctxt_res_vec[j]);
+	// max = x - (x < y) * (x - y)
+	ctxt_max = ctxt_x;
+	ctxt_max -= ctxt_tmp;
 
-					if (ctxt_products[i].empty())
-					{
-						ctxt_products[i].push_back(comp_col);
-					}
-					else
-					{
-						long wt = weight(ZZ(j));
-						int len_i = ctxt_products[i].size();
-						if (wt > len_i)
-						{
-							ctxt_products[i].push_back(comp_col);
-						}
-						else
-						{
-							ctxt_products[i][len_i - 1].multiplyBy(comp_col);
-							for (int k = len_i - 2; k >= (wt - 1); k--)
-							{
-								ctxt_products[i][k].multiplyBy(ctxt_products[i][k + 1]);
-								ctxt_products[i].pop_back();
-							}
-						}
-					}
+	if (m_verbose)
+	{
+		cout << "Minimum" << endl;
+		print_decrypted(ctxt_min);
+		cout << endl;
 
-					// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
-					// NOT the result to multiply to the jth row
-					comp_col.negate();
-					comp_col.addConstant(ZZ(1));
+		cout << "Maximum" << endl;
+		print_decrypted(ctxt_max);
+		cout << endl;
+	}
 
-					if (ctxt_products[j].empty())
-					{
-						ctxt_products[j].push_back(comp_col);
-					}
-					else
-					{
-						long wt = weight(ZZ(i + 1));
-						int len_j = ctxt_products[j].size();
-						if (wt > len_j)
-						{
-							ctxt_products[j].push_back(comp_col);
-						}
-						else
-						{
-							ctxt_products[j][len_j - 1].multiplyBy(comp_col);
-							for (int k = len_j - 2; k >= (wt - 1); k--)
-							{
-								ctxt_products[j][k].multiplyBy(ctxt_products[j][k + 1]);
-								ctxt_products[j].pop_back();
-							}
-						}
-					}
-				}
-			}
+	HELIB_NTIMER_STOP(MinMaxPlain);
+}
 
-			cout << "Computing the minimum" << endl;
-			ctxt_res = Ctxt(m_pk);
-			for (size_t i = 0; i < ctxt_res_vec.size(); i++)
-			{
-				int len_i = ctxt_products[i].size();
-				for (int k = len_i - 2; k >= 0; k--)
-				{
-					ctxt_products[i][k].multiplyBy(ctxt_products[i][k + 1]);
-					ctxt_products[i].pop_back();
-				}
-				Ctxt tmp_prod = ctxt_products[i][0];
+void Comparator::in_range(Ctxt &ctxt_res, const Ctxt &ctxt_x, const Ptxt<BGV> &ptxt_lo, const Ptxt<BGV> &ptxt_hi) const
+{
+	HELIB_NTIMER_START(InRange);
 
-				// multiply by the ith input ciphertext
-				tmp_prod.multiplyBy(ctxt_res_vec[i]);
+	// digits of the bounds in the clear
+	vector<vector<vector<long>>> bounds_p(2);
+	extract_mod_p(bounds_p[0], ptxt_lo);
+	extract_mod_p(bounds_p[1], ptxt_hi);
 
-				// add to the result
-				ctxt_res += tmp_prod;
-			}
-		}
+	vector<Ctxt> ctxt_less_lo, ctxt_eq_lo, ctxt_less_hi, ctxt_eq_hi;
+	if (m_type == UNI)
+	{
+		// univariate circuits of x - lo and x - hi sharing the digits of x and their squares
+		vector<vector<Ctxt>> ctxt_less_p, ctxt_eq_p;
+		less_eq_digits_univar_plain(ctxt_less_p, ctxt_eq_p, ctxt_x, bounds_p);
+
+		ctxt_less_lo = ctxt_less_p[0];
+		ctxt_eq_lo = ctxt_eq_p[0];
+		ctxt_less_hi = ctxt_less_p[1];
+		ctxt_eq_hi = ctxt_eq_p[1];
 	}
 	else
 	{
-		ctxt_res = ctxt_res_vec[0];
+		// the bivariate circuits are more expensive than the univariate polynomials of x with public coefficients
+		vector<Ctxt> ctxt_x_p;
+		extract_mod_p(ctxt_x_p, ctxt_x);
+
+		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+		{
+			// the powers of the digit are shared by the predicates of both bounds
+			vector<vector<long>> bounds;
+			bounds.push_back(bounds_p[0][iCoef]);
+			bounds.push_back(bounds_p[1][iCoef]);
+
+			vector<Ctxt> ctxt_less, ctxt_eq;
+			digit_predicates_plain(ctxt_less, ctxt_eq, ctxt_x_p[iCoef], bounds);
+
+			ctxt_less_lo.push_back(ctxt_less[0]);
+			ctxt_eq_lo.push_back(ctxt_eq[0]);
+			ctxt_less_hi.push_back(ctxt_less[1]);
+			ctxt_eq_hi.push_back(ctxt_eq[1]);
+		}
 	}
 
-	HELIB_NTIMER_STOP(ArrayMin);
+	Ctxt ctxt_lo = Ctxt(ctxt_x.getPubKey());
+	Ctxt ctxt_lo_eq = Ctxt(ctxt_x.getPubKey());
+	combine_digits(ctxt_lo, ctxt_lo_eq, ctxt_less_lo, ctxt_eq_lo);
+
+	Ctxt ctxt_hi = Ctxt(ctxt_x.getPubKey());
+	Ctxt ctxt_hi_eq = Ctxt(ctxt_x.getPubKey());
+	combine_digits(ctxt_hi, ctxt_hi_eq, ctxt_less_hi, ctxt_eq_hi);
+
+	// lo <= x < hi is equal to (x < hi) - (x < lo) if lo <= hi
+	if (m_expansionLen > 1)
+	{
+		// running products of equalities without the least significant digit
+		shift_and_mul(ctxt_lo_eq, 0);
+		batch_shift_for_mul(ctxt_lo_eq, 0, -1);
+		shift_and_mul(ctxt_hi_eq, 0);
+		batch_shift_for_mul(ctxt_hi_eq, 0, -1);
+
+		ctxt_lo.multiplyBy(ctxt_lo_eq);
+		ctxt_hi.multiplyBy(ctxt_hi_eq);
+	}
+
+	ctxt_res = ctxt_hi;
+	ctxt_res -= ctxt_lo;
+
+	// the sum over the digits is linear, so both bounds need only one shift_and_add
+	if (m_expansionLen > 1)
+		shift_and_add(ctxt_res, 0);
+
+	if (m_verbose)
+	{
+		cout << "Range check results" << endl;
+		print_decrypted(ctxt_res);
+		cout << endl;
+	}
+
+	HELIB_NTIMER_STOP(InRange);
 }
 
-void Comparator::int_to_slot(ZZX &poly, unsigned long input, unsigned long enc_base) const
+// depth of the less-than and equality functions of one digit by the univariate circuit
+static long univar_digit_depth(long p, bool batched)
 {
-	vector<long> decomp;
+	// z + 2z^2
+	if (p <= 3)
+		return 1;
+
+	// z^{p-1} = (z^2)^{(p-1)/2}
+	long top_deg = (p - 1) >> 1;
+
+	// f(z^2) and (z^2)^{(p-1)/2} on one baby-step giant-step schedule, z^2 before and the product with z after it
+	if (batched)
+		return batchPolyEvalDepth(top_deg) + 2;
+
+	// z^2, Paterson-Stockmeyer for g(z^2) and the product with z
+	long less_deg = (p - 3) >> 1;
+	long k = univar_baby_steps(p, less_deg);
+	long less_depth = patersonStockmeyerDepth(less_deg, k) + 2;
+
+	// z^{p-1} is the product of a baby step and a giant step of z^2 (see compute_poly_params)
+	long baby_index = top_deg % k;
+	long giant_index = top_deg / k;
+	if (baby_index == 0)
+	{
+		baby_index = k;
+		giant_index -= 1;
+	}
+	long top_depth = 1 + max(ceilLog2(baby_index), ceilLog2(k) + ceilLog2(giant_index)) + 1;
 
-	// decomposition of a digit
-	digit_decomp(decomp, input, enc_base, m_slotDeg);
-	poly = ZZX(INIT_MONO, 0, 0);
-	for (int iCoef = 0; iCoef < m_slotDeg; iCoef++)
+	return max(less_depth, top_depth);
+}
+
+// depth of evaluate_slot_poly for the polynomials of degree p-1 of digit_predicates_plain
+static long plain_digit_depth(long p)
+{
+	long baby_num = static_cast<long>(ceil(sqrt(static_cast<double>(p))));
+	long degree = p - 1;
+
+	// the giant steps x^{g*k} are powers of x
+	long depth = ceilLog2(min(baby_num - 1, degree));
+	for (long giant = 1; giant * baby_num <= degree; giant++)
 	{
-		poly += ZZX(INIT_MONO, iCoef, decomp[iCoef]);
+		long block_deg = min(baby_num - 1, degree - giant * baby_num);
+		long giant_depth = ceilLog2(giant * baby_num);
+		if (block_deg == 0)
+			depth = max(depth, giant_depth);
+		else
+			depth = max(depth, max(ceilLog2(block_deg), giant_depth) + 1);
 	}
+	return depth;
 }
 
-void Comparator::get_sorting_index(vector<Ctxt> &ctxt_out, const vector<Ctxt> &ctxt_in) const
+// depth of combining the digits of a slot and the slots of a batch (compare_from_digits)
+static long combined_depth(long digit_depth, unsigned long d, unsigned long expansion_len)
 {
-	ctxt_out.clear();
+	// combination of digits
+	long res_depth = digit_depth + ceilLog2(d);
 
-	// length of the input vector
-	size_t input_len = ctxt_in.size();
+	// running products of equalities and the final multiplication
+	if (expansion_len > 1)
+		res_depth += ceilLog2(expansion_len) + 1;
 
-	// plaintext modulus
-	long p = m_context.getP();
+	return res_depth;
+}
 
-	if (input_len > p)
-		throw helib::LogicError("The number of ciphertexts cannot be larger than the plaintext modulus");
+long Comparator::compare_depth(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len, bool batched)
+{
+	long p_depth = static_cast<long>(ceil(log2(p - 1)));
 
-	// compute the Hamming weight of every row
-	for (size_t i = 0; i < input_len; i++)
+	// depth of the less-than and equality functions of one digit
+	long digit_depth = 0;
+	if (type == UNI)
 	{
-		// initialize Hamming weights to zero
-		Ctxt ctxt_tmp = Ctxt(ctxt_in[0].getPubKey());
-		ctxt_out.push_back(ctxt_tmp);
+		digit_depth = univar_digit_depth(p, batched);
+	}
+	else if (type == TAN)
+	{
+		// x^i * sum_j c_ij y^j and the equality circuit
+		digit_depth = p_depth + 1;
+	}
+	else if (type == BI)
+	{
+		// Y = y(x-y), f_i(x) * Y^i, (x+1) and Y
+		if (p <= 3)
+			digit_depth = p;
+		else
+			digit_depth = max(p_depth, static_cast<long>(ceil(log2(p - 3))) + 3);
+	}
+	else
+	{
+		throw helib::LogicError("Depth estimation is not available for PSM circuits");
 	}
 
-	cout << "Computing the comparison table" << endl;
-	for (size_t i = 0; i < input_len - 1; i++)
+	return combined_depth(digit_depth, d, expansion_len);
+}
+
+long Comparator::range_depth(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len)
+{
+	// the univariate circuit of x - y has the depth of a comparison
+	if (type == UNI)
+		return compare_depth(type, p, d, expansion_len);
+
+	if (type != BI && type != TAN)
+		throw helib::LogicError("Depth estimation is not available for PSM circuits");
+
+	// polynomials of x with public coefficients
+	return combined_depth(plain_digit_depth(p), d, expansion_len);
+}
+
+double Comparator::compare_cost(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len)
+{
+	// multiplications in the equality circuit
+	double eq_mul_num = floor(log2(p - 1)) + weight(ZZ(p - 1)) - 1;
+
+	// cost of the less-than and equality functions of one digit
+	double digit_cost = 0;
+	if (type == UNI)
 	{
-		cout << "Computing Row " << i << endl;
-		for (size_t j = i + 1; j < input_len; j++)
-		{
-			cout << "Computing Column " << j << endl;
-			// compute upper diagonal entries of the comparison table and sum them
-			Ctxt comp_col_j = Ctxt(ctxt_in[0].getPubKey());
-			compare(comp_col_j, ctxt_in[i], ctxt_in[j]);
-			ctxt_out[i] += comp_col_j;
+		// baby steps and giant steps of the Paterson-Stockmeyer algorithm for the degree (p-3)/2
+		double deg = (p > 3) ? (p - 3) / 2.0 : 1.0;
+		double bs = max(1.0, floor(sqrt(deg / 2.0)));
+		digit_cost = 1 + bs + 2 * ceil(deg / bs) + 2;
+	}
+	else if (type == TAN)
+	{
+		digit_cost = 3.0 * (p - 1) + eq_mul_num;
+	}
+	else if (type == BI)
+	{
+		digit_cost = 2.0 * p + eq_mul_num;
+	}
+	else
+	{
+		throw helib::LogicError("Cost estimation is not available for PSM circuits");
+	}
 
-			// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
-			// NOT the result to add to the jth row
-			comp_col_j.negate();
-			comp_col_j.addConstant(ZZ(1));
+	double res_cost = d * digit_cost;
 
-			// add lower diagonal entries to Hamming weight accumulators of related rows
-			ctxt_out[j] += comp_col_j;
-		}
+	// extraction of digits by Frobenius maps and the combination of digits
+	if (d > 1)
+		res_cost += (type == UNI ? 1 : 2) * (d - 1) + 2 * (d - 1);
+
+	// shifts and multiplications of running products and sums
+	if (expansion_len > 1)
+		res_cost += 3 * ceil(log2(expansion_len)) + 1;
+
+	return res_cost;
+}
+
+long Comparator::circuit_depth(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len, unsigned long set_ptxts, unsigned long sort_len)
+{
+	long p_depth = static_cast<long>(ceil(log2(p - 1)));
+	long d_depth = static_cast<long>(ceil(log2(d)));
+	long l_depth = static_cast<long>(ceil(log2(expansion_len)));
+
+	if (type == PSM || type == PSMS)
+	{
+		// product over the set plaintexts (only without expansion), map to 0/1, product over digits and the cleaning mask
+		long set_depth = (expansion_len == 1) ? static_cast<long>(ceil(log2(max(set_ptxts, 1UL)))) : 0;
+		return set_depth + p_depth + d_depth + l_depth + 1;
 	}
+
+	long depth = compare_depth(type, p, d, expansion_len);
+
+	// equality of the Hamming weights of comparison table rows with every index and the product with the inputs
+	if (sort_len > 0)
+		depth += p_depth + 1;
+
+	return depth;
 }
 
-void Comparator::sort(vector<Ctxt> &ctxt_out, const vector<Ctxt> &ctxt_in) const
+double Comparator::level_bits(unsigned long p, unsigned long phim)
 {
-	HELIB_NTIMER_START(Sorting);
+	// a multiplication consumes about the size of the noise left after modulus switching
+	return log2(p) + 0.5 * log2(phim) + 3.0;
+}
 
-	ctxt_out.clear();
+long Comparator::modulus_bits(CircuitType type, unsigned long p, unsigned long d, unsigned long m, unsigned long expansion_len, unsigned long set_size, unsigned long sort_len, double margin)
+{
+	long phim = phi_N(m);
 
-	// length of the input vector
-	size_t input_len = ctxt_in.size();
+	// set elements are packed into plaintexts of phi(m)/ord(p) slots
+	unsigned long set_ptxts = 1;
+	if (type == PSM || type == PSMS)
+	{
+		unsigned long nslots = phim / multOrd(p, m);
+		set_ptxts = max(1UL, (set_size * expansion_len + nslots - 1) / nslots);
+	}
+
+	long depth = circuit_depth(type, p, d, expansion_len, set_ptxts, sort_len);
+
+	// noise of a fresh encryption, the levels of the circuit and the room left for decryption
+	double fresh_bits = log2(p) + log2(phim);
+	double bits = fresh_bits + depth * level_bits(p, phim) + log2(p) + 1.0;
+
+	return static_cast<long>(ceil(bits * (1.0 + margin)));
+}
+
+bool Comparator::check_capacity(const Ctxt &ctxt_res, double initial_capacity, long depth) const
+{
+	double predicted = initial_capacity - depth * level_bits();
+	double actual = ctxt_res.bitCapacity();
+
+	cout << "Initial capacity: " << initial_capacity << ", circuit depth: " << depth << endl;
+	cout << "Predicted final capacity: " << predicted << ", actual: " << actual << endl;
+
+	if (actual < predicted)
+	{
+		cout << "Capacity prediction is too optimistic by " << predicted - actual << " bits" << endl;
+		return false;
+	}
+	return true;
+}
+
+double Comparator::level_bits() const
+{
+	return level_bits(m_context.getP(), m_context.getPhiM());
+}
+
+void Comparator::drop_to_base(Ctxt &ctxt) const
+{
+	if (!m_levelPlanner || ctxt.isEmpty())
+		return;
+
+	HELIB_NTIMER_START(LevelPlanner);
+	// modulus switching to the base set scales the noise down to the rounding noise without losing capacity,
+	// so the primes outside of it only make rotations and multiplications more expensive
+	IndexSet base_set;
+	ctxt.findBaseSet(base_set);
+	if (!empty(base_set) && ctxt.getPrimeSet().contains(base_set) && base_set != ctxt.getPrimeSet())
+		ctxt.modDownToSet(base_set);
+	HELIB_NTIMER_STOP(LevelPlanner);
 
+	if (m_verbose)
+	{
+		cout << "Level planner: " << ctxt.getPrimeSet().card() << " primes, capacity " << ctxt.bitCapacity() << endl;
+	}
+}
+
+ArrayMinPlan Comparator::plan_array_min(size_t input_len, long capacity, long depth) const
+{
 	// plaintext modulus
 	long p = m_context.getP();
 
-	if (input_len > p)
-		throw helib::LogicError("The number of ciphertexts cannot be larger than the plaintext modulus");
+	long comp_depth = compare_depth(m_type, p, m_slotDeg, m_expansionLen);
+	double comp_cost = compare_cost(m_type, p, m_slotDeg, m_expansionLen);
 
-	// multiplications in the equality circuit
+	// multiplications and depth of the equality circuit
 	long eq_mul_num = static_cast<long>(floor(log2(p - 1))) + weight(ZZ(p - 1)) - 1;
-	cout << "Multiplications in the equality circuit: " << eq_mul_num << endl;
+	long eq_depth = static_cast<long>(ceil(log2(p - 1)));
 
-	// create a table with all pairwise comparisons and compute the Hamming weight of every row
-	vector<Ctxt> ham_weights;
+	double bits = level_bits();
 
-	get_sorting_index(ham_weights, ctxt_in);
-	/*
-	for(size_t i = 0; i < input_len; i++)
+	vector<ArrayMinPlan> plans;
+
+	// number of values after 'level' tournament levels
+	size_t cur_len = input_len;
+	// number of min_max calls in the tournament
+	double tour_comps = 0;
+	for (long level = 0; ; level++)
 	{
-		//initialize Hamming weights to zero
-		Ctxt ctxt_tmp = Ctxt(ctxt_in[0].getPubKey());
-		ham_weights.push_back(ctxt_tmp);
+		if (depth < 0 || level == depth || cur_len == 1)
+		{
+			long tour_depth = level * (comp_depth + 1);
+			double tour_cost = tour_comps * (comp_cost + 1);
+
+			if (cur_len == 1)
+			{
+				plans.push_back({level, false, tour_depth, tour_cost});
+			}
+			else
+			{
+				double table_comps = cur_len * (cur_len - 1) / 2.0;
+
+				if (cur_len <= p)
+				{
+					ArrayMinPlan eq_plan;
+					eq_plan.depth = level;
+					eq_plan.via_equality = true;
+					eq_plan.mul_depth = tour_depth + comp_depth + eq_depth + 1;
+					eq_plan.cost = tour_cost + table_comps * comp_cost + cur_len * (eq_mul_num + 1);
+					plans.push_back(eq_plan);
+				}
+
+				ArrayMinPlan prod_plan;
+				prod_plan.depth = level;
+				prod_plan.via_equality = false;
+				prod_plan.mul_depth = tour_depth + comp_depth + static_cast<long>(ceil(log2(cur_len - 1))) + 1;
+				prod_plan.cost = tour_cost + table_comps * comp_cost + cur_len * (cur_len - 1);
+				plans.push_back(prod_plan);
+			}
+		}
+
+		if (cur_len == 1 || level == depth)
+			break;
+
+		tour_comps += cur_len >> 1;
+		cur_len = (cur_len >> 1) + (cur_len % 2);
 	}
 
-	cout << "Computing the comparison table" << endl;
-	for (size_t i = 0; i < input_len - 1; i++)
+	// the fastest plan that fits into the capacity, otherwise the shallowest one
+	long best = -1;
+	for (size_t i = 0; i < plans.size(); i++)
 	{
-		cout << "Computing Row " << i << endl;
-		for(size_t j = i + 1; j < input_len; j++)
+		if (plans[i].mul_depth * bits > capacity)
+			continue;
+		if (best < 0 || plans[i].cost < plans[best].cost)
+			best = i;
+	}
+	if (best < 0)
+	{
+		cout << "No plan of array_min fits into " << capacity << " bits" << endl;
+		best = 0;
+		for (size_t i = 1; i < plans.size(); i++)
 		{
-			cout << "Computing Column " << j << endl;
-			// compute upper diagonal entries of the comparison table and sum them
-			Ctxt comp_col_j = Ctxt(ctxt_in[0].getPubKey());
-			compare(comp_col_j, ctxt_in[i], ctxt_in[j]);
-			ham_weights[i] += comp_col_j;
+			if (plans[i].mul_depth < plans[best].mul_depth || (plans[i].mul_depth == plans[best].mul_depth && plans[i].cost < plans[best].cost))
+				best = i;
+		}
+	}
 
-			// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
-			//NOT the result to add to the jth row
-			comp_col_j.negate();
-			comp_col_j.addConstant(ZZ(1));
+	if (m_verbose)
+	{
+		for (size_t i = 0; i < plans.size(); i++)
+		{
+			cout << "Plan: levels " << plans[i].depth << (plans[i].via_equality ? ", equality" : ", punctured products") << ", depth " << plans[i].mul_depth << ", cost " << plans[i].cost << endl;
+		}
+	}
+	cout << "Chosen plan: levels " << plans[best].depth << (plans[best].via_equality ? ", equality" : ", punctured products") << ", depth " << plans[best].mul_depth << ", cost " << plans[best].cost << endl;
 
-			// add lower diagonal entries to Hamming weight accumulators of related rows
-			ham_weights[j] += comp_col_j;
+	return plans[best];
+}
+
+void Comparator::array_min_tournament(vector<Ctxt> &ctxt_vec, vector<Ctxt> *ctxt_idx, long depth, bool is_max) const
+{
+	size_t cur_len = ctxt_vec.size();
+	long level = depth;
+
+	while (cur_len > 1 && level > 0)
+	{
+		cout << "Comparison level: " << depth - level << endl;
+		// compare neighbours x[2i] and x[2i+1], so the winners keep the order of the positions they come from
+		// the pairs are independent and compared in parallel
+		long pair_num = cur_len >> 1;
+		cout << "Comparing " << pair_num << " pairs of ciphertexts" << endl;
+		NTL_EXEC_RANGE(pair_num, first, last)
+		for (long k = first; k < last; k++)
+		{
+			size_t i = 2 * k;
+			size_t j = i + 1;
+
+			if (ctxt_idx == nullptr)
+			{
+				// the winner goes to the ith position
+				if (is_max)
+					min_max_in_place(ctxt_vec[j], ctxt_vec[i]);
+				else
+					min_max_in_place(ctxt_vec[i], ctxt_vec[j]);
+				continue;
+			}
+
+			// c = x[i] < x[j]
+			Ctxt ctxt_less = Ctxt(m_pk);
+			compare(ctxt_less, ctxt_vec[i], ctxt_vec[j]);
+
+			// c * (x[i] - x[j])
+			// the other slots of a batch compare the upper digits only, which picks the same digits of x[i] and x[j]
+			ScratchCtxt ctxt_diff(ctxt_vec[i]);
+			*ctxt_diff -= ctxt_vec[j];
+			ctxt_diff->multiplyBy(ctxt_less);
+
+			// c * (idx[i] - idx[j])
+			// the positions differ in every slot, so they need c of the whole numbers from the first slot of the batch
+			spread_first_slot(ctxt_less);
+			ScratchCtxt idx_diff((*ctxt_idx)[i]);
+			*idx_diff -= (*ctxt_idx)[j];
+			idx_diff->multiplyBy(ctxt_less);
+
+			// equal values give c = 0, so the minimum is taken from the later position and the maximum from the earlier one
+			if (is_max)
+			{
+				// max = x[i] - c * (x[i] - x[j])
+				ctxt_vec[i] -= *ctxt_diff;
+				(*ctxt_idx)[i] -= *idx_diff;
+			}
+			else
+			{
+				// min = x[j] + c * (x[i] - x[j])
+				ctxt_vec[i] = ctxt_vec[j];
+				ctxt_vec[i] += *ctxt_diff;
+				(*ctxt_idx)[i] = (*ctxt_idx)[j];
+				(*ctxt_idx)[i] += *idx_diff;
+			}
+		}
+		NTL_EXEC_RANGE_END
+
+		// move the winners and the unpaired last element to the front
+		for (long k = 1; k < pair_num + static_cast<long>(cur_len % 2); k++)
+		{
+			ctxt_vec[k] = ctxt_vec[2 * k];
+			if (ctxt_idx != nullptr)
+				(*ctxt_idx)[k] = (*ctxt_idx)[2 * k];
 		}
+		cur_len = (cur_len >> 1) + (cur_len % 2);
+		ctxt_vec.resize(cur_len, Ctxt(m_pk));
+		if (ctxt_idx != nullptr)
+			ctxt_idx->resize(cur_len, Ctxt(m_pk));
+		level--;
 	}
-	*/
+}
 
-	// print Hamming weights
-	/*
-	for(size_t i = 0; i < input_len; i++)
+void Comparator::compare_pairs(vector<Ctxt> &ctxt_res, const vector<Ctxt> &ctxt_in, const vector<pair<size_t, size_t>> &pairs, size_t first_pair, size_t pair_num) const
+{
+	ctxt_res.assign(pair_num, Ctxt(m_pk));
+
+	cout << "Computing comparisons " << first_pair << " to " << first_pair + pair_num - 1 << " of the comparison table" << endl;
+	NTL_EXEC_RANGE(pair_num, first, last)
+	for (long k = first; k < last; k++)
 	{
-		cout << i << " Row:" << endl;
-		print_decrypted(ham_weights[i]);
-		cout << endl;
+		const pair<size_t, size_t> &ij = pairs[first_pair + k];
+		// the circuit works on x in the result ciphertext, which is written only at the end
+		ctxt_res[k] = ctxt_in[ij.first];
+		compare_in_place(ctxt_res[k], nullptr, ctxt_res[k], ctxt_in[ij.second]);
 	}
-	*/
+	NTL_EXEC_RANGE_END
+}
 
-	if (eq_mul_num * input_len <= p - 2)
-	// if(true)
+void Comparator::multiply_to_stack(vector<Ctxt> &ctxt_stack, const Ctxt &ctxt_factor, long count) const
+{
+	// the stack keeps the products of 2^k factors where k runs over the binary digits of count
+	if (ctxt_stack.empty())
 	{
-		for (size_t i = 0; i < input_len; i++)
+		ctxt_stack.push_back(ctxt_factor);
+		return;
+	}
+
+	long wt = weight(ZZ(count));
+	int len = ctxt_stack.size();
+	if (wt > len)
+	{
+		ctxt_stack.push_back(ctxt_factor);
+	}
+	else
+	{
+		ctxt_stack[len - 1].multiplyBy(ctxt_factor);
+		for (int k = len - 2; k >= (wt - 1); k--)
 		{
-			cout << "Computing Element " << i << endl;
-			Ctxt tmp_sum = Ctxt(ctxt_in[i].getPubKey());
-			for (size_t j = 0; j < input_len; j++)
-			{
-				// compare the Hamming weight of the jth row with i
-				Ctxt tmp_prod = ham_weights[j];
-				tmp_prod.addConstant(ZZX(-i));
-				mapTo01_subfield(tmp_prod, 1);
-				tmp_prod.negate();
-				tmp_prod.addConstant(ZZX(1));
+			ctxt_stack[k].multiplyBy(ctxt_stack[k + 1]);
+			ctxt_stack.pop_back();
+		}
+	}
+}
 
-				// multiply by the jth input ciphertext
-				tmp_prod.multiplyBy(ctxt_in[j]);
-				tmp_sum += tmp_prod;
+void Comparator::array_min_indicators(vector<Ctxt> &ctxt_ind, const vector<Ctxt> &ctxt_in, bool is_max, bool via_equality) const
+{
+	ctxt_ind.clear();
+
+	size_t cur_len = ctxt_in.size();
+
+	if (via_equality)
+	{
+		cout << "Computing minimum via equality" << endl;
+		// create a table with all pairwise comparisons and compute the Hamming weight of every row
+		vector<Ctxt> ham_weights;
+		get_sorting_index(ham_weights, ctxt_in);
+
+		// the minimum is larger than cur_len-1 elements, the maximum is larger than none
+		long target = is_max ? 0 : cur_len - 1;
+
+		for (size_t i = 0; i < cur_len; i++)
+		{
+			// compare the Hamming weight of the ith row with the target
+			Ctxt tmp_prod = ham_weights[i];
+			if (target != 0)
+				tmp_prod.addConstant(ZZX(-target));
+			mapTo01_subfield(tmp_prod, 1);
+			tmp_prod.negate();
+			tmp_prod.addConstant(ZZX(1));
+			ctxt_ind.push_back(tmp_prod);
+		}
+	}
+	else
+	{
+		cout << "Computing minimum via punctured products" << endl;
+		// upper diagonal entries of the comparison table in the row order
+		vector<pair<size_t, size_t>> pairs;
+		for (size_t i = 0; i < cur_len - 1; i++)
+			for (size_t j = i + 1; j < cur_len; j++)
+				pairs.push_back(pair<size_t, size_t>(i, j));
+
+		// products of every row kept as stacks of partial products
+		vector<vector<Ctxt>> ctxt_products(cur_len);
+		// number of factors in every row
+		vector<long> row_count(cur_len, 0);
+
+		// the table is computed in batches of comparisons that are large enough to keep all threads busy
+		// and small enough to avoid storing the whole table
+		size_t batch_len = max(cur_len, static_cast<size_t>(AvailableThreads()));
+
+		cout << "Computing the comparison table" << endl;
+		for (size_t first_pair = 0; first_pair < pairs.size(); first_pair += batch_len)
+		{
+			size_t pair_num = min(batch_len, pairs.size() - first_pair);
+
+			vector<Ctxt> ctxt_comp;
+			compare_pairs(ctxt_comp, ctxt_in, pairs, first_pair, pair_num);
+
+			// entries of every row in the current batch
+			// the ith row takes x[i] < x[j], the jth row takes its negation x[j] <= x[i] (the other way around for the maximum)
+			vector<vector<pair<size_t, bool>>> row_entries(cur_len);
+			for (size_t k = 0; k < pair_num; k++)
+			{
+				row_entries[pairs[first_pair + k].first].push_back(pair<size_t, bool>(k, is_max));
+				row_entries[pairs[first_pair + k].second].push_back(pair<size_t, bool>(k, !is_max));
+			}
+
+			// the rows are independent and multiplied in parallel
+			NTL_EXEC_RANGE(cur_len, first, last)
+			for (long i = first; i < last; i++)
+			{
+				for (size_t k = 0; k < row_entries[i].size(); k++)
+				{
+					Ctxt ctxt_factor = ctxt_comp[row_entries[i][k].first];
+					if (row_entries[i][k].second)
+					{
+						ctxt_factor.negate();
+						ctxt_factor.addConstant(ZZ(1));
+					}
+					row_count[i]++;
+					multiply_to_stack(ctxt_products[i], ctxt_factor, row_count[i]);
+				}
+			}
+			NTL_EXEC_RANGE_END
+		}
+
+		// multiply the partial products of every row
+		NTL_EXEC_RANGE(cur_len, first, last)
+		for (long i = first; i < last; i++)
+		{
+			int len_i = ctxt_products[i].size();
+			for (int k = len_i - 2; k >= 0; k--)
+			{
+				ctxt_products[i][k].multiplyBy(ctxt_products[i][k + 1]);
+				ctxt_products[i].pop_back();
+			}
+		}
+		NTL_EXEC_RANGE_END
+
+		for (size_t i = 0; i < cur_len; i++)
+			ctxt_ind.push_back(ctxt_products[i][0]);
+	}
+}
+
+void Comparator::array_min(Ctxt &ctxt_res, const vector<Ctxt> &ctxt_in, long depth) const
+{
+	// the tournament works on its own copy of the inputs
+	array_min(ctxt_res, vector<Ctxt>(ctxt_in), depth);
+}
+
+void Comparator::array_min(Ctxt &ctxt_res, vector<Ctxt> &&ctxt_in, long depth) const
+{
+	HELIB_NTIMER_START(ArrayMin);
+
+	cout << "Computing the minimum of an array" << endl;
+
+	// choose the number of tournament levels (if depth < 0) and the final method
+	ArrayMinPlan plan = plan_array_min(ctxt_in.size(), ctxt_in[0].bitCapacity(), depth);
+
+	vector<Ctxt> &ctxt_res_vec = ctxt_in;
+	array_min_tournament(ctxt_res_vec, nullptr, plan.depth, false);
+
+	if (ctxt_res_vec.size() > 1)
+	{
+		vector<Ctxt> ctxt_ind;
+		array_min_indicators(ctxt_ind, ctxt_res_vec, false, plan.via_equality);
+
+		cout << "Computing the minimum" << endl;
+		ctxt_res = Ctxt(m_pk);
+		for (size_t i = 0; i < ctxt_res_vec.size(); i++)
+		{
+			// multiply by the ith input ciphertext
+			ctxt_ind[i].multiplyBy(ctxt_res_vec[i]);
+
+			// add to the result
+			ctxt_res += ctxt_ind[i];
+		}
+	}
+	else
+	{
+		ctxt_res = ctxt_res_vec[0];
+	}
+
+	HELIB_NTIMER_STOP(ArrayMin);
+}
+
+void Comparator::array_arg(Ctxt &ctxt_res, Ctxt *ctxt_index, vector<Ctxt> *ctxt_onehot, const vector<Ctxt> &ctxt_in, long depth, bool is_max) const
+{
+	HELIB_NTIMER_START(ArrayArgMin);
+
+	size_t input_len = ctxt_in.size();
+
+	if (ctxt_index != nullptr && input_len > m_context.getP())
+		throw helib::LogicError("The number of ciphertexts cannot be larger than the plaintext modulus");
+
+	// the tournament keeps only the winners, so the one-hot vector needs the indicators of all inputs
+	if (ctxt_onehot != nullptr && depth != 0)
+		throw helib::LogicError("One-hot positions are only available without tournament levels");
+
+	// choose the number of tournament levels (if depth < 0) and the final method
+	ArrayMinPlan plan = plan_array_min(input_len, ctxt_in[0].bitCapacity(), depth);
+
+	vector<Ctxt> ctxt_vec(ctxt_in);
+
+	// positions of the current candidates encrypted without noise
+	vector<Ctxt> ctxt_idx;
+	if (ctxt_index != nullptr)
+	{
+		for (size_t i = 0; i < input_len; i++)
+		{
+			Ctxt ctxt_tmp = Ctxt(m_pk);
+			ctxt_tmp.DummyEncrypt(ZZX(i));
+			ctxt_idx.push_back(ctxt_tmp);
+		}
+	}
+
+	array_min_tournament(ctxt_vec, ctxt_index != nullptr ? &ctxt_idx : nullptr, plan.depth, is_max);
+
+	if (ctxt_vec.size() == 1)
+	{
+		ctxt_res = ctxt_vec[0];
+		if (ctxt_index != nullptr)
+			*ctxt_index = ctxt_idx[0];
+		if (ctxt_onehot != nullptr)
+		{
+			// a single input is always the winner
+			Ctxt ctxt_one = Ctxt(m_pk);
+			ctxt_one.DummyEncrypt(ZZX(1));
+			ctxt_onehot->assign(1, ctxt_one);
+		}
+		HELIB_NTIMER_STOP(ArrayArgMin);
+		return;
+	}
+
+	// the indicators select the winner among the remaining candidates
+	vector<Ctxt> ctxt_ind;
+	array_min_indicators(ctxt_ind, ctxt_vec, is_max, plan.via_equality);
+
+	// the indicators compare the whole numbers in the first slot of every batch only,
+	// the positions need them in all slots of the batch
+	NTL_EXEC_RANGE(ctxt_ind.size(), first, last)
+	for (long i = first; i < last; i++)
+		spread_first_slot(ctxt_ind[i]);
+	NTL_EXEC_RANGE_END
+
+	ctxt_res = Ctxt(m_pk);
+	if (ctxt_index != nullptr)
+		*ctxt_index = Ctxt(m_pk);
+	for (size_t i = 0; i < ctxt_vec.size(); i++)
+	{
+		if (ctxt_index != nullptr)
+		{
+			Ctxt tmp_idx = ctxt_idx[i];
+			tmp_idx.multiplyBy(ctxt_ind[i]);
+			*ctxt_index += tmp_idx;
+		}
+
+		Ctxt tmp_prod = ctxt_ind[i];
+		tmp_prod.multiplyBy(ctxt_vec[i]);
+		ctxt_res += tmp_prod;
+	}
+
+	if (ctxt_onehot != nullptr)
+		ctxt_onehot->swap(ctxt_ind);
+
+	HELIB_NTIMER_STOP(ArrayArgMin);
+}
+
+void Comparator::array_argmin(Ctxt &ctxt_res, Ctxt &ctxt_index, const vector<Ctxt> &ctxt_in, long depth) const
+{
+	array_arg(ctxt_res, &ctxt_index, nullptr, ctxt_in, depth, false);
+}
+
+void Comparator::array_argmin(Ctxt &ctxt_res, vector<Ctxt> &ctxt_onehot, const vector<Ctxt> &ctxt_in) const
+{
+	array_arg(ctxt_res, nullptr, &ctxt_onehot, ctxt_in, 0, false);
+}
+
+void Comparator::array_argmax(Ctxt &ctxt_res, Ctxt &ctxt_index, const vector<Ctxt> &ctxt_in, long depth) const
+{
+	array_arg(ctxt_res, &ctxt_index, nullptr, ctxt_in, depth, true);
+}
+
+void Comparator::array_argmax(Ctxt &ctxt_res, vector<Ctxt> &ctxt_onehot, const vector<Ctxt> &ctxt_in) const
+{
+	array_arg(ctxt_res, nullptr, &ctxt_onehot, ctxt_in, 0, true);
+}
+
+void Comparator::slot_min_max(Ctxt &ctxt_res, const Ctxt &ctxt_in, long num_values, bool is_max) const
+{
+	HELIB_NTIMER_START(SlotMinMax);
+	// get EncryptedArray
+	const EncryptedArray &ea = m_context.getEA();
+
+	// extract slots
+	long nSlots = ea.size();
+
+	// number of batches in one ciphertext
+	long batch_size = nSlots / m_expansionLen;
+
+	if (num_values <= 0)
+		num_values = batch_size;
+
+	if (num_values > batch_size)
+		throw helib::LogicError("The number of values cannot be larger than the number of slot batches");
+
+	ctxt_res = ctxt_in;
+
+	// batches [0, half) are compared with batches [cur_len - half, cur_len) where half is the largest power of two below cur_len.
+	// The two windows overlap if cur_len is not a power of two, which changes neither the minimum nor the maximum,
+	// and no batch needs a mask. After the first round all shifts are powers of two times the batch length
+	long cur_len = num_values;
+	while (cur_len > 1)
+	{
+		long half = 1L << (ceilLog2(cur_len) - 1);
+		long shift = cur_len - half;
+		if (m_verbose)
+			cout << "Comparing " << cur_len << " batches" << endl;
+
+		Ctxt ctxt_rot = ctxt_res;
+		rotate_slots(ctxt_rot, -shift * m_expansionLen);
+
+		// the minimum stays in ctxt_res and the maximum in ctxt_rot
+		min_max_in_place(ctxt_res, ctxt_rot);
+		if (is_max)
+			ctxt_res = ctxt_rot;
+
+		cur_len = half;
+	}
+
+	// the first batch holds the result and the other batches partial results, so the first batch is copied over them
+	if (num_values > 1)
+	{
+		vector<long> first_batch(nSlots, 0);
+		for (long i = 0; i < m_expansionLen; i++)
+			first_batch[i] = 1;
+		ZZX first_batch_poly;
+		ea.encode(first_batch_poly, first_batch);
+		ctxt_res.multByConstant(first_batch_poly);
+		replicate_batches(ctxt_res, num_values);
+	}
+
+	HELIB_NTIMER_STOP(SlotMinMax);
+}
+
+void Comparator::slot_min(Ctxt &ctxt_res, const Ctxt &ctxt_in, long num_values) const
+{
+	slot_min_max(ctxt_res, ctxt_in, num_values, false);
+}
+
+void Comparator::slot_max(Ctxt &ctxt_res, const Ctxt &ctxt_in, long num_values) const
+{
+	slot_min_max(ctxt_res, ctxt_in, num_values, true);
+}
+
+void Comparator::int_to_slot(ZZX &poly, unsigned long input, unsigned long enc_base) const
+{
+	vector<long> decomp;
+
+	// decomposition of a digit
+	digit_decomp(decomp, input, enc_base, m_slotDeg);
+	poly = ZZX(INIT_MONO, 0, 0);
+	for (int iCoef = 0; iCoef < m_slotDeg; iCoef++)
+	{
+		poly += ZZX(INIT_MONO, iCoef, decomp[iCoef]);
+	}
+}
+
+void Comparator::encode_batches(Ptxt<BGV> &ptxt, const vector<unsigned long> &values) const
+{
+	encode_values(ptxt, values, m_context, m_type, m_slotDeg, m_expansionLen);
+}
+
+void Comparator::rotate_and_combine(Ctxt &ctxt, long count, long unit, bool mul) const
+{
+	// windows shorter than a batch only use slots of the same batch
+	bool in_batches = labs(unit) * count <= m_expansionLen;
+
+	// ctxt combines windows of win_len slots, the window cut off from the end of an odd number of windows goes to ctxt_rest
+	Ctxt ctxt_rest(m_pk);
+	bool has_rest = false;
+	long win_len = 1;
+	long rest_offset = count;
+	ScratchCtxt tmp(ctxt);
+	for (long len = count; len > 1; len >>= 1)
+	{
+		if (mul)
+			drop_to_base(ctxt);
+
+		if (len & 1)
+		{
+			rest_offset -= win_len;
+			*tmp = ctxt;
+			if (in_batches)
+				rotate_in_batches(*tmp, -rest_offset * unit);
+			else
+				rotate_slots(*tmp, -rest_offset * unit);
+
+			if (!has_rest)
+				ctxt_rest = *tmp;
+			else if (mul)
+				ctxt_rest.multiplyBy(*tmp);
+			else
+				ctxt_rest += *tmp;
+			has_rest = true;
+		}
+
+		// join neighbouring windows
+		*tmp = ctxt;
+		if (in_batches)
+			rotate_in_batches(*tmp, -win_len * unit);
+		else
+			rotate_slots(*tmp, -win_len * unit);
+		if (mul)
+			ctxt.multiplyBy(*tmp);
+		else
+			ctxt += *tmp;
+		win_len <<= 1;
+	}
+
+	if (has_rest)
+	{
+		if (mul)
+			ctxt.multiplyBy(ctxt_rest);
+		else
+			ctxt += ctxt_rest;
+	}
+}
+
+void Comparator::spread_first_slot(Ctxt &ctxt) const
+{
+	if (m_expansionLen == 1)
+		return;
+
+	// keep the first slot of every batch
+	double size;
+	shared_ptr<const DoubleCRT> mask = get_mask(size, m_layouts[0].first_slot_mask, ctxt.getPrimeSet());
+	ctxt.multByConstant(*mask, size);
+
+	// slot j gets the sum of the slots j-k for 0 <= k < expansion_len, i.e. the first slot of its batch
+	rotate_and_combine(ctxt, m_expansionLen, -1, false);
+}
+
+void Comparator::replicate_batches(Ctxt &ctxt, long count) const
+{
+	const EncryptedArray &ea = m_context.getEA();
+
+	if (count * m_expansionLen > ea.size())
+		throw helib::LogicError("Too many copies to fit into one ciphertext");
+
+	// ctxt_pow contains 2^i copies of the first batch, the copies of the set bits of count are collected in ctxt
+	Ctxt ctxt_pow = ctxt;
+	long pow_len = 1;
+	long offset = 0;
+	bool is_first = true;
+	for (long rest = count; rest > 0; rest >>= 1)
+	{
+		if (rest & 1)
+		{
+			if (is_first)
+			{
+				ctxt = ctxt_pow;
+				is_first = false;
+			}
+			else
+			{
+				Ctxt tmp = ctxt_pow;
+				rotate_slots(tmp, offset * m_expansionLen);
+				ctxt += tmp;
+			}
+			offset += pow_len;
+		}
+
+		if (rest > 1)
+		{
+			Ctxt tmp = ctxt_pow;
+			rotate_slots(tmp, pow_len * m_expansionLen);
+			ctxt_pow += tmp;
+			pow_len <<= 1;
+		}
+	}
+}
+
+void Comparator::bucketize(vector<Ctxt> &ctxt_bins, const Ctxt &ctxt_x, const vector<unsigned long> &thresholds) const
+{
+	HELIB_NTIMER_START(Bucketize);
+
+	if (thresholds.empty())
+		throw helib::LogicError("At least one threshold is needed");
+	for (size_t k = 1; k < thresholds.size(); k++)
+		if (thresholds[k] < thresholds[k - 1])
+			throw helib::LogicError("Thresholds must be sorted in ascending order");
+
+	ctxt_bins.clear();
+
+	long nslots = m_context.getEA().size();
+	size_t numbers_size = nslots / m_expansionLen;
+	size_t bin_num = thresholds.size();
+
+	// digits of the thresholds in the clear, the same threshold is used for all numbers
+	vector<vector<vector<long>>> thr_p(bin_num);
+	for (size_t k = 0; k < bin_num; k++)
+	{
+		Ptxt<BGV> ptxt_thr;
+		encode_batches(ptxt_thr, vector<unsigned long>(numbers_size, thresholds[k]));
+		extract_mod_p(thr_p[k], ptxt_thr);
+	}
+
+	// less-than and equality results of every digit and every threshold
+	vector<vector<Ctxt>> ctxt_less_p;
+	vector<vector<Ctxt>> ctxt_eq_p;
+	if (m_type == UNI)
+	{
+		// univariate circuits of x - t_k sharing the digits of x and their squares
+		less_eq_digits_univar_plain(ctxt_less_p, ctxt_eq_p, ctxt_x, thr_p);
+	}
+	else
+	{
+		// extract mod p coefficients of x once for all thresholds
+		vector<Ctxt> ctxt_x_p;
+		extract_mod_p(ctxt_x_p, ctxt_x);
+
+		ctxt_less_p.resize(bin_num);
+		ctxt_eq_p.resize(bin_num);
+		for (long iCoef = 0; iCoef < m_slotDeg; iCoef++)
+		{
+			vector<vector<long>> bounds;
+			for (size_t k = 0; k < bin_num; k++)
+				bounds.push_back(thr_p[k][iCoef]);
+
+			// the powers of the digit are shared by all thresholds
+			vector<Ctxt> ctxt_less, ctxt_eq;
+			digit_predicates_plain(ctxt_less, ctxt_eq, ctxt_x_p[iCoef], bounds);
+
+			for (size_t k = 0; k < bin_num; k++)
+			{
+				ctxt_less_p[k].push_back(ctxt_less[k]);
+				ctxt_eq_p[k].push_back(ctxt_eq[k]);
+			}
+		}
+	}
+
+	// x < t_k
+	vector<Ctxt> ctxt_less(bin_num, Ctxt(m_pk));
+	NTL_EXEC_RANGE(bin_num, first, last)
+	for (long k = first; k < last; k++)
+	{
+		compare_from_digits(ctxt_less[k], nullptr, ctxt_less_p[k], ctxt_eq_p[k]);
+	}
+	NTL_EXEC_RANGE_END
+
+	// bin 0 is x < t_0, bin k is t_{k-1} <= x < t_k, the last bin is t_{K-1} <= x
+	ctxt_bins.push_back(ctxt_less[0]);
+	for (size_t k = 1; k < bin_num; k++)
+	{
+		Ctxt ctxt_tmp = ctxt_less[k];
+		ctxt_tmp -= ctxt_less[k - 1];
+		ctxt_bins.push_back(ctxt_tmp);
+	}
+	Ctxt ctxt_tmp = ctxt_less[bin_num - 1];
+	ctxt_tmp.negate();
+	ctxt_tmp.addConstant(ZZ(1));
+	ctxt_bins.push_back(ctxt_tmp);
+
+	HELIB_NTIMER_STOP(Bucketize);
+}
+
+void Comparator::bucketize_packed(Ctxt &ctxt_bins, const Ctxt &ctxt_x, const vector<unsigned long> &thresholds) const
+{
+	HELIB_NTIMER_START(BucketizePacked);
+
+	if (thresholds.empty())
+		throw helib::LogicError("At least one threshold is needed");
+	for (size_t k = 1; k < thresholds.size(); k++)
+		if (thresholds[k] < thresholds[k - 1])
+			throw helib::LogicError("Thresholds must be sorted in ascending order");
+
+	const EncryptedArray &ea = m_context.getEA();
+	long nslots = ea.size();
+	size_t bin_num = thresholds.size();
+
+	if ((bin_num + 1) * m_expansionLen > nslots)
+		throw helib::LogicError("The thresholds do not fit into one ciphertext");
+
+	// copy x into the first K+1 batches
+	Ctxt ctxt_rep = ctxt_x;
+	replicate_batches(ctxt_rep, bin_num + 1);
+
+	// the kth batch is compared with t_k, the last one with 0 to get a zero
+	Ptxt<BGV> ptxt_thr;
+	encode_batches(ptxt_thr, thresholds);
+
+	// x < t_k in the first slot of the kth batch
+	Ctxt ctxt_less(m_pk);
+	compare(ctxt_less, ctxt_rep, ptxt_thr);
+
+	// x < infinity in the last bin
+	vector<long> last_bin(nslots, 0);
+	last_bin[bin_num * m_expansionLen] = 1;
+	ZZX last_bin_poly;
+	ea.encode(last_bin_poly, last_bin);
+	ctxt_less.addConstant(last_bin_poly);
+
+	// bin k is (x < t_k) - (x < t_{k-1})
+	ctxt_bins = ctxt_less;
+	ea.shift(ctxt_less, m_expansionLen);
+	ctxt_bins -= ctxt_less;
+
+	if (m_verbose)
+	{
+		cout << "Bins" << endl;
+		print_decrypted(ctxt_bins);
+		cout << endl;
+	}
+
+	HELIB_NTIMER_STOP(BucketizePacked);
+}
+
+void Comparator::get_sorting_index(vector<Ctxt> &ctxt_out, const vector<Ctxt> &ctxt_in) const
+{
+	ctxt_out.clear();
+
+	// length of the input vector
+	size_t input_len = ctxt_in.size();
+
+	// plaintext modulus
+	long p = m_context.getP();
+
+	if (input_len > p)
+		throw helib::LogicError("The number of ciphertexts cannot be larger than the plaintext modulus");
+
+	// compute the Hamming weight of every row
+	// initialize Hamming weights to zero
+	ctxt_out.assign(input_len, Ctxt(ctxt_in[0].getPubKey()));
+
+	// upper diagonal entries of the comparison table in the row order
+	vector<pair<size_t, size_t>> pairs;
+	for (size_t i = 0; i < input_len - 1; i++)
+		for (size_t j = i + 1; j < input_len; j++)
+			pairs.push_back(pair<size_t, size_t>(i, j));
+
+	// the table is computed in batches of comparisons that are large enough to keep all threads busy
+	size_t batch_len = max(input_len, static_cast<size_t>(AvailableThreads()));
+
+	cout << "Computing the comparison table" << endl;
+	for (size_t first_pair = 0; first_pair < pairs.size(); first_pair += batch_len)
+	{
+		size_t pair_num = min(batch_len, pairs.size() - first_pair);
+
+		vector<Ctxt> ctxt_comp;
+		compare_pairs(ctxt_comp, ctxt_in, pairs, first_pair, pair_num);
+
+		for (size_t k = 0; k < pair_num; k++)
+		{
+			size_t i = pairs[first_pair + k].first;
+			size_t j = pairs[first_pair + k].second;
+
+			// add upper diagonal entries to the Hamming weight of the ith row
+			ctxt_out[i] += ctxt_comp[k];
+
+			// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
+			// NOT the result to add to the jth row
+			ctxt_comp[k].negate();
+			ctxt_comp[k].addConstant(ZZ(1));
+
+			// add lower diagonal entries to Hamming weight accumulators of related rows
+			ctxt_out[j] += ctxt_comp[k];
+		}
+	}
+}
+
+void Comparator::sort(vector<Ctxt> &ctxt_out, const vector<Ctxt> &ctxt_in) const
+{
+	HELIB_NTIMER_START(Sorting);
+
+	ctxt_out.clear();
+
+	// length of the input vector
+	size_t input_len = ctxt_in.size();
+
+	// plaintext modulus
+	long p = m_context.getP();
+
+	if (input_len > p)
+		throw helib::LogicError("The number of ciphertexts cannot be larger than the plaintext modulus");
+
+	// multiplications in the equality circuit
+	long eq_mul_num = static_cast<long>(floor(log2(p - 1))) + weight(ZZ(p - 1)) - 1;
+	cout << "Multiplications in the equality circuit: " << eq_mul_num << endl;
+
+	// create a table with all pairwise comparisons and compute the Hamming weight of every row
+	vector<Ctxt> ham_weights;
+
+	get_sorting_index(ham_weights, ctxt_in);
+	/*
+	for(size_t i = 0; i < input_len; i++)
+	{
+		//initialize Hamming weights to zero
+		Ctxt ctxt_tmp = Ctxt(ctxt_in[0].getPubKey());
+		ham_weights.push_back(ctxt_tmp);
+	}
+
+	cout << "Computing the comparison table" << endl;
+	for (size_t i = 0; i < input_len - 1; i++)
+	{
+		cout << "Computing Row " << i << endl;
+		for(size_t j = i + 1; j < input_len; j++)
+		{
+			cout << "Computing Column " << j << endl;
+			// compute upper diagonal entries of the comparison table and sum them
+			Ctxt comp_col_j = Ctxt(ctxt_in[0].getPubKey());
+			compare(comp_col_j, ctxt_in[i], ctxt_in[j]);
+			ham_weights[i] += comp_col_j;
+
+			// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
+			//NOT the result to add to the jth row
+			comp_col_j.negate();
+			comp_col_j.addConstant(ZZ(1));
+
+			// add lower diagonal entries to Hamming weight accumulators of related rows
+			ham_weights[j] += comp_col_j;
+		}
+	}
+	*/
+
+	// print Hamming weights
+	/*
+	for(size_t i = 0; i < input_len; i++)
+	{
+		cout << i << " Row:" << endl;
+		print_decrypted(ham_weights[i]);
+		cout << endl;
+	}
+	*/
+
+	if (eq_mul_num * input_len <= p - 2)
+	// if(true)
+	{
+		// the same scratch ciphertext holds every entry of the permutation matrix
+		ScratchCtxt tmp_prod(ham_weights[0]);
+		ctxt_out.reserve(input_len);
+		for (size_t i = 0; i < input_len; i++)
+		{
+			cout << "Computing Element " << i << endl;
+			ctxt_out.emplace_back(ctxt_in[i].getPubKey());
+			Ctxt &tmp_sum = ctxt_out.back();
+			for (size_t j = 0; j < input_len; j++)
+			{
+				// compare the Hamming weight of the jth row with i
+				*tmp_prod = ham_weights[j];
+				tmp_prod->addConstant(ZZX(-i));
+				mapTo01_subfield(*tmp_prod, 1);
+				tmp_prod->negate();
+				tmp_prod->addConstant(ZZX(1));
+
+				// multiply by the jth input ciphertext
+				tmp_prod->multiplyBy(ctxt_in[j]);
+				tmp_sum += *tmp_prod;
+			}
+		}
+	}
+	else
+	{
+		// equality sums
+		vector<Ctxt> eq_sums;
+
+		// fill ctxt_out with zeros
+		for (size_t i = 0; i < input_len; i++)
+		{
+			ctxt_out.push_back(Ctxt(ctxt_in[0].getPubKey()));
+			eq_sums.push_back(Ctxt(ctxt_in[0].getPubKey()));
+		}
+
+		for (size_t i = 0; i < input_len; i++)
+		{
+			cout << "Adding element " << i << endl;
+
+			// hw_i^j, j in [1,p-1]
+			DynamicCtxtPowers hw_powers(ham_weights[i], p - 1);
+
+			// eq_sums[0] = 1 - hw_i^(p-1)
+			eq_sums[0].clear();
+			eq_sums[0] = hw_powers.getPower(p - 1);
+			eq_sums[0].negate();
+			eq_sums[0].addConstant(ZZX(1));
+
+			// eq_sums[0] * ctxt_in[i]
+			eq_sums[0].multiplyBy(ctxt_in[i]);
+
+			// sum_i eq_sums[0] * ctxt_in[i]
+			ctxt_out[0] += eq_sums[0];
+
+			for (size_t k = 1; k < input_len; k++)
+			{
+				// zeroize
+				eq_sums[k].clear();
+
+				// current sorting index
+				ZZ_p k_zzp;
+				k_zzp.init(ZZ(p));
+				k_zzp = k;
+
+				ZZ_p k_power;
+				k_power.init(ZZ(p));
+
+				for (int j = 1; j < p; j++)
+				{
+					// k^(p-1-j) mod p
+					k_power = power(k_zzp, p - 1 - j);
+					// hw_i^j
+					ScratchCtxt tmp(hw_powers.getPower(j));
+					// hw_i^j * k^(p-1-j)
+					tmp->multByConstant(rep(k_power));
+					// sum hw_i^j * k^(p-1-j)
+					eq_sums[k] += *tmp;
+				}
+				// add k^(p-1) to eq_sums
+				eq_sums[k].addConstant(rep(power(k_zzp, p - 1)));
+
+				// 1 - sum_(j=0)^(p-1) hw_i^j * k^(p-1-j)
+				eq_sums[k].negate();
+				eq_sums[k].addConstant(ZZX(1));
+
+				// eq_sums[k] * ctxt_in[i]
+				eq_sums[k].multiplyBy(ctxt_in[i]);
+
+				// sum_i eq_sums[k] * ctxt_in[i]
+				ctxt_out[k] += eq_sums[k];
+			}
+		}
+	}
+
+	// print output ciphertexts
+	/*
+	for(size_t i = 0; i < input_len; i++)
+	{
+		cout << i << " ctxt:" << endl;
+		print_decrypted(ctxt_out[i]);
+		cout << endl;
+	}
+	*/
+	HELIB_NTIMER_STOP(Sorting);
+}
+
+void Comparator::top_k(vector<Ctxt> &ctxt_out, const vector<Ctxt> &ctxt_in, long k) const
+{
+	HELIB_NTIMER_START(TopK);
+
+	ctxt_out.clear();
+
+	// length of the input vector
+	size_t input_len = ctxt_in.size();
+
+	if (k <= 0 || k > input_len)
+		throw helib::LogicError("k must be positive and not larger than the number of ciphertexts");
+
+	if (input_len == 1)
+	{
+		ctxt_out.push_back(ctxt_in[0]);
+		HELIB_NTIMER_STOP(TopK);
+		return;
+	}
+
+	// plaintext modulus
+	long p = m_context.getP();
+
+	// multiplications in the equality circuit
+	long eq_mul_num = static_cast<long>(floor(log2(p - 1))) + weight(ZZ(p - 1)) - 1;
+	cout << "Multiplications in the equality circuit: " << eq_mul_num << endl;
+
+	// create a table with all pairwise comparisons and compute the Hamming weight of every row
+	// the Hamming weight of a row is the number of input values larger than the row element,
+	// so the r-th smallest element is the one with the Hamming weight input_len-1-r
+	vector<Ctxt> ham_weights;
+	get_sorting_index(ham_weights, ctxt_in);
+
+	// fill ctxt_out with zeros
+	for (long r = 0; r < k; r++)
+	{
+		ctxt_out.push_back(Ctxt(ctxt_in[0].getPubKey()));
+	}
+
+	// the Hamming weights are a permutation of 0, ..., input_len-1 (ties are broken by the input order),
+	// so the equality with a rank can be interpolated on these values with degree input_len-1 instead of p-1
+	long max_deg = input_len - 1;
+
+	if (eq_mul_num * k <= max_deg - 1)
+	{
+		// few ranks: compare every Hamming weight with each rank separately,
+		// which takes fewer multiplications than the max_deg-1 powers of the interpolation
+		for (long r = 0; r < k; r++)
+		{
+			cout << "Computing Element " << r << endl;
+			long rank = input_len - 1 - r;
+			for (size_t j = 0; j < input_len; j++)
+			{
+				// compare the Hamming weight of the jth row with the rank
+				Ctxt tmp_prod = ham_weights[j];
+				tmp_prod.addConstant(ZZX(-rank));
+				mapTo01_subfield(tmp_prod, 1);
+				tmp_prod.negate();
+				tmp_prod.addConstant(ZZX(1));
+
+				// multiply by the jth input ciphertext
+				tmp_prod.multiplyBy(ctxt_in[j]);
+				ctxt_out[r] += tmp_prod;
+			}
+		}
+	}
+	else
+	{
+		// many ranks: [hw = rank] = R(hw) / ((hw - rank) * R'(rank)) with R(x) = prod_(u=0)^(input_len-1) (x - u),
+		// so the k equalities of one Hamming weight are linear combinations of the same powers hw^j, 1 <= j <= max_deg
+		vector<vector<long>> rank_coefs(k, vector<long>(max_deg + 1, 0));
+		{
+			zz_pPush push(p);
+
+			vec_zz_p roots;
+			roots.SetLength(input_len);
+			for (size_t u = 0; u < input_len; u++)
+				roots[u] = u;
+			zz_pX root_pol;
+			BuildFromRoots(root_pol, roots);
+			zz_pX root_der;
+			diff(root_der, root_pol);
+
+			for (long r = 0; r < k; r++)
+			{
+				zz_p rank(input_len - 1 - r);
+
+				// R(x) / (x - rank)
+				zz_pX lin_pol;
+				SetCoeff(lin_pol, 1);
+				SetCoeff(lin_pol, 0, -rank);
+				zz_pX eq_pol = root_pol / lin_pol;
+				eq_pol *= inv(eval(root_der, rank));
+
+				for (long j = 0; j <= deg(eq_pol); j++)
+					rank_coefs[r][j] = rep(coeff(eq_pol, j));
+			}
+		}
+
+		for (size_t i = 0; i < input_len; i++)
+		{
+			cout << "Adding element " << i << endl;
+
+			// hw_i^j, j in [1,max_deg]
+			DynamicCtxtPowers hw_powers(ham_weights[i], max_deg);
+
+			for (long r = 0; r < k; r++)
+			{
+				// the leading coefficient 1/R'(rank) is not zero, so eq_sum is not empty when the constant is added
+				Ctxt eq_sum = Ctxt(ctxt_in[i].getPubKey());
+				for (long j = 1; j <= max_deg; j++)
+				{
+					if (rank_coefs[r][j] == 0)
+						continue;
+					// hw_i^j * coef_j
+					ScratchCtxt tmp(hw_powers.getPower(j));
+					tmp->multByConstant(ZZ(rank_coefs[r][j]));
+					eq_sum += *tmp;
+				}
+				eq_sum.addConstant(ZZ(rank_coefs[r][0]));
+
+				// multiply by the ith input ciphertext and add to the rth output
+				eq_sum.multiplyBy(ctxt_in[i]);
+				ctxt_out[r] += eq_sum;
+			}
+		}
+	}
+
+	HELIB_NTIMER_STOP(TopK);
+}
+
+void Comparator::test_sorting(int num_to_sort, long runs) const
+{
+	// reset timers
+	setTimersOn();
+
+	// initialize the random generator
+	random_device rd;
+	mt19937 eng(rd());
+	uniform_int_distribution<unsigned long> distr_u;
+	uniform_int_distribution<long> distr_i;
+
+	// get EncryptedArray
+	const EncryptedArray &ea = m_context.getEA();
+
+	// extract number of slots
+	long nslots = ea.size();
+
+	// get p
+	unsigned long p = m_context.getP();
+
+	// order of p
+	unsigned long ord_p = m_context.getOrdP();
+
+	// amount of numbers in one ciphertext
+	unsigned long numbers_size = nslots / m_expansionLen;
+
+	// number of slots occupied by encoded numbers
+	unsigned long occupied_slots = numbers_size * m_expansionLen;
+
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long enc_base = (p + 1) >> 1;
+	if (m_type == BI || m_type == TAN)
+	{
+		enc_base = p;
+	}
+
+	unsigned long digit_base = power_long(enc_base, m_slotDeg);
+
+	// check that field_size^expansion_len fits into 64-bits
+	int space_bit_size = static_cast<int>(ceil(m_expansionLen * log2(digit_base)));
+	unsigned long input_range = ULONG_MAX;
+	if (space_bit_size < 64)
+	{
+		// input_range = power_long(field_size, expansion_len);
+		input_range = power_long(digit_base, m_expansionLen);
+	}
+	cout << "Maximal input: " << input_range << endl;
+
+	long min_capacity = 1000;
+	long capacity;
+
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
+
+		// all slots contain the same value
+		vector<vector<ZZX>> expected_result;
+		for (int i = 0; i < num_to_sort; i++)
+		{
+			vector<ZZX> tmp_vec(occupied_slots, ZZX(INIT_MONO, 0, 0));
+			expected_result.push_back(tmp_vec);
+		}
+
+		// vector of input longs
+		vector<vector<unsigned long>> input_xs;
+		for (int i = 0; i < numbers_size; i++)
+		{
+			vector<unsigned long> tmp_vec(num_to_sort, 0);
+			input_xs.push_back(tmp_vec);
+		}
+
+		ZZX pol_slot;
+
+		// ciphertexts to sort
+		vector<Ctxt> ctxt_in;
+
+		// sorted ciphertexts
+		vector<Ctxt> ctxt_out;
+
+		for (int i = 0; i < num_to_sort; i++)
+		{
+			// the plaintext polynomials
+			vector<ZZX> pol_x(nslots);
+
+			// encoding of slots
+			for (int k = 0; k < numbers_size; k++)
+			{
+				unsigned long input_x = distr_u(eng) % input_range;
+
+				input_xs[k][i] = input_x;
+
+				if (m_verbose)
+				{
+					cout << "Input" << endl;
+					cout << input_x << endl;
+				}
+
+				vector<long> decomp_int_x;
+
+				// decomposition of input integers
+				digit_decomp(decomp_int_x, input_x, digit_base, m_expansionLen);
+				for (int j = 0; j < m_expansionLen; j++)
+				{
+					// decomposition of a digit
+					int_to_slot(pol_slot, decomp_int_x[j], enc_base);
+					pol_x[k * m_expansionLen + j] = pol_slot;
+				}
+			}
+
+			if (m_verbose)
+			{
+				cout << "Input" << endl;
+				for (int j = 0; j < nslots; j++)
+				{
+					printZZX(cout, pol_x[j], ord_p);
+					cout << endl;
+				}
+			}
+
+			Ctxt ctxt_x(m_pk);
+			ea.encrypt(ctxt_x, m_pk, pol_x);
+
+			ctxt_in.push_back(ctxt_x);
+		}
+
+		// cout << "Input" << endl;
+		for (int i = 0; i < numbers_size; i++)
+		{
+			// for (int j = 0; j < num_to_sort; j++)
+			//	cout << input_xs[i][j] << " ";
+			// cout << endl;
+			std::sort(input_xs[i].begin(), input_xs[i].end());
+		}
+
+		// cout << "Expected results" << endl;
+		for (int i = num_to_sort - 1; i >= 0; i--)
+		{
+			for (int k = 0; k < numbers_size; k++)
+			{
+				vector<long> decomp_int_x;
+
+				// decomposition of input integers
+				digit_decomp(decomp_int_x, input_xs[k][i], digit_base, m_expansionLen);
+				for (int j = 0; j < m_expansionLen; j++)
+				{
+					// decomposition of a digit
+					int_to_slot(pol_slot, decomp_int_x[j], enc_base);
+					expected_result[num_to_sort - 1 - i][k * m_expansionLen + j] = pol_slot;
+				}
+			}
+
+			/*
+			cout << num_to_sort-1-i << endl;
+			for(int j = 0; j < nslots; j++)
+			{
+				printZZX(cout, expected_result[num_to_sort-1-i][j], ord_p);
+				cout << endl;
+			}
+			*/
+		}
+
+		// comparison function
+		cout << "Start of sorting" << endl;
+		this->sort(ctxt_out, ctxt_in);
+
+		printNamedTimer(cout, "Extraction");
+		printNamedTimer(cout, "ComparisonCircuitBivar");
+		printNamedTimer(cout, "ComparisonCircuitUnivar");
+		printNamedTimer(cout, "EqualityCircuit");
+		printNamedTimer(cout, "ShiftMul");
+		printNamedTimer(cout, "ShiftAdd");
+		printNamedTimer(cout, "Comparison");
+		printNamedTimer(cout, "Sorting");
+
+		const FHEtimer *sort_timer = getTimerByName("Sorting");
+
+		cout << "Avg. time per batch: " << 1000.0 * sort_timer->getTime() / static_cast<double>(run + 1) / static_cast<double>(numbers_size) << " ms" << endl;
+		cout << "Number of integers in one ciphertext " << numbers_size << endl;
+
+		// remove the line below if it gives bizarre results
+		ctxt_out[0].cleanUp();
+		capacity = ctxt_out[0].bitCapacity();
+		cout << "Final capacity: " << capacity << endl;
+		if (capacity < min_capacity)
+			min_capacity = capacity;
+		cout << "Min. capacity: " << min_capacity << endl;
+		cout << "Final size: " << ctxt_out[0].logOfPrimeSet() / log(2.0) << endl;
+		if (m_capacityCheck)
+			check_capacity(ctxt_out[0], ctxt_in[0].bitCapacity(), circuit_depth(m_type, m_context.getP(), m_slotDeg, m_expansionLen, 1, num_to_sort));
+
+		for (int i = 0; i < num_to_sort; i++)
+		{
+			vector<ZZX> decrypted(nslots);
+			ea.decrypt(ctxt_out[i], secret_key(), decrypted);
+
+			for (int j = 0; j < numbers_size; j++)
+			{
+				for (int k = 0; k < m_expansionLen; k++)
+				{
+					if (decrypted[j * m_expansionLen + k] != expected_result[i][j * m_expansionLen + k])
+					{
+						printf("Slot %ld: ", j * m_expansionLen + k);
+						printZZX(cout, decrypted[j * m_expansionLen + k], ord_p);
+						cout << endl;
+						cout << "Failure" << endl;
+						return;
+					}
+				}
+			}
+		}
+	}
+}
+
+void Comparator::test_top_k(int num_values, long k, long runs) const
+{
+	// reset timers
+	setTimersOn();
+
+	// initialize the random generator
+	random_device rd;
+	mt19937 eng(rd());
+	uniform_int_distribution<unsigned long> distr_u;
+
+	// get EncryptedArray
+	const EncryptedArray &ea = m_context.getEA();
+
+	// extract number of slots
+	long nslots = ea.size();
+
+	// get p
+	unsigned long p = m_context.getP();
+
+	// order of p
+	unsigned long ord_p = m_context.getOrdP();
+
+	// amount of numbers in one ciphertext
+	unsigned long numbers_size = nslots / m_expansionLen;
+
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long enc_base = (p + 1) >> 1;
+	if (m_type == BI || m_type == TAN)
+	{
+		enc_base = p;
+	}
+
+	unsigned long digit_base = power_long(enc_base, m_slotDeg);
+
+	// check that field_size^expansion_len fits into 64-bits
+	int space_bit_size = static_cast<int>(ceil(m_expansionLen * log2(digit_base)));
+	unsigned long input_range = ULONG_MAX;
+	if (space_bit_size < 64)
+	{
+		input_range = power_long(digit_base, m_expansionLen);
+	}
+	cout << "Maximal input: " << input_range << endl;
+
+	// encodes an integer into the slots of the ith batch
+	auto encode_value = [&](vector<ZZX> &pol, long i, unsigned long value) {
+		vector<long> decomp_int;
+		digit_decomp(decomp_int, value, digit_base, m_expansionLen);
+		for (long j = 0; j < m_expansionLen; j++)
+			int_to_slot(pol[i * m_expansionLen + j], decomp_int[j], enc_base);
+	};
+
+	long min_capacity = 1000;
+	long capacity;
+
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
+
+		// input values of every slot batch
+		vector<vector<unsigned long>> input_xs(numbers_size, vector<unsigned long>(num_values, 0));
+
+		// ciphertexts to select from
+		vector<Ctxt> ctxt_in;
+		for (int i = 0; i < num_values; i++)
+		{
+			vector<ZZX> pol_x(nslots);
+			for (long b = 0; b < numbers_size; b++)
+			{
+				input_xs[b][i] = distr_u(eng) % input_range;
+				// repeat values to test ties
+				if (i > 0 && distr_u(eng) % 4 == 0)
+					input_xs[b][i] = input_xs[b][distr_u(eng) % i];
+				encode_value(pol_x, b, input_xs[b][i]);
+			}
+
+			Ctxt ctxt_x(m_pk);
+			ea.encrypt(ctxt_x, m_pk, pol_x);
+			ctxt_in.push_back(ctxt_x);
+		}
+
+		// the rth output holds the rth smallest value of every batch
+		vector<vector<ZZX>> expected_result(k, vector<ZZX>(nslots));
+		for (long b = 0; b < numbers_size; b++)
+		{
+			if (m_verbose)
+			{
+				cout << "Input" << endl;
+				for (int i = 0; i < num_values; i++)
+					cout << input_xs[b][i] << " ";
+				cout << endl;
+			}
+			std::sort(input_xs[b].begin(), input_xs[b].end());
+			for (long r = 0; r < k; r++)
+				encode_value(expected_result[r], b, input_xs[b][r]);
+		}
+
+		vector<Ctxt> ctxt_out;
+		cout << "Start of top-k" << endl;
+		top_k(ctxt_out, ctxt_in, k);
+
+		printNamedTimer(cout, "Comparison");
+		printNamedTimer(cout, "TopK");
+
+		const FHEtimer *top_k_timer = getTimerByName("TopK");
+
+		cout << "Avg. time per batch: " << 1000.0 * top_k_timer->getTime() / static_cast<double>(run + 1) / static_cast<double>(numbers_size) << " ms" << endl;
+		cout << "Number of integers in one ciphertext " << numbers_size << endl;
+
+		ctxt_out[0].cleanUp();
+		capacity = ctxt_out[0].bitCapacity();
+		cout << "Final capacity: " << capacity << endl;
+		if (capacity < min_capacity)
+			min_capacity = capacity;
+		cout << "Min. capacity: " << min_capacity << endl;
+
+		for (long r = 0; r < k; r++)
+		{
+			vector<ZZX> decrypted(nslots);
+			ea.decrypt(ctxt_out[r], secret_key(), decrypted);
+
+			if (m_verbose)
+			{
+				cout << "Output " << r << endl;
+				print_decrypted(ctxt_out[r]);
+				cout << endl;
+			}
+
+			for (long j = 0; j < numbers_size * m_expansionLen; j++)
+			{
+				if (decrypted[j] != expected_result[r][j])
+				{
+					printf("Output %ld, slot %ld: ", r, j);
+					printZZX(cout, decrypted[j], ord_p);
+					cout << endl;
+					cout << "Failure" << endl;
+					return;
+				}
+			}
+		}
+		cout << endl;
+	}
+}
+
+void Comparator::test_string_psm(long runs) const
+{
+	// reset timers
+	setTimersOn();
+	// initialize the random generator
+	random_device rd;
+	mt19937 eng(rd());
+	uniform_int_distribution<unsigned long> distr_u;
+	const EncryptedArray &ea = m_context.getEA();
+
+	unsigned long p = m_context.getP();
+	unsigned long slots = m_context.getZMStar().getNSlots();
+
+	long min_capacity = 1000;
+	long capacity;
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
+
+		string input;
+		// long input_v = (distr_u(eng) % (2*m_ss_size)) ;
+		long input_v = 1;
+		Ptxt<BGV> ptxt(m_context);
+		std::stringstream ss;
+		ss << std::setw(m_slotDeg * m_expansionLen) << std::setfill('0') << input_v;
+
+		string str = ss.str();
+		std::vector<char> v(str.begin(), str.end());
+		for (uint i = 0; i < m_expansionLen; i++)
+		{
+			ZZX poly = ZZX(INIT_MONO, 0, 0);
+			for (int iCoef = 0; iCoef < m_slotDeg; iCoef++)
+			{
+				poly += ZZX(INIT_MONO, iCoef, v[i + iCoef]);
+			}
+			ptxt[i] = poly;
+		}
+		Ctxt ctxt(m_pk);
+		m_pk.Encrypt(ctxt, ptxt);
+
+		ZZX expected_result;
+		if (input_v < m_ss_size)
+		{
+			expected_result = ZZX(INIT_MONO, 0, 1);
+		}
+		else
+		{
+			expected_result = ZZX(INIT_MONO, 0, 0);
+		}
+
+		std::cout << "Start of comparison" << endl;
+
+		Ctxt ctxt_res(m_pk);
+		reset_key_switches();
+		psm(ctxt_res, ctxt, m_ss);
+		cout << "Automorphism key switches per membership test: " << get_key_switches() << endl;
+
+		// remove the line below if it gives bizarre results
+		ctxt_res.cleanUp();
+		capacity = ctxt_res.bitCapacity();
+		cout << "Final capacity: " << capacity << endl;
+		if (capacity < min_capacity)
+			min_capacity = capacity;
+		cout << "Min. capacity: " << min_capacity << endl;
+		cout << "Final size: " << ctxt_res.logOfPrimeSet() / log(2.0) << endl;
+		if (m_capacityCheck)
+			check_capacity(ctxt_res, ctxt.bitCapacity(), circuit_depth(m_type, m_context.getP(), m_slotDeg, m_expansionLen, m_ss.size()));
+		vector<ZZX> decrypted(slots);
+		ea.decrypt(ctxt_res, secret_key(), decrypted);
+		if (decrypted[0] != expected_result)
+		{
+			cout << "Failure - Input: " << input_v << " Expected Value: ";
+			printZZX(cout, expected_result, m_context.getOrdP());
+			pd(ctxt_res, " Verified ", 0);
+			return;
+		}
+		cout << "end" << endl;
+	}
+
+	printNamedTimer(cout, "Comparison");
+	printNamedTimer(cout, "Rotation");
+	printNamedTimer(cout, "Rotation1");
+	printNamedTimer(cout, "Map");
+	printNamedTimer(cout, "Sub");
+
+	const FHEtimer *comp_timer = getTimerByName("Comparison");
+	cout << endl << "T: " << comp_timer->getTime() / static_cast<double>(runs) ;
+}
+
+void Comparator::test_compare_psm(long runs) const
+{
+	// reset timers
+	setTimersOn();
+	// initialize the random generator
+	random_device rd;
+	mt19937 eng(rd());
+	uniform_int_distribution<unsigned long> distr_u;
+	const EncryptedArray &ea = m_context.getEA();
+
+	unsigned long p = m_context.getP();
+	unsigned long slots = m_context.getZMStar().getNSlots();
+	unsigned long input_range = (p + 1) >> 1;
+
+	unsigned long enc_base = (p - 1) >> 1;
+
+	int space_bit_size = static_cast<int>(log2(input_range));
+	cout << "Space bit size " << space_bit_size << endl;
+	cout << "slots: " << slots << " slots in bits " << static_cast<int>(log2(slots)) << endl;
+	cout << "Maximal input: " << input_range << endl;
+
+	long min_capacity = 1000;
+	long capacity;
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
+
+		unsigned long input_x;
+		unsigned long input_y;
+		ZZX expected_result;
+
+		input_x = distr_u(eng) % input_range;
+		input_y = distr_u(eng) % input_range;
+
+		//input_x = 3437;
+		//input_y = 5800;
+
+		Ptxt<BGV> ptxt_x(m_context);
+		Ptxt<BGV> ptxt_y(m_context);
+		ptxt_x[0] = input_x;
+		ptxt_y[0] = input_y;
+
+		if (input_x < input_y)
+		{
+			expected_result = ZZX(INIT_MONO, 0, 1);
+		}
+		else
+		{
+			expected_result = ZZX(INIT_MONO, 0, 0);
+		}
+
+		Ctxt ctxt_x(m_pk);
+		Ctxt ctxt_y(m_pk);
+		m_pk.Encrypt(ctxt_x, ptxt_x);
+		m_pk.Encrypt(ctxt_y, ptxt_y);
+
+		std::cout << "Start of comparison" << endl;
+
+		// subract value from pattern
+		Ctxt ctxt_diff = ctxt_x;
+		ctxt_diff -= ctxt_y;
+
+		Ctxt ctxt_res(m_pk);
+		reset_key_switches();
+		psm(ctxt_res, ctxt_diff, m_ss);
+		cout << "Automorphism key switches per membership test: " << get_key_switches() << endl;
+
+		// remove the line below if it gives bizarre results
+		ctxt_res.cleanUp();
+		capacity = ctxt_res.bitCapacity();
+		cout << "Final capacity: " << capacity << endl;
+		if (capacity < min_capacity)
+			min_capacity = capacity;
+		cout << "Min. capacity: " << min_capacity << endl;
+		cout << "Final size: " << ctxt_res.logOfPrimeSet() / log(2.0) << endl;
+		if (m_capacityCheck)
+			check_capacity(ctxt_res, ctxt_diff.bitCapacity(), circuit_depth(m_type, m_context.getP(), m_slotDeg, m_expansionLen, m_ss.size()));
+		vector<ZZX> decrypted(slots);
+		ea.decrypt(ctxt_res, secret_key(), decrypted);
+		if (decrypted[0] != expected_result)
+		{
+			cout << "failure: X: " << input_x << " Y: " << input_y << endl;
+			cout << "Expected= " << expected_result[0];
+			pd(ctxt_res, " Verified ", 0);
+			cout << "Failure" << endl;
+			return;
+		}
+		cout << "end" << endl;
+	}
+
+	printNamedTimer(cout, "Comparison");
+	printNamedTimer(cout, "Rotation");
+	printNamedTimer(cout, "Rotation1");
+	printNamedTimer(cout, "Map");
+	printNamedTimer(cout, "Sub");
+
+	const FHEtimer *comp_timer = getTimerByName("Comparison");
+	cout << endl << "T: " << comp_timer->getTime() / static_cast<double>(runs) ;
+}
+
+void Comparator::test_compare(long runs) const
+{
+	// reset timers
+	setTimersOn();
+
+	// initialize the random generator
+	random_device rd;
+	mt19937 eng(rd());
+	uniform_int_distribution<unsigned long> distr_u;
+	uniform_int_distribution<long> distr_i;
+
+	// get EncryptedArray
+	const EncryptedArray &ea = m_context.getEA();
+
+	// extract number of slots
+	long nslots = ea.size();
+
+	// get p
+	unsigned long p = m_context.getP();
+
+	// order of p
+	unsigned long ord_p = m_context.getOrdP();
+
+	// amount of numbers in one ciphertext
+	unsigned long numbers_size = nslots / m_expansionLen;
+
+	// number of slots occupied by encoded numbers
+	unsigned long occupied_slots = numbers_size * m_expansionLen;
+
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long enc_base = (p + 1) >> 1;
+	if (m_type == BI || m_type == TAN)
+	{
+		enc_base = p;
+	}
+
+	unsigned long digit_base = power_long(enc_base, m_slotDeg);
+
+	// check that field_size^expansion_len fits into 64-bits
+	int space_bit_size = static_cast<int>(ceil(m_expansionLen * log2(digit_base)));
+	cout << "Space bit size " << static_cast<int>(m_expansionLen * log2(digit_base)) << endl;
+	cout << "base: " << enc_base << " slotDeg: " << m_slotDeg << " nslots: " << nslots << " digitBase: " << digit_base << " log2 " << log2(digit_base) << " expansion " << m_expansionLen << endl;
+	unsigned long input_range = ULONG_MAX;
+	if (space_bit_size < 64)
+	{
+		// input_range = power_long(field_size, expansion_len);
+		input_range = power_long(digit_base, m_expansionLen);
+	}
+	cout << "Maximal input: " << input_range << endl;
+
+	long min_capacity = 1000;
+	long capacity;
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
+
+		vector<ZZX> expected_result(occupied_slots);
+		vector<ZZX> decrypted(occupied_slots);
+
+		// Create the plaintext polynomials for the text and for the pattern
+		vector<ZZX> pol_x(nslots);
+		vector<ZZX> pol_y(nslots);
+
+		unsigned long input_x;
+		unsigned long input_y;
+		ZZX pol_slot;
+
+		for (int i = 0; i < numbers_size; i++)
+		{
+			input_x = distr_u(eng) % input_range;
+			input_y = distr_u(eng) % input_range;
+
+			if (m_verbose)
+			{
+				cout << "Input " << i << endl;
+				cout << input_x << endl;
+				cout << input_y << endl;
+			}
+
+			if (input_x < input_y)
+			{
+				expected_result[i * m_expansionLen] = ZZX(INIT_MONO, 0, 1);
+			}
+			else
+			{
+				expected_result[i * m_expansionLen] = ZZX(INIT_MONO, 0, 0);
+			}
+
+			vector<long> decomp_int_x;
+			vector<long> decomp_int_y;
+			vector<long> decomp_char;
+
+			// decomposition of input integers
+			digit_decomp(decomp_int_x, input_x, digit_base, m_expansionLen);
+			digit_decomp(decomp_int_y, input_y, digit_base, m_expansionLen);
+
+			if (m_verbose)
+			{
+				cout << "Input decomposition into digits" << endl;
+				for (int j = 0; j < m_expansionLen; j++)
+				{
+					cout << decomp_int_x[j] << " " << decomp_int_y[j] << endl;
+				}
+			}
+
+			// encoding of slots
+			for (int j = 0; j < m_expansionLen; j++)
+			{
+				// decomposition of a digit
+				int_to_slot(pol_slot, decomp_int_x[j], enc_base);
+				pol_x[i * m_expansionLen + j] = pol_slot;
+			}
+
+			for (int j = 0; j < m_expansionLen; j++)
+			{
+				// decomposition of a digit
+				int_to_slot(pol_slot, decomp_int_y[j], enc_base);
+				pol_y[i * m_expansionLen + j] = pol_slot;
+			}
+		}
+
+		if (m_verbose)
+		{
+			cout << "Input" << endl;
+			for (int i = 0; i < nslots; i++)
+			{
+				printZZX(cout, pol_x[i], ord_p);
+				printZZX(cout, pol_y[i], ord_p);
+				cout << endl;
+			}
+		}
+
+		Ctxt ctxt_x(m_pk);
+		Ctxt ctxt_y(m_pk);
+		ea.encrypt(ctxt_x, m_pk, pol_x);
+		ea.encrypt(ctxt_y, m_pk, pol_y);
+
+		Ctxt ctxt_res(m_pk);
+
+		// comparison function
+		cout << "Start of comparison" << endl;
+		reset_key_switches();
+		compare(ctxt_res, ctxt_x, ctxt_y);
+		cout << "Automorphism key switches per comparison: " << get_key_switches() << endl;
+
+		if (m_verbose)
+		{
+			cout << "Input" << endl;
+			for (int j = 0; j < nslots; j++)
+			{
+				printZZX(cout, pol_x[j], ord_p);
+				printZZX(cout, pol_y[j], ord_p);
+				cout << endl;
+			}
+
+			cout << "Output" << endl;
+			print_decrypted(ctxt_res);
+			cout << endl;
+		}
+		printNamedTimer(cout, "Extraction");
+		printNamedTimer(cout, "ComparisonCircuitBivar");
+		printNamedTimer(cout, "ComparisonCircuitUnivar");
+		printNamedTimer(cout, "EqualityCircuit");
+		printNamedTimer(cout, "ShiftMul");
+		printNamedTimer(cout, "ShiftAdd");
+		printNamedTimer(cout, "Comparison");
+
+		const FHEtimer *comp_timer = getTimerByName("Comparison");
+
+		cout << "Avg. time per integer: " << 1000.0 * comp_timer->getTime() / static_cast<double>(run + 1) / static_cast<double>(numbers_size) << " ms" << endl;
+		cout << "Number of integers in one ciphertext " << numbers_size << endl;
+		cout << "Total Time " << comp_timer->getTime() / static_cast<double>(run + 1) << " s" << endl;
+
+		// remove the line below if it gives bizarre results
+		ctxt_res.cleanUp();
+		capacity = ctxt_res.bitCapacity();
+		cout << "Final capacity: " << capacity << endl;
+		if (capacity < min_capacity)
+			min_capacity = capacity;
+		cout << "Min. capacity: " << min_capacity << endl;
+		cout << "Final size: " << ctxt_res.logOfPrimeSet() / log(2.0) << endl;
+		m_constCache.print_stats(cout);
+		long scratch_allocated, scratch_reused;
+		ScratchCtxt::get_stats(scratch_allocated, scratch_reused);
+		cout << "Scratch ciphertexts allocated: " << scratch_allocated << ", reused: " << scratch_reused << endl;
+		cout << "Resident memory: " << resident_memory_kb() << " KB" << endl;
+		if (m_capacityCheck)
+			check_capacity(ctxt_res, min(ctxt_x.bitCapacity(), ctxt_y.bitCapacity()), circuit_depth(m_type, p, m_slotDeg, m_expansionLen));
+		ea.decrypt(ctxt_res, secret_key(), decrypted);
+
+		for (int i = 0; i < numbers_size; i++)
+		{
+			if (decrypted[i * m_expansionLen] != expected_result[i * m_expansionLen])
+			{
+				printf("Slot %ld: ", i * m_expansionLen);
+				printZZX(cout, decrypted[i * m_expansionLen], ord_p);
+				cout << endl;
+				cout << "Failure" << endl;
+				return;
+			}
+		}
+		cout << endl;
+
+	}
+	const FHEtimer *comp_timer = getTimerByName("Comparison");
+	cout << endl << "T: " << comp_timer->getTime() / static_cast<double>(runs) ;
+}
+
+void Comparator::test_compare_wide(long bit_size, long runs) const
+{
+	// reset timers
+	setTimersOn();
+
+	// get EncryptedArray
+	const EncryptedArray &ea = m_context.getEA();
+
+	// extract number of slots
+	long nslots = ea.size();
+
+	// get p
+	unsigned long p = m_context.getP();
+
+	// order of p
+	unsigned long ord_p = m_context.getOrdP();
+
+	// amount of numbers in one ciphertext
+	long numbers_size = nslots / m_expansionLen;
+
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long enc_base = (p + 1) >> 1;
+	if (m_type == BI || m_type == TAN)
+	{
+		enc_base = p;
+	}
+
+	unsigned long digit_base = power_long(enc_base, m_slotDeg);
+
+	// number of ciphertexts needed to keep bit_size-bit integers
+	long digit_num = static_cast<long>(ceil(bit_size / log2(digit_base)));
+	long chunk_num = (digit_num + m_expansionLen - 1) / m_expansionLen;
+	cout << "Bit size " << bit_size << " digitBase: " << digit_base << " expansion " << m_expansionLen << " chunks: " << chunk_num << endl;
+
+	long min_capacity = 1000;
+	long capacity;
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
+
+		vector<ZZ> input_x(numbers_size);
+		vector<ZZ> input_y(numbers_size);
+		for (long i = 0; i < numbers_size; i++)
+		{
+			RandomBits(input_x[i], bit_size);
+			RandomBits(input_y[i], bit_size);
+
+			if (m_verbose)
+			{
+				cout << "Input " << i << endl;
+				cout << input_x[i] << endl;
+				cout << input_y[i] << endl;
+			}
+		}
+
+		vector<Ptxt<BGV>> ptxt_x;
+		vector<Ptxt<BGV>> ptxt_y;
+		encode_wide_values(ptxt_x, input_x, m_context, m_type, m_slotDeg, m_expansionLen, chunk_num);
+		encode_wide_values(ptxt_y, input_y, m_context, m_type, m_slotDeg, m_expansionLen, chunk_num);
+
+		vector<Ctxt> ctxt_x(chunk_num, Ctxt(m_pk));
+		vector<Ctxt> ctxt_y(chunk_num, Ctxt(m_pk));
+		for (long c = 0; c < chunk_num; c++)
+		{
+			m_pk.Encrypt(ctxt_x[c], ptxt_x[c]);
+			m_pk.Encrypt(ctxt_y[c], ptxt_y[c]);
+		}
+
+		Ctxt ctxt_res(m_pk);
+
+		// comparison function
+		cout << "Start of comparison" << endl;
+		reset_key_switches();
+		compare_wide(ctxt_res, ctxt_x, ctxt_y);
+		cout << "Automorphism key switches per comparison: " << get_key_switches() << endl;
+
+		if (m_verbose)
+		{
+			cout << "Output" << endl;
+			print_decrypted(ctxt_res);
+			cout << endl;
+		}
+		printNamedTimer(cout, "Extraction");
+		printNamedTimer(cout, "ComparisonCircuitBivar");
+		printNamedTimer(cout, "ComparisonCircuitUnivar");
+		printNamedTimer(cout, "EqualityCircuit");
+		printNamedTimer(cout, "ComparisonBatch");
+		printNamedTimer(cout, "ComparisonWide");
+
+		const FHEtimer *batch_timer = getTimerByName("ComparisonBatch");
+		const FHEtimer *wide_timer = getTimerByName("ComparisonWide");
+		double total_time = (batch_timer->getTime() + wide_timer->getTime()) / static_cast<double>(run + 1);
+
+		cout << "Avg. time per integer: " << 1000.0 * total_time / static_cast<double>(numbers_size) << " ms" << endl;
+		cout << "Number of integers in " << chunk_num << " ciphertexts " << numbers_size << endl;
+		cout << "Total Time " << total_time << " s" << endl;
+
+		// remove the line below if it gives bizarre results
+		ctxt_res.cleanUp();
+		capacity = ctxt_res.bitCapacity();
+		cout << "Final capacity: " << capacity << endl;
+		if (capacity < min_capacity)
+			min_capacity = capacity;
+		cout << "Min. capacity: " << min_capacity << endl;
+		cout << "Final size: " << ctxt_res.logOfPrimeSet() / log(2.0) << endl;
+		if (m_capacityCheck)
+			check_capacity(ctxt_res, min(ctxt_x[0].bitCapacity(), ctxt_y[0].bitCapacity()), compare_depth(m_type, p, m_slotDeg, m_expansionLen, true) + NTL::NumBits(chunk_num - 1));
+
+		vector<ZZX> decrypted(nslots);
+		ea.decrypt(ctxt_res, secret_key(), decrypted);
+
+		for (long i = 0; i < numbers_size; i++)
+		{
+			ZZX expected_result = ZZX(INIT_MONO, 0, input_x[i] < input_y[i] ? 1 : 0);
+			if (decrypted[i * m_expansionLen] != expected_result)
+			{
+				printf("Slot %ld: ", i * m_expansionLen);
+				printZZX(cout, decrypted[i * m_expansionLen], ord_p);
+				cout << endl;
+				cout << "Failure" << endl;
+				return;
 			}
-			ctxt_out.push_back(tmp_sum);
 		}
+		cout << endl;
 	}
-	else
-	{
-		// equality sums
-		vector<Ctxt> eq_sums;
+	const FHEtimer *batch_timer = getTimerByName("ComparisonBatch");
+	const FHEtimer *wide_timer = getTimerByName("ComparisonWide");
+	cout << endl << "T: " << (batch_timer->getTime() + wide_timer->getTime()) / static_cast<double>(runs);
+}
 
-		// fill ctxt_out with zeros
-		for (size_t i = 0; i < input_len; i++)
-		{
-			ctxt_out.push_back(Ctxt(ctxt_in[0].getPubKey()));
-			eq_sums.push_back(Ctxt(ctxt_in[0].getPubKey()));
-		}
+void Comparator::test_digit_predicates(long runs) const
+{
+	if (m_type != UNI || m_expansionLen != 1 || m_slotDeg != 1)
+		throw helib::LogicError("Digit predicates are only implemented with the univariate circuit for d = 1 and l = 1");
 
-		for (size_t i = 0; i < input_len; i++)
-		{
-			cout << "Adding element " << i << endl;
+	// reset timers
+	setTimersOn();
 
-			// hw_i^j, j in [1,p-1]
-			DynamicCtxtPowers hw_powers(ham_weights[i], p - 1);
+	// initialize the random generator
+	random_device rd;
+	mt19937 eng(rd());
 
-			// eq_sums[0] = 1 - hw_i^(p-1)
-			eq_sums[0].clear();
-			eq_sums[0] = hw_powers.getPower(p - 1);
-			eq_sums[0].negate();
-			eq_sums[0].addConstant(ZZX(1));
+	// get EncryptedArray
+	const EncryptedArray &ea = m_context.getEA();
 
-			// eq_sums[0] * ctxt_in[i]
-			eq_sums[0].multiplyBy(ctxt_in[i]);
+	// extract number of slots
+	long nslots = ea.size();
 
-			// sum_i eq_sums[0] * ctxt_in[i]
-			ctxt_out[0] += eq_sums[0];
+	// get p
+	unsigned long p = m_context.getP();
 
-			for (size_t k = 1; k < input_len; k++)
-			{
-				// zeroize
-				eq_sums[k].clear();
+	// digits are in [0, (p-1)/2]
+	uniform_int_distribution<unsigned long> distr_digit(0, (p - 1) >> 1);
 
-				// current sorting index
-				ZZ_p k_zzp;
-				k_zzp.init(ZZ(p));
-				k_zzp = k;
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
 
-				ZZ_p k_power;
-				k_power.init(ZZ(p));
+		vector<unsigned long> input_x(nslots);
+		vector<unsigned long> input_y(nslots);
+		vector<ZZX> pol_x(nslots);
+		vector<ZZX> pol_y(nslots);
+		for (long i = 0; i < nslots; i++)
+		{
+			input_x[i] = distr_digit(eng);
+			input_y[i] = distr_digit(eng);
+			pol_x[i] = ZZX(INIT_MONO, 0, input_x[i]);
+			pol_y[i] = ZZX(INIT_MONO, 0, input_y[i]);
+		}
 
-				for (int j = 1; j < p; j++)
-				{
-					// k^(p-1-j) mod p
-					k_power = power(k_zzp, p - 1 - j);
-					// hw_i^j
-					Ctxt tmp = hw_powers.getPower(j);
-					// hw_i^j * k^(p-1-j)
-					tmp.multByConstant(rep(k_power));
-					// sum hw_i^j * k^(p-1-j)
-					eq_sums[k] += tmp;
-				}
-				// add k^(p-1) to eq_sums
-				eq_sums[k].addConstant(rep(power(k_zzp, p - 1)));
+		Ctxt ctxt_x(m_pk);
+		Ctxt ctxt_y(m_pk);
+		ea.encrypt(ctxt_x, m_pk, pol_x);
+		ea.encrypt(ctxt_y, m_pk, pol_y);
 
-				// 1 - sum_(j=0)^(p-1) hw_i^j * k^(p-1-j)
-				eq_sums[k].negate();
-				eq_sums[k].addConstant(ZZX(1));
+		Ctxt ctxt_less(m_pk);
+		Ctxt ctxt_eq(m_pk);
+		Ctxt ctxt_min(m_pk);
+		Ctxt ctxt_max(m_pk);
+		digit_predicates(&ctxt_less, &ctxt_eq, &ctxt_min, &ctxt_max, ctxt_x, ctxt_y);
 
-				// eq_sums[k] * ctxt_in[i]
-				eq_sums[k].multiplyBy(ctxt_in[i]);
+		printNamedTimer(cout, "DigitPredicates");
 
-				// sum_i eq_sums[k] * ctxt_in[i]
-				ctxt_out[k] += eq_sums[k];
+		vector<ZZX> dec_less, dec_eq, dec_min, dec_max;
+		ea.decrypt(ctxt_less, secret_key(), dec_less);
+		ea.decrypt(ctxt_eq, secret_key(), dec_eq);
+		ea.decrypt(ctxt_min, secret_key(), dec_min);
+		ea.decrypt(ctxt_max, secret_key(), dec_max);
+
+		for (long i = 0; i < nslots; i++)
+		{
+			unsigned long x = input_x[i];
+			unsigned long y = input_y[i];
+			if (dec_less[i] != ZZX(INIT_MONO, 0, x < y ? 1 : 0) || dec_eq[i] != ZZX(INIT_MONO, 0, x == y ? 1 : 0) || dec_min[i] != ZZX(INIT_MONO, 0, min(x, y)) || dec_max[i] != ZZX(INIT_MONO, 0, max(x, y)))
+			{
+				printf("Slot %ld: x = %lu, y = %lu\n", i, x, y);
+				printZZX(cout, dec_less[i], 1);
+				printZZX(cout, dec_eq[i], 1);
+				printZZX(cout, dec_min[i], 1);
+				printZZX(cout, dec_max[i], 1);
+				cout << endl;
+				cout << "Failure" << endl;
+				return;
 			}
 		}
+		cout << "Less-than, equality, minimum and maximum of " << nslots << " digit pairs are correct" << endl;
 	}
-
-	// print output ciphertexts
-	/*
-	for(size_t i = 0; i < input_len; i++)
-	{
-		cout << i << " ctxt:" << endl;
-		print_decrypted(ctxt_out[i]);
-		cout << endl;
-	}
-	*/
-	HELIB_NTIMER_STOP(Sorting);
+	const FHEtimer *timer = getTimerByName("DigitPredicates");
+	cout << endl << "T: " << timer->getTime() / static_cast<double>(runs);
 }
 
-void Comparator::test_sorting(int num_to_sort, long runs) const
+void Comparator::test_in_range(long runs) const
 {
 	// reset timers
 	setTimersOn();
@@ -2405,7 +5328,6 @@ void Comparator::test_sorting(int num_to_sort, long runs) const
 	random_device rd;
 	mt19937 eng(rd());
 	uniform_int_distribution<unsigned long> distr_u;
-	uniform_int_distribution<long> distr_i;
 
 	// get EncryptedArray
 	const EncryptedArray &ea = m_context.getEA();
@@ -2440,356 +5362,298 @@ void Comparator::test_sorting(int num_to_sort, long runs) const
 	unsigned long input_range = ULONG_MAX;
 	if (space_bit_size < 64)
 	{
-		// input_range = power_long(field_size, expansion_len);
 		input_range = power_long(digit_base, m_expansionLen);
 	}
 	cout << "Maximal input: " << input_range << endl;
 
-	long min_capacity = 1000;
-	long capacity;
-
 	for (int run = 0; run < runs; run++)
 	{
 		printf("Run %d started\n", run);
 
-		// all slots contain the same value
-		vector<vector<ZZX>> expected_result;
-		for (int i = 0; i < num_to_sort; i++)
-		{
-			vector<ZZX> tmp_vec(occupied_slots, ZZX(INIT_MONO, 0, 0));
-			expected_result.push_back(tmp_vec);
-		}
+		vector<ZZX> expected_result(occupied_slots);
+		vector<ZZX> decrypted(occupied_slots);
 
-		// vector of input longs
-		vector<vector<unsigned long>> input_xs;
-		for (int i = 0; i < numbers_size; i++)
-		{
-			vector<unsigned long> tmp_vec(num_to_sort, 0);
-			input_xs.push_back(tmp_vec);
-		}
+		vector<ZZX> pol_x(nslots);
+		Ptxt<BGV> ptxt_lo(m_context);
+		Ptxt<BGV> ptxt_hi(m_context);
 
 		ZZX pol_slot;
 
-		// ciphertexts to sort
-		vector<Ctxt> ctxt_in;
-
-		// sorted ciphertexts
-		vector<Ctxt> ctxt_out;
-
-		for (int i = 0; i < num_to_sort; i++)
+		for (int i = 0; i < numbers_size; i++)
 		{
-			// the plaintext polynomials
-			vector<ZZX> pol_x(nslots);
-
-			// encoding of slots
-			for (int k = 0; k < numbers_size; k++)
-			{
-				unsigned long input_x = distr_u(eng) % input_range;
-
-				input_xs[k][i] = input_x;
-
-				if (m_verbose)
-				{
-					cout << "Input" << endl;
-					cout << input_x << endl;
-				}
-
-				vector<long> decomp_int_x;
-
-				// decomposition of input integers
-				digit_decomp(decomp_int_x, input_x, digit_base, m_expansionLen);
-				for (int j = 0; j < m_expansionLen; j++)
-				{
-					// decomposition of a digit
-					int_to_slot(pol_slot, decomp_int_x[j], enc_base);
-					pol_x[k * m_expansionLen + j] = pol_slot;
-				}
-			}
+			unsigned long input_x = distr_u(eng) % input_range;
+			unsigned long input_lo = distr_u(eng) % input_range;
+			unsigned long input_hi = distr_u(eng) % input_range;
+			if (input_hi < input_lo)
+				swap(input_lo, input_hi);
 
 			if (m_verbose)
 			{
-				cout << "Input" << endl;
-				for (int j = 0; j < nslots; j++)
-				{
-					printZZX(cout, pol_x[j], ord_p);
-					cout << endl;
-				}
+				cout << "Input " << i << endl;
+				cout << input_lo << " <= " << input_x << " < " << input_hi << endl;
 			}
 
-			Ctxt ctxt_x(m_pk);
-			ea.encrypt(ctxt_x, m_pk, pol_x);
+			if (input_lo <= input_x && input_x < input_hi)
+				expected_result[i * m_expansionLen] = ZZX(INIT_MONO, 0, 1);
+			else
+				expected_result[i * m_expansionLen] = ZZX(INIT_MONO, 0, 0);
 
-			ctxt_in.push_back(ctxt_x);
-		}
+			vector<long> decomp_int_x;
+			vector<long> decomp_int_lo;
+			vector<long> decomp_int_hi;
 
-		// cout << "Input" << endl;
-		for (int i = 0; i < numbers_size; i++)
-		{
-			// for (int j = 0; j < num_to_sort; j++)
-			//	cout << input_xs[i][j] << " ";
-			// cout << endl;
-			std::sort(input_xs[i].begin(), input_xs[i].end());
-		}
+			// decomposition of input integers
+			digit_decomp(decomp_int_x, input_x, digit_base, m_expansionLen);
+			digit_decomp(decomp_int_lo, input_lo, digit_base, m_expansionLen);
+			digit_decomp(decomp_int_hi, input_hi, digit_base, m_expansionLen);
 
-		// cout << "Expected results" << endl;
-		for (int i = num_to_sort - 1; i >= 0; i--)
-		{
-			for (int k = 0; k < numbers_size; k++)
+			// encoding of slots
+			for (int j = 0; j < m_expansionLen; j++)
 			{
-				vector<long> decomp_int_x;
+				int_to_slot(pol_slot, decomp_int_x[j], enc_base);
+				pol_x[i * m_expansionLen + j] = pol_slot;
 
-				// decomposition of input integers
-				digit_decomp(decomp_int_x, input_xs[k][i], digit_base, m_expansionLen);
-				for (int j = 0; j < m_expansionLen; j++)
-				{
-					// decomposition of a digit
-					int_to_slot(pol_slot, decomp_int_x[j], enc_base);
-					expected_result[num_to_sort - 1 - i][k * m_expansionLen + j] = pol_slot;
-				}
-			}
+				int_to_slot(pol_slot, decomp_int_lo[j], enc_base);
+				ptxt_lo[i * m_expansionLen + j] = pol_slot;
 
-			/*
-			cout << num_to_sort-1-i << endl;
-			for(int j = 0; j < nslots; j++)
-			{
-				printZZX(cout, expected_result[num_to_sort-1-i][j], ord_p);
-				cout << endl;
+				int_to_slot(pol_slot, decomp_int_hi[j], enc_base);
+				ptxt_hi[i * m_expansionLen + j] = pol_slot;
 			}
-			*/
 		}
 
-		// comparison function
-		cout << "Start of sorting" << endl;
-		this->sort(ctxt_out, ctxt_in);
+		Ctxt ctxt_x(m_pk);
+		ea.encrypt(ctxt_x, m_pk, pol_x);
 
-		printNamedTimer(cout, "Extraction");
-		printNamedTimer(cout, "ComparisonCircuitBivar");
-		printNamedTimer(cout, "ComparisonCircuitUnivar");
-		printNamedTimer(cout, "EqualityCircuit");
-		printNamedTimer(cout, "ShiftMul");
-		printNamedTimer(cout, "ShiftAdd");
-		printNamedTimer(cout, "Comparison");
-		printNamedTimer(cout, "Sorting");
+		// two comparisons with public bounds as a reference
+		cout << "Start of two comparisons" << endl;
+		Ctxt ctxt_less_lo(m_pk);
+		Ctxt ctxt_less_hi(m_pk);
+		compare(ctxt_less_lo, ctxt_x, ptxt_lo);
+		compare(ctxt_less_hi, ctxt_x, ptxt_hi);
 
-		const FHEtimer *sort_timer = getTimerByName("Sorting");
+		cout << "Start of range check" << endl;
+		Ctxt ctxt_res(m_pk);
+		in_range(ctxt_res, ctxt_x, ptxt_lo, ptxt_hi);
 
-		cout << "Avg. time per batch: " << 1000.0 * sort_timer->getTime() / static_cast<double>(run + 1) / static_cast<double>(numbers_size) << " ms" << endl;
-		cout << "Number of integers in one ciphertext " << numbers_size << endl;
+		printNamedTimer(cout, "Extraction");
+		printNamedTimer(cout, "ComparisonCircuitUnivar");
+		printNamedTimer(cout, "DigitPredicatesPlain");
+		printNamedTimer(cout, "ComparisonPlain");
+		printNamedTimer(cout, "InRange");
 
-		// remove the line below if it gives bizarre results
-		ctxt_out[0].cleanUp();
-		capacity = ctxt_out[0].bitCapacity();
-		cout << "Final capacity: " << capacity << endl;
-		if (capacity < min_capacity)
-			min_capacity = capacity;
-		cout << "Min. capacity: " << min_capacity << endl;
-		cout << "Final size: " << ctxt_out[0].logOfPrimeSet() / log(2.0) << endl;
+		const FHEtimer *comp_timer = getTimerByName("ComparisonPlain");
+		const FHEtimer *range_timer = getTimerByName("InRange");
+		cout << "Avg. time of two comparisons: " << comp_timer->getTime() / static_cast<double>(run + 1) << " s" << endl;
+		cout << "Avg. time of range check: " << range_timer->getTime() / static_cast<double>(run + 1) << " s" << endl;
 
-		for (int i = 0; i < num_to_sort; i++)
-		{
-			vector<ZZX> decrypted(nslots);
-			ea.decrypt(ctxt_out[i], m_sk, decrypted);
+		ctxt_res.cleanUp();
+		cout << "Final capacity: " << ctxt_res.bitCapacity() << endl;
+		if (m_capacityCheck)
+			check_capacity(ctxt_res, ctxt_x.bitCapacity(), range_depth(m_type, p, m_slotDeg, m_expansionLen));
+		ea.decrypt(ctxt_res, secret_key(), decrypted);
 
-			for (int j = 0; j < numbers_size; j++)
-			{
-				for (int k = 0; k < m_expansionLen; k++)
-				{
-					if (decrypted[j * m_expansionLen + k] != expected_result[i][j * m_expansionLen + k])
-					{
-						printf("Slot %ld: ", j * m_expansionLen + k);
-						printZZX(cout, decrypted[j * m_expansionLen + k], ord_p);
-						cout << endl;
-						cout << "Failure" << endl;
-						return;
-					}
-				}
+		for (int i = 0; i < numbers_size; i++)
+		{
+			if (decrypted[i * m_expansionLen] != expected_result[i * m_expansionLen])
+			{
+				printf("Slot %ld: ", i * m_expansionLen);
+				printZZX(cout, decrypted[i * m_expansionLen], ord_p);
+				cout << endl;
+				cout << "Failure" << endl;
+				return;
 			}
 		}
+		cout << endl;
 	}
 }
 
-void Comparator::test_string_psm(long runs) const
+void Comparator::test_bucketize(long bin_num, long runs) const
 {
+	if (bin_num < 1)
+		throw helib::LogicError("At least one threshold is needed");
+
 	// reset timers
 	setTimersOn();
+
 	// initialize the random generator
 	random_device rd;
 	mt19937 eng(rd());
 	uniform_int_distribution<unsigned long> distr_u;
+
+	// get EncryptedArray
 	const EncryptedArray &ea = m_context.getEA();
 
+	// amount of numbers in one ciphertext
+	unsigned long numbers_size = ea.size() / m_expansionLen;
+
+	// get p
 	unsigned long p = m_context.getP();
-	unsigned long slots = m_context.getZMStar().getNSlots();
 
-	long min_capacity = 1000;
-	long capacity;
+	// encoding base, ((p+1)/2)^d or p^d for the bivariate circuits
+	unsigned long enc_base = (m_type == BI || m_type == TAN) ? p : (p + 1) >> 1;
+	unsigned long digit_base = power_long(enc_base, m_slotDeg);
+
+	// check that field_size^expansion_len fits into 64-bits
+	int space_bit_size = static_cast<int>(ceil(m_expansionLen * log2(digit_base)));
+	unsigned long input_range = ULONG_MAX;
+	if (space_bit_size < 64)
+		input_range = power_long(digit_base, m_expansionLen);
+
 	for (int run = 0; run < runs; run++)
 	{
 		printf("Run %d started\n", run);
 
-		string input;
-		// long input_v = (distr_u(eng) % (2*m_ss_size)) ;
-		long input_v = 1;
-		Ptxt<BGV> ptxt(m_context);
-		std::stringstream ss;
-		ss << std::setw(m_slotDeg * m_expansionLen) << std::setfill('0') << input_v;
+		// sorted thresholds, repeated values give empty bins
+		vector<unsigned long> thresholds(bin_num);
+		for (long k = 0; k < bin_num; k++)
+			thresholds[k] = distr_u(eng) % input_range;
+		std::sort(thresholds.begin(), thresholds.end());
 
-		string str = ss.str();
-		std::vector<char> v(str.begin(), str.end());
-		for (uint i = 0; i < m_expansionLen; i++)
+		vector<unsigned long> input_x(numbers_size);
+		for (size_t i = 0; i < numbers_size; i++)
 		{
-			ZZX poly = ZZX(INIT_MONO, 0, 0);
-			for (int iCoef = 0; iCoef < m_slotDeg; iCoef++)
-			{
-				poly += ZZX(INIT_MONO, iCoef, v[i + iCoef]);
-			}
-			ptxt[i] = poly;
+			// some inputs hit the thresholds exactly
+			if (i % 4 == 0)
+				input_x[i] = thresholds[distr_u(eng) % bin_num];
+			else
+				input_x[i] = distr_u(eng) % input_range;
 		}
-		Ctxt ctxt(m_pk);
-		m_pk.Encrypt(ctxt, ptxt);
 
-		ZZX expected_result;
-		if (input_v < m_ss_size)
-		{
-			expected_result = ZZX(INIT_MONO, 0, 1);
-		}
-		else
-		{
-			expected_result = ZZX(INIT_MONO, 0, 0);
-		}
+		Ptxt<BGV> ptxt_x(m_context);
+		encode_batches(ptxt_x, input_x);
+		Ctxt ctxt_x(m_pk);
+		m_pk.Encrypt(ctxt_x, ptxt_x);
 
-		std::cout << "Start of comparison" << endl;
+		vector<Ctxt> ctxt_bins;
+		bucketize(ctxt_bins, ctxt_x, thresholds);
 
-		Ctxt ctxt_res(m_pk);
-		psm(ctxt_res, ctxt, m_ss);
+		printNamedTimer(cout, "Bucketize");
+		if (m_capacityCheck)
+			check_capacity(ctxt_bins[0], ctxt_x.bitCapacity(), range_depth(m_type, p, m_slotDeg, m_expansionLen));
 
-		// remove the line below if it gives bizarre results
-		ctxt_res.cleanUp();
-		capacity = ctxt_res.bitCapacity();
-		cout << "Final capacity: " << capacity << endl;
-		if (capacity < min_capacity)
-			min_capacity = capacity;
-		cout << "Min. capacity: " << min_capacity << endl;
-		cout << "Final size: " << ctxt_res.logOfPrimeSet() / log(2.0) << endl;
-		vector<ZZX> decrypted(slots);
-		ea.decrypt(ctxt_res, m_sk, decrypted);
-		if (decrypted[0] != expected_result)
+		vector<vector<ZZX>> decrypted(ctxt_bins.size());
+		for (size_t k = 0; k < ctxt_bins.size(); k++)
+			ea.decrypt(ctxt_bins[k], secret_key(), decrypted[k]);
+
+		for (size_t i = 0; i < numbers_size; i++)
 		{
-			cout << "Failure - Input: " << input_v << " Expected Value: ";
-			printZZX(cout, expected_result, m_context.getOrdP());
-			pd(ctxt_res, " Verified ", 0);
-			return;
+			// plaintext binning: the bin of x is the number of thresholds not larger than x
+			size_t bin = std::upper_bound(thresholds.begin(), thresholds.end(), input_x[i]) - thresholds.begin();
+			for (size_t k = 0; k < ctxt_bins.size(); k++)
+			{
+				if (decrypted[k][i * m_expansionLen] != ZZX(INIT_MONO, 0, k == bin ? 1 : 0))
+				{
+					printf("Number %zu: x = %lu, expected bin %zu, bin %zu is ", i, input_x[i], bin, k);
+					printZZX(cout, decrypted[k][i * m_expansionLen], m_slotDeg);
+					cout << endl;
+					cout << "Failure" << endl;
+					return;
+				}
+			}
 		}
-		cout << "end" << endl;
+		cout << "Bins of " << numbers_size << " numbers are correct" << endl;
 	}
-
-	printNamedTimer(cout, "Comparison");
-	printNamedTimer(cout, "Rotation");
-	printNamedTimer(cout, "Rotation1");
-	printNamedTimer(cout, "Map");
-	printNamedTimer(cout, "Sub");
-
-	const FHEtimer *comp_timer = getTimerByName("Comparison");
-	cout << endl << "T: " << comp_timer->getTime() / static_cast<double>(runs) ;
+	const FHEtimer *timer = getTimerByName("Bucketize");
+	cout << endl << "T: " << timer->getTime() / static_cast<double>(runs);
 }
 
-void Comparator::test_compare_psm(long runs) const
+void Comparator::test_compare_layout(const vector<long> &batch_lengths, long runs)
 {
 	// reset timers
 	setTimersOn();
+
 	// initialize the random generator
 	random_device rd;
 	mt19937 eng(rd());
 	uniform_int_distribution<unsigned long> distr_u;
+
 	const EncryptedArray &ea = m_context.getEA();
+	long nslots = ea.size();
 
-	unsigned long p = m_context.getP();
-	unsigned long slots = m_context.getZMStar().getNSlots();
-	unsigned long input_range = (p + 1) >> 1;
+	// repeat the pattern of batch lengths while it fits into one ciphertext
+	vector<long> lengths;
+	long occupied_slots = 0;
+	while (true)
+	{
+		bool is_full = false;
+		for (long len : batch_lengths)
+		{
+			if (occupied_slots + len > nslots)
+			{
+				is_full = true;
+				break;
+			}
+			lengths.push_back(len);
+			occupied_slots += len;
+		}
+		if (is_full || batch_lengths.empty())
+			break;
+	}
+	cout << "Number of batches: " << lengths.size() << ", occupied slots: " << occupied_slots << " of " << nslots << endl;
 
-	unsigned long enc_base = (p - 1) >> 1;
+	long layout = add_batch_layout(lengths);
 
-	int space_bit_size = static_cast<int>(log2(input_range));
-	cout << "Space bit size " << space_bit_size << endl;
-	cout << "slots: " << slots << " slots in bits " << static_cast<int>(log2(slots)) << endl;
-	cout << "Maximal input: " << input_range << endl;
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long p = m_context.getP();
+	unsigned long enc_base = (p + 1) >> 1;
+	if (m_type == BI || m_type == TAN)
+		enc_base = p;
+	unsigned long digit_base = power_long(enc_base, m_slotDeg);
 
-	long min_capacity = 1000;
-	long capacity;
 	for (int run = 0; run < runs; run++)
 	{
 		printf("Run %d started\n", run);
 
-		unsigned long input_x;
-		unsigned long input_y;
-		ZZX expected_result;
-
-		input_x = distr_u(eng) % input_range;
-		input_y = distr_u(eng) % input_range;
-
-		//input_x = 3437;
-		//input_y = 5800;
-
-		Ptxt<BGV> ptxt_x(m_context);
-		Ptxt<BGV> ptxt_y(m_context);
-		ptxt_x[0] = input_x;
-		ptxt_y[0] = input_y;
-
-		if (input_x < input_y)
+		vector<unsigned long> input_x(lengths.size());
+		vector<unsigned long> input_y(lengths.size());
+		for (size_t i = 0; i < lengths.size(); i++)
 		{
-			expected_result = ZZX(INIT_MONO, 0, 1);
-		}
-		else
-		{
-			expected_result = ZZX(INIT_MONO, 0, 0);
+			// check that field_size^batch_len fits into 64-bits
+			unsigned long input_range = ULONG_MAX;
+			if (ceil(lengths[i] * log2(digit_base)) < 64)
+				input_range = power_long(digit_base, lengths[i]);
+			input_x[i] = distr_u(eng) % input_range;
+			input_y[i] = distr_u(eng) % input_range;
 		}
 
+		Ptxt<BGV> ptxt_x, ptxt_y;
+		encode_values(ptxt_x, input_x, m_context, m_type, m_slotDeg, lengths);
+		encode_values(ptxt_y, input_y, m_context, m_type, m_slotDeg, lengths);
 		Ctxt ctxt_x(m_pk);
 		Ctxt ctxt_y(m_pk);
 		m_pk.Encrypt(ctxt_x, ptxt_x);
 		m_pk.Encrypt(ctxt_y, ptxt_y);
 
-		std::cout << "Start of comparison" << endl;
+		// all batches in one comparison
+		Ctxt ctxt_res(m_pk);
+		compare(ctxt_res, ctxt_x, ctxt_y, layout);
 
-		// subract value from pattern
-		Ctxt ctxt_diff = ctxt_x;
-		ctxt_diff -= ctxt_y;
+		printNamedTimer(cout, "Comparison");
+		const FHEtimer *comp_timer = getTimerByName("Comparison");
+		cout << "Avg. time per integer: " << 1000.0 * comp_timer->getTime() / static_cast<double>(run + 1) / static_cast<double>(lengths.size()) << " ms" << endl;
 
-		Ctxt ctxt_res(m_pk);
-		psm(ctxt_res, ctxt_diff, m_ss);
+		vector<ZZX> decrypted(nslots);
+		ea.decrypt(ctxt_res, secret_key(), decrypted);
 
-		// remove the line below if it gives bizarre results
-		ctxt_res.cleanUp();
-		capacity = ctxt_res.bitCapacity();
-		cout << "Final capacity: " << capacity << endl;
-		if (capacity < min_capacity)
-			min_capacity = capacity;
-		cout << "Min. capacity: " << min_capacity << endl;
-		cout << "Final size: " << ctxt_res.logOfPrimeSet() / log(2.0) << endl;
-		vector<ZZX> decrypted(slots);
-		ea.decrypt(ctxt_res, m_sk, decrypted);
-		if (decrypted[0] != expected_result)
+		long batch_start = 0;
+		for (size_t i = 0; i < lengths.size(); i++)
 		{
-			cout << "failure: X: " << input_x << " Y: " << input_y << endl;
-			cout << "Expected= " << expected_result[0];
-			pd(ctxt_res, " Verified ", 0);
-			cout << "Failure" << endl;
-			return;
+			ZZX expected = ZZX(INIT_MONO, 0, (input_x[i] < input_y[i]) ? 1 : 0);
+			if (decrypted[batch_start] != expected)
+			{
+				printf("Slot %ld: ", batch_start);
+				printZZX(cout, decrypted[batch_start], m_context.getOrdP());
+				printf("\n");
+				cout << "Failure in batch " << i << " of length " << lengths[i] << endl;
+				return;
+			}
+			batch_start += lengths[i];
 		}
-		cout << "end" << endl;
 	}
-
-	printNamedTimer(cout, "Comparison");
-	printNamedTimer(cout, "Rotation");
-	printNamedTimer(cout, "Rotation1");
-	printNamedTimer(cout, "Map");
-	printNamedTimer(cout, "Sub");
-
-	const FHEtimer *comp_timer = getTimerByName("Comparison");
-	cout << endl << "T: " << comp_timer->getTime() / static_cast<double>(runs) ;
 }
 
-void Comparator::test_compare(long runs) const
+void Comparator::test_compare_batch(long batch_size, long runs) const
 {
 	// reset timers
 	setTimersOn();
@@ -2798,7 +5662,6 @@ void Comparator::test_compare(long runs) const
 	random_device rd;
 	mt19937 eng(rd());
 	uniform_int_distribution<unsigned long> distr_u;
-	uniform_int_distribution<long> distr_i;
 
 	// get EncryptedArray
 	const EncryptedArray &ea = m_context.getEA();
@@ -2830,163 +5693,166 @@ void Comparator::test_compare(long runs) const
 
 	// check that field_size^expansion_len fits into 64-bits
 	int space_bit_size = static_cast<int>(ceil(m_expansionLen * log2(digit_base)));
-	cout << "Space bit size " << static_cast<int>(m_expansionLen * log2(digit_base)) << endl;
-	cout << "base: " << enc_base << " slotDeg: " << m_slotDeg << " nslots: " << nslots << " digitBase: " << digit_base << " log2 " << log2(digit_base) << " expansion " << m_expansionLen << endl;
 	unsigned long input_range = ULONG_MAX;
 	if (space_bit_size < 64)
 	{
-		// input_range = power_long(field_size, expansion_len);
 		input_range = power_long(digit_base, m_expansionLen);
 	}
 	cout << "Maximal input: " << input_range << endl;
 
-	long min_capacity = 1000;
-	long capacity;
+	long threads = AvailableThreads();
+	cout << "Number of threads: " << threads << endl;
+
+	double seq_time = 0;
+	double batch_time = 0;
+
 	for (int run = 0; run < runs; run++)
 	{
 		printf("Run %d started\n", run);
 
-		vector<ZZX> expected_result(occupied_slots);
-		vector<ZZX> decrypted(occupied_slots);
-
-		// Create the plaintext polynomials for the text and for the pattern
-		vector<ZZX> pol_x(nslots);
-		vector<ZZX> pol_y(nslots);
+		vector<vector<ZZX>> expected_result(batch_size, vector<ZZX>(occupied_slots));
+		vector<Ctxt> ctxt_x(batch_size, Ctxt(m_pk));
+		vector<Ctxt> ctxt_y(batch_size, Ctxt(m_pk));
 
-		unsigned long input_x;
-		unsigned long input_y;
 		ZZX pol_slot;
-
-		for (int i = 0; i < numbers_size; i++)
+		for (long iCtxt = 0; iCtxt < batch_size; iCtxt++)
 		{
-			input_x = distr_u(eng) % input_range;
-			input_y = distr_u(eng) % input_range;
-
-			if (m_verbose)
-			{
-				cout << "Input " << i << endl;
-				cout << input_x << endl;
-				cout << input_y << endl;
-			}
-
-			if (input_x < input_y)
-			{
-				expected_result[i * m_expansionLen] = ZZX(INIT_MONO, 0, 1);
-			}
-			else
+			vector<ZZX> pol_x(nslots);
+			vector<ZZX> pol_y(nslots);
+			for (int i = 0; i < numbers_size; i++)
 			{
-				expected_result[i * m_expansionLen] = ZZX(INIT_MONO, 0, 0);
-			}
+				unsigned long input_x = distr_u(eng) % input_range;
+				unsigned long input_y = distr_u(eng) % input_range;
 
-			vector<long> decomp_int_x;
-			vector<long> decomp_int_y;
-			vector<long> decomp_char;
+				expected_result[iCtxt][i * m_expansionLen] = ZZX(INIT_MONO, 0, (input_x < input_y) ? 1 : 0);
 
-			// decomposition of input integers
-			digit_decomp(decomp_int_x, input_x, digit_base, m_expansionLen);
-			digit_decomp(decomp_int_y, input_y, digit_base, m_expansionLen);
+				vector<long> decomp_int_x;
+				vector<long> decomp_int_y;
+				digit_decomp(decomp_int_x, input_x, digit_base, m_expansionLen);
+				digit_decomp(decomp_int_y, input_y, digit_base, m_expansionLen);
 
-			if (m_verbose)
-			{
-				cout << "Input decomposition into digits" << endl;
 				for (int j = 0; j < m_expansionLen; j++)
 				{
-					cout << decomp_int_x[j] << " " << decomp_int_y[j] << endl;
+					int_to_slot(pol_slot, decomp_int_x[j], enc_base);
+					pol_x[i * m_expansionLen + j] = pol_slot;
+					int_to_slot(pol_slot, decomp_int_y[j], enc_base);
+					pol_y[i * m_expansionLen + j] = pol_slot;
 				}
 			}
-
-			// encoding of slots
-			for (int j = 0; j < m_expansionLen; j++)
-			{
-				// decomposition of a digit
-				int_to_slot(pol_slot, decomp_int_x[j], enc_base);
-				pol_x[i * m_expansionLen + j] = pol_slot;
-			}
-
-			for (int j = 0; j < m_expansionLen; j++)
-			{
-				// decomposition of a digit
-				int_to_slot(pol_slot, decomp_int_y[j], enc_base);
-				pol_y[i * m_expansionLen + j] = pol_slot;
-			}
-		}
-
-		if (m_verbose)
-		{
-			cout << "Input" << endl;
-			for (int i = 0; i < nslots; i++)
-			{
-				printZZX(cout, pol_x[i], ord_p);
-				printZZX(cout, pol_y[i], ord_p);
-				cout << endl;
-			}
+			ea.encrypt(ctxt_x[iCtxt], m_pk, pol_x);
+			ea.encrypt(ctxt_y[iCtxt], m_pk, pol_y);
 		}
 
-		Ctxt ctxt_x(m_pk);
-		Ctxt ctxt_y(m_pk);
-		ea.encrypt(ctxt_x, m_pk, pol_x);
-		ea.encrypt(ctxt_y, m_pk, pol_y);
+		// one ciphertext after another
+		cout << "Start of sequential comparisons" << endl;
+		vector<Ctxt> ctxt_res_seq(batch_size, Ctxt(m_pk));
+		{
+			HELIB_NTIMER_START(ComparisonSequential);
+			for (long iCtxt = 0; iCtxt < batch_size; iCtxt++)
+				compare(ctxt_res_seq[iCtxt], ctxt_x[iCtxt], ctxt_y[iCtxt]);
+			HELIB_NTIMER_STOP(ComparisonSequential);
+		}
 
-		Ctxt ctxt_res(m_pk);
+		// all ciphertexts stage by stage
+		cout << "Start of batched comparisons" << endl;
+		vector<Ctxt> ctxt_res;
+		compare_batch(ctxt_res, ctxt_x, ctxt_y);
 
-		// comparison function
-		cout << "Start of comparison" << endl;
-		compare(ctxt_res, ctxt_x, ctxt_y);
+		seq_time = getTimerByName("ComparisonSequential")->getTime() / static_cast<double>(run + 1);
+		batch_time = getTimerByName("ComparisonBatch")->getTime() / static_cast<double>(run + 1);
 
-		if (m_verbose)
+		cout << "Sequential: " << seq_time << " s, " << batch_size * numbers_size / seq_time << " comparisons/s" << endl;
+		cout << "Batched: " << batch_time << " s, " << batch_size * numbers_size / batch_time << " comparisons/s, "
+			 << batch_size * numbers_size / batch_time / threads << " comparisons/s per core" << endl;
+
+		for (long iCtxt = 0; iCtxt < batch_size; iCtxt++)
 		{
-			cout << "Input" << endl;
-			for (int j = 0; j < nslots; j++)
+			vector<ZZX> decrypted(occupied_slots);
+			ea.decrypt(ctxt_res[iCtxt], secret_key(), decrypted);
+
+			for (int i = 0; i < numbers_size; i++)
 			{
-				printZZX(cout, pol_x[j], ord_p);
-				printZZX(cout, pol_y[j], ord_p);
-				cout << endl;
+				if (decrypted[i * m_expansionLen] != expected_result[iCtxt][i * m_expansionLen])
+				{
+					printf("Ciphertext %ld, slot %ld: ", iCtxt, i * m_expansionLen);
+					printZZX(cout, decrypted[i * m_expansionLen], ord_p);
+					cout << endl;
+					cout << "Failure" << endl;
+					return;
+				}
 			}
-
-			cout << "Output" << endl;
-			print_decrypted(ctxt_res);
-			cout << endl;
 		}
-		printNamedTimer(cout, "Extraction");
-		printNamedTimer(cout, "ComparisonCircuitBivar");
-		printNamedTimer(cout, "ComparisonCircuitUnivar");
-		printNamedTimer(cout, "EqualityCircuit");
-		printNamedTimer(cout, "ShiftMul");
-		printNamedTimer(cout, "ShiftAdd");
-		printNamedTimer(cout, "Comparison");
+		cout << endl;
+	}
+	cout << "Speedup: " << seq_time / batch_time << " with " << threads << " threads" << endl;
+}
 
-		const FHEtimer *comp_timer = getTimerByName("Comparison");
+void Comparator::test_level_planner(long runs)
+{
+	// stages of the comparison circuits
+	vector<const char *> stages = {"Extraction", "ComparisonCircuitUnivar", "ComparisonCircuitBivar", "EqualityCircuit",
+								   "ShiftMul", "BatchShiftForMul", "ShiftAdd", "BatchShift",
+								   "Rotation", "Map", "Sub", "Rotation1", "Cleaning", "LevelPlanner", "Comparison"};
 
-		cout << "Avg. time per integer: " << 1000.0 * comp_timer->getTime() / static_cast<double>(run + 1) / static_cast<double>(numbers_size) << " ms" << endl;
-		cout << "Number of integers in one ciphertext " << numbers_size << endl;
-		cout << "Total Time " << comp_timer->getTime() / static_cast<double>(run + 1) << " s" << endl;
+	bool level_planner = m_levelPlanner;
 
-		// remove the line below if it gives bizarre results
-		ctxt_res.cleanUp();
-		capacity = ctxt_res.bitCapacity();
-		cout << "Final capacity: " << capacity << endl;
-		if (capacity < min_capacity)
-			min_capacity = capacity;
-		cout << "Min. capacity: " << min_capacity << endl;
-		cout << "Final size: " << ctxt_res.logOfPrimeSet() / log(2.0) << endl;
-		ea.decrypt(ctxt_res, m_sk, decrypted);
+	// time of every stage with the planner off (i = 0) and on (i = 1)
+	vector<vector<double>> stage_times(2, vector<double>(stages.size(), 0.0));
+	for (int i = 0; i < 2; i++)
+	{
+		cout << "Level planner " << (i ? "on" : "off") << endl;
+		resetAllTimers();
+		m_levelPlanner = (i == 1);
+
+		if (m_type == PSMS)
+			test_string_psm(runs);
+		else if (m_type == PSM)
+			test_compare_psm(runs);
+		else
+			test_compare(runs);
 
-		for (int i = 0; i < numbers_size; i++)
+		for (size_t j = 0; j < stages.size(); j++)
 		{
-			if (decrypted[i * m_expansionLen] != expected_result[i * m_expansionLen])
-			{
-				printf("Slot %ld: ", i * m_expansionLen);
-				printZZX(cout, decrypted[i * m_expansionLen], ord_p);
-				cout << endl;
-				cout << "Failure" << endl;
-				return;
-			}
+			const FHEtimer *timer = getTimerByName(stages[j]);
+			if (timer != nullptr)
+				stage_times[i][j] = timer->getTime() / static_cast<double>(runs);
 		}
-		cout << endl;
+	}
+	m_levelPlanner = level_planner;
+
+	cout << "Stage times per run (planner off / on / saved)" << endl;
+	for (size_t j = 0; j < stages.size(); j++)
+	{
+		if (stage_times[0][j] == 0.0 && stage_times[1][j] == 0.0)
+			continue;
+		cout << stages[j] << ": " << stage_times[0][j] << " s / " << stage_times[1][j] << " s / "
+			 << stage_times[0][j] - stage_times[1][j] << " s" << endl;
+	}
+}
+
+void Comparator::test_scratch_pool(long runs) const
+{
+	// comparison time and scratch ciphertexts with the pool off (i = 0) and on (i = 1)
+	vector<double> times(2, 0.0);
+	vector<long> allocated(2, 0), reused(2, 0);
+	for (int i = 0; i < 2; i++)
+	{
+		cout << "Scratch pool " << (i ? "on" : "off") << endl;
+		resetAllTimers();
+		ScratchCtxt::set_enabled(i == 1);
+		ScratchCtxt::reset_stats();
 
+		test_compare(runs);
+
+		const FHEtimer *timer = getTimerByName("Comparison");
+		if (timer != nullptr)
+			times[i] = timer->getTime() / static_cast<double>(runs);
+		ScratchCtxt::get_stats(allocated[i], reused[i]);
 	}
-	const FHEtimer *comp_timer = getTimerByName("Comparison");
-	cout << endl << "T: " << comp_timer->getTime() / static_cast<double>(runs) ;
+	ScratchCtxt::set_enabled(true);
+
+	cout << "Comparison time per run (pool off / on): " << times[0] << " s / " << times[1] << " s" << endl;
+	cout << "Scratch ciphertexts allocated (pool off / on): " << allocated[0] << " / " << allocated[1] << ", reused with the pool: " << reused[1] << endl;
 }
 
 void Comparator::test_min_max(long runs) const
@@ -3168,8 +6034,8 @@ void Comparator::test_min_max(long runs) const
 			min_capacity = capacity;
 		cout << "Min. capacity: " << min_capacity << endl;
 		cout << "Final size: " << ctxt_min.logOfPrimeSet() / log(2.0) << endl;
-		ea.decrypt(ctxt_min, m_sk, decrypted_min);
-		ea.decrypt(ctxt_max, m_sk, decrypted_max);
+		ea.decrypt(ctxt_min, secret_key(), decrypted_min);
+		ea.decrypt(ctxt_max, secret_key(), decrypted_max);
 
 		for (int i = 0; i < numbers_size; i++)
 		{
@@ -3198,6 +6064,157 @@ void Comparator::test_min_max(long runs) const
 	}
 }
 
+void Comparator::test_slot_min_max(long num_values, long runs) const
+{
+	// reset timers
+	setTimersOn();
+
+	// initialize the random generator
+	random_device rd;
+	mt19937 eng(rd());
+	uniform_int_distribution<unsigned long> distr_u;
+
+	// get EncryptedArray
+	const EncryptedArray &ea = m_context.getEA();
+
+	// extract number of slots
+	long nslots = ea.size();
+
+	// order of p
+	unsigned long ord_p = m_context.getOrdP();
+
+	// amount of numbers in one ciphertext
+	long numbers_size = nslots / m_expansionLen;
+
+	if (num_values <= 0 || num_values > numbers_size)
+		num_values = numbers_size;
+	cout << "Number of values: " << num_values << endl;
+
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long enc_base = (m_context.getP() + 1) >> 1;
+	if (m_type == BI || m_type == TAN)
+	{
+		enc_base = m_context.getP();
+	}
+
+	unsigned long digit_base = power_long(enc_base, m_slotDeg);
+
+	// check that field_size^expansion_len fits into 64-bits
+	int space_bit_size = static_cast<int>(ceil(m_expansionLen * log2(digit_base)));
+	unsigned long input_range = ULONG_MAX;
+	if (space_bit_size < 64)
+	{
+		input_range = power_long(digit_base, m_expansionLen);
+	}
+	cout << "Maximal input: " << input_range << endl;
+
+	// encodes an integer into the slots of the ith batch
+	auto encode_value = [&](vector<ZZX> &pol, long i, unsigned long value) {
+		vector<long> decomp_int;
+		digit_decomp(decomp_int, value, digit_base, m_expansionLen);
+		for (long j = 0; j < m_expansionLen; j++)
+			int_to_slot(pol[i * m_expansionLen + j], decomp_int[j], enc_base);
+	};
+
+	long min_capacity = 1000;
+	long capacity;
+	for (int run = 0; run < runs; run++)
+	{
+		printf("Run %d started\n", run);
+
+		// the batches after num_values are filled with random values as well as they must be ignored
+		vector<ZZX> pol_x(nslots);
+		vector<unsigned long> input(numbers_size);
+		for (long i = 0; i < numbers_size; i++)
+		{
+			input[i] = distr_u(eng) % input_range;
+			// repeat values to test ties
+			if (i > 0 && distr_u(eng) % 4 == 0)
+				input[i] = input[distr_u(eng) % i];
+			encode_value(pol_x, i, input[i]);
+		}
+
+		unsigned long input_min = *min_element(input.begin(), input.begin() + num_values);
+		unsigned long input_max = *max_element(input.begin(), input.begin() + num_values);
+
+		vector<ZZX> expected_result_min(nslots);
+		vector<ZZX> expected_result_max(nslots);
+		if (num_values == 1)
+		{
+			expected_result_min = pol_x;
+			expected_result_max = pol_x;
+		}
+		else
+		{
+			for (long i = 0; i < num_values; i++)
+			{
+				encode_value(expected_result_min, i, input_min);
+				encode_value(expected_result_max, i, input_max);
+			}
+		}
+
+		Ctxt ctxt_x(m_pk);
+		ea.encrypt(ctxt_x, m_pk, pol_x);
+
+		Ctxt ctxt_min(m_pk);
+		Ctxt ctxt_max(m_pk);
+
+		cout << "Start of slot Min/Max" << endl;
+		slot_min(ctxt_min, ctxt_x, num_values);
+		slot_max(ctxt_max, ctxt_x, num_values);
+
+		if (m_verbose)
+		{
+			cout << "Input" << endl;
+			for (long i = 0; i < numbers_size; i++)
+				cout << input[i] << endl;
+
+			cout << "Output min" << endl;
+			print_decrypted(ctxt_min);
+			cout << endl;
+
+			cout << "Output max" << endl;
+			print_decrypted(ctxt_max);
+			cout << endl;
+		}
+		printNamedTimer(cout, "SlotMinMax");
+
+		const FHEtimer *slot_min_max_timer = getTimerByName("SlotMinMax");
+
+		cout << "Avg. time per slot min/max: " << 1000.0 * slot_min_max_timer->getTime() / static_cast<double>(2 * (run + 1)) << " ms" << endl;
+
+		ctxt_min.cleanUp();
+		capacity = ctxt_min.bitCapacity();
+		ctxt_max.cleanUp();
+		cout << "Final capacity: " << capacity << endl;
+		if (capacity < min_capacity)
+			min_capacity = capacity;
+		cout << "Min. capacity: " << min_capacity << endl;
+
+		vector<ZZX> decrypted_min(nslots);
+		vector<ZZX> decrypted_max(nslots);
+		ea.decrypt(ctxt_min, secret_key(), decrypted_min);
+		ea.decrypt(ctxt_max, secret_key(), decrypted_max);
+
+		// all slots are checked including the zero batches after num_values
+		for (long i = 0; i < nslots; i++)
+		{
+			if (decrypted_min[i] != expected_result_min[i] || decrypted_max[i] != expected_result_max[i])
+			{
+				printf("Slot %ld: ", i);
+				printZZX(cout, decrypted_min[i], ord_p);
+				cout << " ";
+				printZZX(cout, decrypted_max[i], ord_p);
+				cout << endl;
+				cout << "Failure" << endl;
+				return;
+			}
+		}
+		cout << endl;
+	}
+}
+
 void Comparator::test_array_min(int input_len, long depth, long runs) const
 {
 	// reset timers
@@ -3281,6 +6298,9 @@ void Comparator::test_array_min(int input_len, long depth, long runs) const
 			for (int k = 0; k < numbers_size; k++)
 			{
 				unsigned long input_x = distr_u(eng) % input_range;
+				// repeat values to test the positions of equal minima
+				if (i > 0 && distr_u(eng) % 4 == 0)
+					input_x = input_xs[k][distr_u(eng) % i];
 
 				input_xs[k][i] = input_x;
 
@@ -3331,6 +6351,20 @@ void Comparator::test_array_min(int input_len, long depth, long runs) const
 			// cout << "Output: " << output_xs[i] << endl;
 		}
 
+		// positions of the last minimum and the first maximum of every batch
+		vector<long> argmin_xs(numbers_size, 0);
+		vector<long> argmax_xs(numbers_size, 0);
+		for (int i = 0; i < numbers_size; i++)
+		{
+			for (int j = 0; j < input_len; j++)
+			{
+				if (input_xs[i][j] <= input_xs[i][argmin_xs[i]])
+					argmin_xs[i] = j;
+				if (input_xs[i][j] > input_xs[i][argmax_xs[i]])
+					argmax_xs[i] = j;
+			}
+		}
+
 		// cout << "Expected results" << endl;
 		for (int k = 0; k < numbers_size; k++)
 		{
@@ -3383,7 +6417,7 @@ void Comparator::test_array_min(int input_len, long depth, long runs) const
 		cout << "Final size: " << ctxt_out.logOfPrimeSet() / log(2.0) << endl;
 
 		vector<ZZX> decrypted(nslots);
-		ea.decrypt(ctxt_out, m_sk, decrypted);
+		ea.decrypt(ctxt_out, secret_key(), decrypted);
 
 		for (int j = 0; j < numbers_size; j++)
 		{
@@ -3399,5 +6433,172 @@ void Comparator::test_array_min(int input_len, long depth, long runs) const
 				}
 			}
 		}
+
+		// checks every slot of the first numbers_size batches against the value expected in the batch
+		auto check_batches = [&](const Ctxt &ctxt, const vector<ZZX> &expected, const char *name) {
+			vector<ZZX> decrypted_out(nslots);
+			ea.decrypt(ctxt, secret_key(), decrypted_out);
+			for (int j = 0; j < numbers_size; j++)
+			{
+				for (int k = 0; k < m_expansionLen; k++)
+				{
+					if (decrypted_out[j * m_expansionLen + k] != expected[j])
+					{
+						printf("%s, slot %ld: ", name, j * m_expansionLen + k);
+						printZZX(cout, decrypted_out[j * m_expansionLen + k], ord_p);
+						cout << endl;
+						cout << "Failure" << endl;
+						return false;
+					}
+				}
+			}
+			return true;
+		};
+
+		vector<ZZX> expected_argmin(numbers_size);
+		vector<ZZX> expected_argmax(numbers_size);
+		for (int j = 0; j < numbers_size; j++)
+		{
+			expected_argmin[j] = ZZX(argmin_xs[j]);
+			expected_argmax[j] = ZZX(argmax_xs[j]);
+		}
+
+		// the positions are encoded modulo p
+		if (input_len > p)
+			continue;
+
+		// the position of the minimum with the same tournament levels
+		cout << "Start of array argmin" << endl;
+		Ctxt ctxt_index(m_pk);
+		array_argmin(ctxt_out, ctxt_index, ctxt_in, depth);
+		printNamedTimer(cout, "ArrayArgMin");
+		ea.decrypt(ctxt_out, secret_key(), decrypted);
+		for (int j = 0; j < occupied_slots; j++)
+		{
+			if (decrypted[j] != expected_result[j])
+			{
+				printf("Argmin value, slot %d: ", j);
+				printZZX(cout, decrypted[j], ord_p);
+				cout << endl;
+				cout << "Failure" << endl;
+				return;
+			}
+		}
+		if (!check_batches(ctxt_index, expected_argmin, "Argmin index"))
+			return;
+
+		// the position of the maximum
+		cout << "Start of array argmax" << endl;
+		array_argmax(ctxt_out, ctxt_index, ctxt_in, depth);
+		if (!check_batches(ctxt_index, expected_argmax, "Argmax index"))
+			return;
+
+		// the one-hot vector of the minimum position (without tournament levels)
+		cout << "Start of one-hot array argmin" << endl;
+		vector<Ctxt> ctxt_onehot;
+		array_argmin(ctxt_out, ctxt_onehot, ctxt_in);
+		for (int i = 0; i < input_len; i++)
+		{
+			vector<ZZX> expected_onehot(numbers_size);
+			for (int j = 0; j < numbers_size; j++)
+				expected_onehot[j] = ZZX(argmin_xs[j] == i ? 1 : 0);
+			if (!check_batches(ctxt_onehot[i], expected_onehot, "One-hot argmin"))
+				return;
+		}
+		cout << endl;
+	}
+}
+
+void he_cmp::encode_values(Ptxt<BGV> &ptxt, const vector<unsigned long> &values, const Context &context, CircuitType type, unsigned long d, unsigned long expansion_len)
+{
+	if (values.size() * expansion_len > context.getEA().size())
+		throw helib::LogicError("Too many values to encode into one plaintext");
+
+	encode_values(ptxt, values, context, type, d, vector<long>(values.size(), expansion_len));
+}
+
+void he_cmp::encode_values(Ptxt<BGV> &ptxt, const vector<unsigned long> &values, const Context &context, CircuitType type, unsigned long d, const vector<long> &batch_lengths)
+{
+	if (values.size() > batch_lengths.size())
+		throw helib::LogicError("More values than batches");
+
+	long nslots = context.getEA().size();
+	if (accumulate(batch_lengths.begin(), batch_lengths.end(), 0L) > nslots)
+		throw helib::LogicError("Too many values to encode into one plaintext");
+
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long p = context.getP();
+	unsigned long enc_base = (p + 1) >> 1;
+	if (type == BI || type == TAN)
+	{
+		enc_base = p;
+	}
+	unsigned long digit_base = power_long(enc_base, d);
+
+	ptxt = Ptxt<BGV>(context);
+
+	long batch_start = 0;
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		long batch_len = batch_lengths[i];
+		vector<long> decomp;
+		digit_decomp(decomp, values[i], digit_base, batch_len);
+		for (long j = 0; j < batch_len; j++)
+		{
+			// decomposition of a digit into the coefficients of a slot polynomial
+			vector<long> coefs;
+			digit_decomp(coefs, decomp[j], enc_base, d);
+			ZZX pol_slot;
+			for (long iCoef = 0; iCoef < d; iCoef++)
+				SetCoeff(pol_slot, iCoef, coefs[iCoef]);
+			ptxt[batch_start + j] = pol_slot;
+		}
+		batch_start += batch_len;
+	}
+}
+
+void he_cmp::encode_wide_values(vector<Ptxt<BGV>> &ptxts, const vector<ZZ> &values, const Context &context, CircuitType type, unsigned long d, unsigned long expansion_len, long chunk_num)
+{
+	long nslots = context.getEA().size();
+
+	if (values.size() * expansion_len > nslots)
+		throw helib::LogicError("Too many values to encode into one plaintext");
+
+	// encoding base, ((p+1)/2)^d
+	// if 2-variable comparison polynomial is used, it must be p^d
+	unsigned long p = context.getP();
+	unsigned long enc_base = (p + 1) >> 1;
+	if (type == BI || type == TAN)
+	{
+		enc_base = p;
+	}
+	ZZ digit_base = power_ZZ(enc_base, d);
+
+	ptxts.assign(chunk_num, Ptxt<BGV>(context));
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		if (values[i] >= power(digit_base, chunk_num * expansion_len))
+			throw helib::LogicError("Value does not fit into the chunks");
+
+		// digits of the value, the jth digit of the cth chunk is the digit c*expansion_len + j
+		ZZ rest = values[i];
+		for (long c = 0; c < chunk_num; c++)
+		{
+			for (long j = 0; j < expansion_len; j++)
+			{
+				ZZ digit;
+				DivRem(rest, digit, rest, digit_base);
+
+				// decomposition of a digit into the coefficients of a slot polynomial
+				vector<long> coefs;
+				digit_decomp(coefs, conv<long>(digit), enc_base, d);
+				ZZX pol_slot;
+				for (long iCoef = 0; iCoef < d; iCoef++)
+					SetCoeff(pol_slot, iCoef, coefs[iCoef]);
+				ptxts[c][i * expansion_len + j] = pol_slot;
+			}
+		}
 	}
 }
+
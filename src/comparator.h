@@ -9,6 +9,8 @@ Comparator class: creates all auxiliary information necessary to compare integer
 #include <helib/Ptxt.h>
 #include <helib/norms.h>
 #include <NTL/mat_ZZ.h>
+#include <atomic>
+#include "tools.h"
 
 using namespace std;
 using namespace NTL;
@@ -17,6 +19,18 @@ using namespace helib;
 namespace he_cmp{
 enum CircuitType{UNI, BI, TAN, PSM, PSMS};
 
+// execution plan of array_min
+struct ArrayMinPlan{
+  // number of tournament levels
+  long depth;
+  // true if the final table is reduced via equality of Hamming weights, false if via punctured products
+  bool via_equality;
+  // estimated multiplicative depth
+  long mul_depth;
+  // estimated cost in ciphertext multiplications
+  double cost;
+};
+
 class Comparator{
     const Context& m_context;
 
@@ -26,8 +40,8 @@ class Comparator{
   	// expansion length
   	unsigned long m_expansionLen;
 
-  	// vector of multiplicative masks
-  	vector<DoubleCRT> m_mulMasks;
+  	// vector of multiplicative masks (small coefficients, converted to DoubleCRT on demand)
+  	vector<zzX> m_mulMasks;
 
     // vector of multiplicative mask size
     vector<double> m_mulMasksSize;
@@ -41,6 +55,10 @@ class Comparator{
     // univariate comparison polynomial of the less-than function
     ZZX m_univar_min_max_poly;
 
+    // the same polynomials before compute_poly_params makes them monic
+    ZZX m_univar_less_poly_raw;
+    ZZX m_univar_min_max_poly_raw;
+
     // bivariate comparison polynomial coefficients of the less-than function
     mat_ZZ m_bivar_less_coefs; 
 
@@ -65,14 +83,14 @@ class Comparator{
     // slot generator
     ZZX m_slot_gen;
 
-    // secret key
-    SecKey m_sk;
+    // secret key (null if the comparator only evaluates), it is only used to decrypt in the test functions and debug output
+    const SecKey* m_sk;
 
-    // public key
-    PubKey m_pk;
+    // public key with the key-switching matrices, shared with the caller and other comparators
+    const PubKey& m_pk;
 
-    // elements of F_{p^d} for extraction of F_p elements
-    vector<vector<DoubleCRT>> m_extraction_const;
+    // elements of F_{p^d} for extraction of F_p elements (small coefficients, converted to DoubleCRT on demand)
+    vector<vector<zzX>> m_extraction_const;
     vector<vector<double>> m_extraction_const_size;
 
     // PSM set
@@ -84,10 +102,62 @@ class Comparator{
   	// print/hide flag for debugging
   	bool m_verbose;
 
+    // relinearize sums of products once instead of every product in polynomial evaluation
+    bool m_lazyRelin;
+
+    // mod-switch operands down to their base prime set before rotations and multiplications
+    bool m_levelPlanner;
+
+    // compare the final capacity in the test functions with the predicted one
+    bool m_capacityCheck;
+
+    // masks and extraction constants over the prime sets of recent ciphertexts
+    mutable DoubleCRTCache m_constCache;
+
+    // capacity of m_constCache set by the user (0 to fit all masks and extraction constants)
+    size_t m_constCacheSize;
+
+    // set the capacity of m_constCache and print the memory of the constants
+    void fit_constant_cache();
+
+    // hypercube dimension of batch shifts by 1D rotations (-1 for rotations of all slots)
+    long m_rotationDim;
+
+    // estimated key switches of one batch shift
+    long m_shiftKeySwitches;
+
+    // automorphism key switches (rotations and Frobenius maps) since the last reset
+    mutable std::atomic<long> m_keySwitches;
+
     // create multiplicative masks for shifts
-  	DoubleCRT create_shift_mask(double& size, long shift);
+  	zzX create_shift_mask(double& size, long shift, const vector<long>& borders);
+  	zzX create_first_slot_mask(double& size, const vector<long>& borders);
   	void create_all_shift_masks();
 
+    // slot batches of a layout, batch i covers the slots borders[i], ..., borders[i+1]-1
+    struct BatchLayout
+    {
+      vector<long> borders;
+      // length of the longest batch
+      long max_len;
+      // position of the mask of the shift by 1 in m_mulMasks, the masks of the shifts by 2^k follow
+      long first_mask;
+      // position of the mask of the first slot of every batch in m_mulMasks (-1 for batches of one slot)
+      long first_slot_mask;
+    };
+
+    // layout 0 are the uniform batches of expansion_len slots
+    vector<BatchLayout> m_layouts;
+
+    // borders of the uniform batches of expansion_len slots
+    vector<long> uniform_borders() const;
+
+    // store a layout with the masks of its shifts, returns its id
+    long create_layout(const vector<long>& borders);
+
+    // length of the longest batch of a layout
+    long batch_len(long layout = 0) const;
+
     
     void create_psm_masks();
 
@@ -102,20 +172,26 @@ class Comparator{
     // initialize extraction constants
     void extraction_init();
 
+    // extraction constant as DoubleCRT over the given primes
+    shared_ptr<const DoubleCRT> get_extraction_const(double& size, long iCoef, long iFrob, const IndexSet& primes) const;
+
     // extract F_p elements from slots
     void extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) const; 
 
-    // shifts ciphertext slots to the left by shift within batches of size m_expansionLen starting at start. Slots shifted outside their respective batches are zeroized.
-    void batch_shift(Ctxt& ctxt, long start, long shift) const;
+    // extract F_p elements of slots of a plaintext
+    void extract_mod_p(vector<vector<long>>& mod_p_coefs, const Ptxt<BGV>& ptxt_x) const;
+
+    // shifts ciphertext slots to the left by shift within the batches of a layout. Slots shifted outside their respective batches are zeroized.
+    void batch_shift(Ctxt& ctxt, long start, long shift, long layout = 0) const;
     
-    // shifts ciphertext slots to the left by shift within batches of size m_expansionLen starting at start. Slots shifted outside their respective batches filled with 1.
-    void batch_shift_for_mul(Ctxt& ctxt, long start, long shift) const;
+    // shifts ciphertext slots to the left by shift within the batches of a layout. Slots shifted outside their respective batches filled with 1.
+    void batch_shift_for_mul(Ctxt& ctxt, long start, long shift, long layout = 0) const;
 
     // running sums of slot batches
-    void shift_and_add(Ctxt& x, long start, long shift_direction = false) const;
+    void shift_and_add(Ctxt& x, long start, long shift_direction = false, long layout = 0) const;
 
     // running products of slot batches
-    void shift_and_mul(Ctxt& x, long start, long shift_direction = false) const;
+    void shift_and_mul(Ctxt& x, long start, long shift_direction = false, long layout = 0) const;
 
     // send non-zero elements of a field F_{p^d} to 1 and zero to 0
     // if pow = 1, this map operates on elements of the prime field F_p
@@ -125,6 +201,9 @@ class Comparator{
     // univariate comparison polynomial evaluation
     void evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt& x) const;
 
+    // the same with the square of x computed by the caller
+    void evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt& x, const Ctxt& x2) const;
+
     // univariate min/max polynomial evaluation
     void evaluate_min_max_poly(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const;
 
@@ -158,17 +237,119 @@ class Comparator{
     // conversion to slots
     void int_to_slot(ZZX& poly, unsigned long input, unsigned long enc_base) const;
 
+    // tournament levels of array_min: the minimum (or maximum) of every compared pair and, if ctxt_idx is given, its position are kept
+    void array_min_tournament(vector<Ctxt>& ctxt_vec, vector<Ctxt>* ctxt_idx, long depth, bool is_max) const;
+
+    // evaluate sum_j coefs[j] * x^j with slot-wise coefficients by the Paterson-Stockmeyer algorithm,
+    // coefficients that are the same in all slots are multiplied as scalars without encoding
+    void evaluate_slot_poly(Ctxt& ctxt_res, const vector<vector<long>>& coefs, DynamicCtxtPowers& x_powers, long baby_num) const;
+
+    // coefficients of x < y as a univariate polynomial in x for a public y (entry j is the coefficient of x^j)
+    void plain_less_row(vector<long>& row, long y) const;
+
+    // less-than and equality functions of a ciphertext digit and several public digits per slot with shared powers of x
+    void digit_predicates_plain(vector<Ctxt>& ctxt_less, vector<Ctxt>& ctxt_eq, const Ctxt& ctxt_x, const vector<vector<long>>& bounds) const;
+
+    // univariate comparisons of compare_batch: every stage runs for all pairs on the thread pool before the next one
+    void compare_batch_univar(vector<Ctxt>& ctxt_res, vector<Ctxt>* ctxt_res_eq, const vector<Ctxt>& ctxt_x, const vector<Ctxt>& ctxt_y) const;
+
+    // less-than and equality functions of every digit of the difference z = x - y (univariate circuit)
+    void less_eq_digits_univar(vector<Ctxt>& ctxt_less_p, vector<Ctxt>& ctxt_eq_p, const Ctxt& ctxt_z) const;
+
+    // the same for the differences of x and several public bounds, ctxt_less_p[k][i] compares the ith digit with bounds_p[k][i] (one value per slot)
+    // the digits of x and their squares are shared by all bounds, (x - y)^2 = x^2 - 2xy + y^2 needs no further multiplication
+    void less_eq_digits_univar_plain(vector<vector<Ctxt>>& ctxt_less_p, vector<vector<Ctxt>>& ctxt_eq_p, const Ctxt& ctxt_x, const vector<vector<vector<long>>>& bounds_p) const;
+
+    // comparison result of whole vectors from the less-than and equality results of digits
+    // the equality of whole vectors is returned in ctxt_res_eq if it is not null
+    void compare_from_digits(Ctxt& ctxt_res, Ctxt* ctxt_res_eq, vector<Ctxt>& ctxt_less_p, vector<Ctxt>& ctxt_eq_p, long layout = 0) const;
+
+    // rotation by |shift| < expansion_len where only slots whose source lies in the same batch are used afterwards
+    // (1D rotation along m_rotationDim if the batches of the uniform layout fit into its rows)
+    void rotate_in_batches(Ctxt& ctxt, long shift, long layout = 0) const;
+
+    // rotation of all slots
+    void rotate_slots(Ctxt& ctxt, long shift) const;
+
+    // comparison circuit using ctxt_x as work space, ctxt_res may be ctxt_x as it is written only at the end
+    // equality is returned only if ctxt_res_eq is not null
+    void compare_in_place(Ctxt& ctxt_res, Ctxt* ctxt_res_eq, Ctxt& ctxt_x, const Ctxt& ctxt_y, long layout = 0) const;
+
+    // combine the less-than and equality results of digits into the results of the whole slot (the input vectors are overwritten)
+    void combine_digits(Ctxt& ctxt_less, Ctxt& ctxt_eq, vector<Ctxt>& ctxt_less_p, vector<Ctxt>& ctxt_eq_p) const;
+
+    // compare the pairs of ciphertexts pairs[first_pair], ..., pairs[first_pair + pair_num - 1] in parallel
+    void compare_pairs(vector<Ctxt>& ctxt_res, const vector<Ctxt>& ctxt_in, const vector<pair<size_t, size_t>>& pairs, size_t first_pair, size_t pair_num) const;
+
+    // multiply the count-th factor to a product kept as a stack of partial products of depth O(log(count))
+    void multiply_to_stack(vector<Ctxt>& ctxt_stack, const Ctxt& ctxt_factor, long count) const;
+
+    // one-hot indicators of the minimum (or maximum) of an array computed from the table of all pairwise comparisons
+    void array_min_indicators(vector<Ctxt>& ctxt_ind, const vector<Ctxt>& ctxt_in, bool is_max, bool via_equality) const;
+
+    // minimum/maximum of an array together with its position
+    void array_arg(Ctxt& ctxt_res, Ctxt* ctxt_index, vector<Ctxt>* ctxt_onehot, const vector<Ctxt>& ctxt_in, long depth, bool is_max) const;
+
+    // minimum/maximum of the values stored in the slot batches of one ciphertext
+    void slot_min_max(Ctxt& ctxt_res, const Ctxt& ctxt_in, long num_values, bool is_max) const;
+
+    // estimated number of modulus bits consumed by one multiplication level
+    double level_bits() const;
+
+    // drop the primes of the ciphertext modulus that only carry noise (if the level planner is on). The capacity is kept,
+    // since the ciphertext may be used after the current sub-circuit, e.g. a comparison result in min/max or sorting
+    void drop_to_base(Ctxt& ctxt) const;
+
+    // encode values[i] into the ith slot batch of a plaintext, the remaining slots are zero
+    void encode_batches(Ptxt<BGV>& ptxt, const vector<unsigned long>& values) const;
+
+    // copy the first slot batch of a ciphertext into the first 'count' batches (the other batches must be zero)
+    void replicate_batches(Ctxt& ctxt, long count) const;
+
+    // copy the first slot of every uniform batch into the other slots of the batch, e.g. a comparison result that is valid only in the first slot
+    void spread_first_slot(Ctxt& ctxt) const;
+
+    // slot j gets the sum (or the product if mul is set) of the slots j + k*unit for 0 <= k < count using about 2*log2(count) rotations,
+    // count needs not be a power of two
+    void rotate_and_combine(Ctxt& ctxt, long count, long unit, bool mul) const;
+
     // compute an array of positions of ciphertexts in ctxt_in when sorted
     void get_sorting_index(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const;
 
     // find the primitive root of a SIMD slot
     void find_prim_root(ZZ_pE& root) const; 
 
+    // secret key for decryption, throws if the comparator was created from a public key
+    const SecKey& secret_key() const;
+
 public:
-  // constructor
+  // constructor of an evaluator that only holds the public key with the key-switching matrices
+  // the key is kept by reference, so it must outlive the comparator
+	Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, const PubKey& pk, bool verbose, unsigned long ss_size = 1);
+
+  // constructor that can also decrypt (test functions and debug output), the secret key must outlive the comparator
 	Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len,  const SecKey& sk, bool verbose, unsigned long ss_size = 1);
 
-	const DoubleCRT& get_mask(double& size, long index) const;
+  // switch lazy relinearization in polynomial evaluation on/off (on by default)
+  void set_lazy_relin(bool lazy_relin);
+
+  // switch the level planner on/off (off by default)
+  void set_level_planner(bool level_planner);
+
+  // mask as DoubleCRT over the given primes (usually the prime set of the ciphertext it multiplies)
+	shared_ptr<const DoubleCRT> get_mask(double& size, long index, const IndexSet& primes) const;
+
+  // maximal number of masks and constants kept as DoubleCRT (0 to fit all of them at two prime sets, the default)
+  void set_constant_cache_size(size_t size);
+
+  // add a layout of consecutive slot batches of the given lengths starting at slot 0 and create the masks of its shifts,
+  // returns the id of the layout to pass to compare/compare_full. Values of all batches are compared by one comparison, the result of a batch
+  // is in its first slot. Layouts are added before the comparator is shared, comparisons with different layouts may then run concurrently
+  long add_batch_layout(const vector<long>& batch_lengths);
+
+  // number of automorphism key switches since the last reset
+  long get_key_switches() const;
+  void reset_key_switches() const;
   const ZZX& get_less_than_poly() const;
   const ZZX& get_min_max_poly() const;
 
@@ -180,35 +361,162 @@ public:
 
   void pd(const Ctxt& ctxt, string preamble = "", int i = -1) const;
 
-  // comparison function
-  void compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const;
+  // comparison function, the slots are split into the batches of a layout (0 is the uniform layout of expansion_len slots)
+  void compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y, long layout = 0) const;
+
+  // the same using x as work space, x is garbage afterwards
+  void compare(Ctxt& ctxt_res, Ctxt&& ctxt_x, const Ctxt& ctxt_y, long layout = 0) const;
+
+  // comparison with a public value, y is encoded in the same way as encrypted inputs
+  void compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ptxt<BGV>& ptxt_y) const;
+
+  // comparison of many pairs of ciphertexts advancing all of them through the same stages on the NTL thread pool
+  // the equality results are returned too if ctxt_res_eq is not null
+  void compare_batch(vector<Ctxt>& ctxt_res, const vector<Ctxt>& ctxt_x, const vector<Ctxt>& ctxt_y, vector<Ctxt>* ctxt_res_eq = nullptr) const;
+
+  // comparison of wide integers split into chunks of expansion_len digits, the ith ciphertext keeps the ith chunk of every integer
+  // (the last chunk is the most significant one). The chunks are compared in parallel and combined by a tree of depth ceil(log2(chunk number))
+  void compare_wide(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_x, const vector<Ctxt>& ctxt_y, Ctxt* ctxt_res_eq = nullptr) const;
+
+  // comparison function returning x < y and x == y computed by the same circuit (both valid in the first slot of every batch)
+  void compare_full(Ctxt& ctxt_res_less, Ctxt& ctxt_res_eq, const Ctxt& ctxt_x, const Ctxt& ctxt_y, long layout = 0) const;
+  void compare_full(Ctxt& ctxt_res_less, Ctxt& ctxt_res_eq, Ctxt&& ctxt_x, const Ctxt& ctxt_y, long layout = 0) const;
+  void compare_full(Ctxt& ctxt_res_less, Ctxt& ctxt_res_eq, const Ctxt& ctxt_x, const Ptxt<BGV>& ptxt_y) const;
 
   void expandProd(Ctxt &ctxt_res, unsigned long p) const;
 
   // Private Set Membership Function
-  void psm(Ctxt& ctxt_res, Ctxt ctxt, const vector<Ptxt<BGV>> &ss) const;
+  void psm(Ctxt& ctxt_res, const Ctxt& ctxt, const vector<Ptxt<BGV>> &ss) const;
+
+  // the same rotating the input in place, ctxt is garbage afterwards
+  void psm(Ctxt& ctxt_res, Ctxt&& ctxt, const vector<Ptxt<BGV>> &ss) const;
 
   // minimum/maximum function for general vectors
   void min_max(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const;
 
-  // minimum/maximum of an array
-  void array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long depth = 0) const;
+  // in-place minimum/maximum: x is replaced by the minimum and y by the maximum
+  void min_max_in_place(Ctxt& ctxt_x, Ctxt& ctxt_y) const;
+
+  // several predicates of digits x and y (vectors of dimension 1 over F_p) sharing the powers of (x-y)^2
+  // only the predicates with non-null outputs are computed; less-than/equality alone or min/max alone
+  // use their Paterson-Stockmeyer circuits, both together share one baby-step giant-step schedule
+  void digit_predicates(Ctxt* ctxt_less, Ctxt* ctxt_eq, Ctxt* ctxt_min, Ctxt* ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const;
+
+  // minimum/maximum function with a public value
+  void min_max(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ptxt<BGV>& ptxt_y) const;
+
+  // range check lo <= x < hi with public bounds (lo <= hi)
+  // the univariate circuit works on the differences x - lo and x - hi, the bivariate ones on polynomials of x with public coefficients
+  void in_range(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ptxt<BGV>& ptxt_lo, const Ptxt<BGV>& ptxt_hi) const;
+
+  // estimated multiplicative depth and number of ciphertext multiplications of the comparison circuit
+  // (batched: the univariate digits of compare_batch on one baby-step giant-step schedule)
+  static long compare_depth(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len, bool batched = false);
+  static double compare_cost(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len);
+
+  // estimated multiplicative depth of a comparison (UNI, BI, TAN), of a membership test against set_ptxts plaintexts of a set (PSM, PSMS)
+  // or of sorting when sort_len > 0
+  static long circuit_depth(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len, unsigned long set_ptxts = 1, unsigned long sort_len = 0);
+
+  // estimated multiplicative depth of in_range and bucketize
+  static long range_depth(CircuitType type, unsigned long p, unsigned long d, unsigned long expansion_len);
+
+  // estimated number of modulus bits consumed by one multiplication level
+  static double level_bits(unsigned long p, unsigned long phim);
+
+  // minimal bit size of the ciphertext modulus to evaluate the circuit of circuit_depth, increased by the relative safety margin
+  static long modulus_bits(CircuitType type, unsigned long p, unsigned long d, unsigned long m, unsigned long expansion_len, unsigned long set_size = 1, unsigned long sort_len = 0, double margin = 0.2);
+
+  // print the final capacity of ctxt_res against the one predicted from the initial capacity and the circuit depth
+  // returns false if the prediction was too optimistic
+  bool check_capacity(const Ctxt& ctxt_res, double initial_capacity, long depth) const;
+
+  // check the final capacity in the test functions (off by default)
+  void set_capacity_check(bool capacity_check);
+
+  // choose the number of tournament levels (if depth < 0) and the method of array_min that is the fastest within 'capacity' bits
+  ArrayMinPlan plan_array_min(size_t input_len, long capacity, long depth = -1) const;
+
+  // minimum/maximum of an array (the number of tournament levels is chosen automatically if depth < 0)
+  void array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long depth = -1) const;
+
+  // the same running the tournament on the input vector, which is garbage afterwards
+  void array_min(Ctxt& ctxt_res, vector<Ctxt>&& ctxt_in, long depth = -1) const;
+
+  // minimum/maximum of an array and the position of the winner encoded as an integer in every slot
+  // the last position wins among equal minima, the first one among equal maxima
+  void array_argmin(Ctxt& ctxt_res, Ctxt& ctxt_index, const vector<Ctxt>& ctxt_in, long depth = -1) const;
+  void array_argmax(Ctxt& ctxt_res, Ctxt& ctxt_index, const vector<Ctxt>& ctxt_in, long depth = -1) const;
+
+  // minimum/maximum of an array and the one-hot vector of the winner position with the same rule for equal values
+  // no tournament levels are used (depth 0), since the vector needs the indicators of all inputs from the comparison table
+  void array_argmin(Ctxt& ctxt_res, vector<Ctxt>& ctxt_onehot, const vector<Ctxt>& ctxt_in) const;
+  void array_argmax(Ctxt& ctxt_res, vector<Ctxt>& ctxt_onehot, const vector<Ctxt>& ctxt_in) const;
+
+  // minimum/maximum of the first num_values slot batches of a ciphertext (all batches if num_values <= 0),
+  // returned in each of the first num_values batches, the other batches are zero if num_values > 1
+  // the ciphertext needs the key-switching matrices of add_shift_matrices(sk, expansion_len, nslots, true)
+  void slot_min(Ctxt& ctxt_res, const Ctxt& ctxt_in, long num_values = 0) const;
+  void slot_max(Ctxt& ctxt_res, const Ctxt& ctxt_in, long num_values = 0) const;
+
+  // one-hot bin membership of x for ascending public thresholds t_0 <= ... <= t_{K-1}
+  // bin 0 is x < t_0, bin k is t_{k-1} <= x < t_k, bin K is t_{K-1} <= x
+  // the univariate circuit works on the differences x - t_k, the bivariate ones on polynomials of x with public coefficients
+  void bucketize(vector<Ctxt>& ctxt_bins, const Ctxt& ctxt_x, const vector<unsigned long>& thresholds) const;
+
+  // the same for a single value in the first slot batch of x (other batches must be zero), bin k is returned in the first slot of the kth batch
+  // the ciphertext needs the key-switching matrices of add_shift_matrices(sk, expansion_len, nslots, true)
+  void bucketize_packed(Ctxt& ctxt_bins, const Ctxt& ctxt_x, const vector<unsigned long>& thresholds) const;
 
   // sorting
   void sort(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const;
 
+  // k smallest elements of an array in ascending order, equal values are ordered by their position in the array
+  // the input length must not exceed p
+  void top_k(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in, long k) const;
+
   // test compare function 'runs' times
   void test_compare(long runs) const;
 
+  // test comparison of bit_size-bit integers split over several ciphertexts
+  void test_compare_wide(long bit_size, long runs) const;
+
   // test compare psm function 'runs' times
   void test_compare_psm(long runs) const;
 
+  // test less-than, equality, minimum and maximum of digits computed by digit_predicates 'runs' times
+  void test_digit_predicates(long runs) const;
+
+  // test range check function 'runs' times and compare it with two comparisons
+  void test_in_range(long runs) const;
+
+  // test bucketize with bin_num random thresholds 'runs' times against plaintext binning
+  void test_bucketize(long bin_num, long runs) const;
+
+  // test batched comparison of batch_size ciphertext pairs 'runs' times and compare it with sequential comparisons
+  void test_compare_batch(long batch_size, long runs) const;
+
+  // test comparison of values in batches of the given lengths (repeated while they fit into one ciphertext) 'runs' times
+  void test_compare_layout(const vector<long>& batch_lengths, long runs);
+
+  // test the comparison (or the membership test of PSM circuits) 'runs' times without and with the level planner and print the time of every stage
+  void test_level_planner(long runs);
+
+  // test compare function 'runs' times without and with the scratch ciphertext pool and print the time and the allocations
+  void test_scratch_pool(long runs) const;
+
   // test min/max function 'runs' times
   void test_min_max(long runs) const;
 
+  // test slot_min and slot_max of the first num_values slot batches (all batches if num_values <= 0) 'runs' times against plaintext min/max
+  void test_slot_min_max(long num_values, long runs) const;
+
   // test compare function 'runs' times
   void test_sorting(int num_to_sort, long runs) const;
 
+  // test top_k of num_values ciphertexts with repeated values 'runs' times against the k smallest plaintext values
+  void test_top_k(int num_values, long k, long runs) const;
+
   // test array_minn function
   void test_array_min(int input_len, long depth, long runs) const;
 
@@ -216,6 +524,15 @@ public:
 
 
 };
+
+// encode values[i] into the ith slot batch of a plaintext in the encoding of the given circuit type, the remaining slots are zero
+void encode_values(Ptxt<BGV>& ptxt, const vector<unsigned long>& values, const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len);
+
+// encode integers of chunk_num*expansion_len digits into chunk_num plaintexts, the cth plaintext contains the cth chunk of every integer
+void encode_wide_values(vector<Ptxt<BGV>>& ptxts, const vector<ZZ>& values, const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, long chunk_num);
+
+// the same for batches of different lengths, value i is encoded into the ith batch of batch_lengths[i] slots
+void encode_values(Ptxt<BGV>& ptxt, const vector<unsigned long>& values, const Context& context, CircuitType type, unsigned long d, const vector<long>& batch_lengths);
 }
 
 #endif // #ifndef COMPARATOR_H
@@ -26,6 +26,7 @@
 #include "../../HElib/src/PrimeGenerator.h"
 #include "tools.h"
 #include "comparator.h"
+#include "keystore.h"
 
 using namespace std;
 using namespace NTL;
@@ -40,9 +41,18 @@ using namespace he_cmp;
 // argv[3] - the dimension of a vector space over a finite field
 // argv[4] - the order of the cyclotomic ring
 // argv[5] - the bitsize of the ciphertext modulus in ciphertexts (HElib increases it to fit the moduli chain). The modulus used for public-key generation
+//           (a - estimated from the circuit depth, the final capacity is then checked against the estimate)
 // argv[6] - the length of vectors to be compared
 // argv[7] - the number of experiment repetitions
 // argv[8] - print debug info (y/n)
+// argv[9] - test the range check (r), bucketizing by public thresholds (k), batched comparison (b), comparison of batches of mixed lengths (m), comparison without and with the level planner (l)
+//           comparison without and with the scratch ciphertext pool (s), comparison of integers spread over several ciphertexts (w)
+//           or less-than, equality, min and max of digits with shared powers (d, U with d = 1 and l = 1 only) instead of comparison (optional)
+// argv[10] - the number of ciphertext pairs in a batch (b only), comma-separated batch lengths, e.g. 8,16 (m only), the bit size of integers, e.g. 128 (w only)
+//            or the number of thresholds (k only)
+// argv[11] - the number of threads (optional, 1 by default)
+// --keys <dir> - read the context and the keys from dir if they were stored there for the same argv[1]-argv[6], otherwise store them there (optional, anywhere in the command line)
+// --cache <n> - the number of masks and constants kept as DoubleCRT (optional, anywhere in the command line, all of them at two prime sets by default)
 
 // Running examples from table 2, Section A of [Ribeiro23]
 // PSM tests
@@ -63,6 +73,8 @@ using namespace he_cmp;
 void adjustingParameters(unsigned long& p, unsigned long& m, unsigned long nb_primes, unsigned long d, long ss_size=-11);
 
 int main(int argc, char *argv[]) {
+  string keys_dir = take_keys_option(argc, argv);
+  string cache_size = take_option(argc, argv, "--cache");
   if(argc < 9) {
     throw invalid_argument("There should be exactly 8 arguments\n");
   }
@@ -87,6 +99,15 @@ int main(int argc, char *argv[]) {
   if (!strcmp(argv[8], "y"))
     verbose = true;
 
+  // the batched tests take their size from argv[10], they must not fall back to the plain comparison
+  if (argc == 10 && (!strcmp(argv[9], "b") || !strcmp(argv[9], "m") || !strcmp(argv[9], "w") || !strcmp(argv[9], "k"))) {
+    throw invalid_argument(string("Test ") + argv[9] + " needs argv[10]\n");
+  }
+
+  // independent ciphertexts are distributed among NTL threads
+  if (argc > 11)
+    SetNumThreads(atol(argv[11]));
+
   //////////PARAMETER SET UP////////////////
   // Plaintext prime modulus
   unsigned long p = atol(argv[2]);
@@ -95,26 +116,42 @@ int main(int argc, char *argv[]) {
   // Cyclotomic polynomial - defines phi(m)
   unsigned long m = atol(argv[4]);
   // Number of ciphertext prime bits in the modulus chain
-  unsigned long nb_primes = atol(argv[5]);
+  bool auto_bits = !strcmp(argv[5], "a");
+  unsigned long nb_primes = auto_bits ? Comparator::modulus_bits(type, p, d, m, atol(argv[6])) : atol(argv[5]);
   // Number of columns of Key-Switching matix (default = 2 or 3)
   unsigned long c = 3;
 
-  if(type == PSM) {
+  // the context and the keys are read from the key store if it holds them for the same parameters
+  string keys_tag = string("comparison_circuit ") + argv[1] + " " + argv[2] + " " + argv[3] + " " + argv[4] + " " + argv[5] + " " + argv[6];
+  bool stored_keys = !keys_dir.empty() && has_keys(keys_dir, keys_tag);
+
+  if(type == PSM && !stored_keys) {
     adjustingParameters(p, m, nb_primes, d);
+    if (auto_bits)
+      nb_primes = Comparator::modulus_bits(type, p, d, m, atol(argv[6]));
     cout << "Parms: P " << p << " " << d << " " << m << " " << nb_primes << " " << argv[6] << " " << argv[7] << endl;
   }
 
-
-  cout << "Initialising context object..." << endl;
-  // Intialise context
-  auto context = ContextBuilder<BGV>()
-            .m(m)
-            .p(p)
-            .r(1)
-            .bits(nb_primes)
-            .c(c)
-            .scale(6)
-            .build();
+  unique_ptr<Context> context_ptr;
+  if (stored_keys) {
+    cout << "Reading context object from " << keys_dir << "..." << endl;
+    context_ptr = load_context(keys_dir);
+  } else {
+    cout << "Initialising context object..." << endl;
+    // Intialise context
+    context_ptr.reset(ContextBuilder<BGV>()
+              .m(m)
+              .p(p)
+              .r(1)
+              .bits(nb_primes)
+              .c(c)
+              .scale(6)
+              .buildPtr());
+  }
+  const Context& context = *context_ptr;
+  // the stored context may come from adjusted parameters
+  p = context.getP();
+  m = context.getM();
   const EncryptedArray& ea = context.getEA();
   // Print the security level
   cout << "Ctx primes" << context.getCtxtPrimes() << endl;
@@ -130,67 +167,88 @@ int main(int argc, char *argv[]) {
   //maximal number of digits in a number
   unsigned long expansion_len = atol(argv[6]);
 
-  // Secret key management
-  // Create a secret key associated with the context
-  SecKey secret_key(context);
-  // Generate the secret key
-  secret_key.GenSecKey();
-
-
-  // Compute key-switching matrices that we need
-  if(type == PSM) {
-
-      const PAlgebra& al = ea.getPAlgebra();
-      unsigned long slots = al.getNSlots();
-      unsigned long enc_base = (p-1) >> 1;
-      unsigned long maxsize = enc_base > slots ? slots : enc_base;
-
-      for(uint g = 0; g < al.numOfGens(); g++  ) {
-        for(uint r=1; r<maxsize; r <<= 1) {
-          long v = al.coordinate(g, r);
-          if( v!= 0) {
-            secret_key.GenKeySWmatrix(1, context.getZMStar().genToPow(g, v), 0, 0);
-          }
-          v = al.coordinate(g, slots-r);
-          if( v!= 0) {
-            secret_key.GenKeySWmatrix(1, context.getZMStar().genToPow(g, v), 0, 0);
+  unique_ptr<SecKey> stored_key;
+  unique_ptr<ParallelSecKey> generated_key;
+  if (stored_keys) {
+    cout << "Reading keys from " << keys_dir << "..." << endl;
+    stored_key = load_secret_key(keys_dir, context);
+  } else {
+    // Secret key management
+    // Create a secret key associated with the context
+    generated_key = make_unique<ParallelSecKey>(context);
+    ParallelSecKey& secret_key = *generated_key;
+    // Generate the secret key
+    secret_key.GenSecKey();
+
+
+    // Compute key-switching matrices that we need, they are generated concurrently
+    std::set<long> autos;
+    if(type == PSM) {
+
+        const PAlgebra& al = ea.getPAlgebra();
+        unsigned long slots = al.getNSlots();
+        unsigned long enc_base = (p-1) >> 1;
+        unsigned long maxsize = enc_base > slots ? slots : enc_base;
+
+        for(uint g = 0; g < al.numOfGens(); g++  ) {
+          for(uint r=1; r<maxsize; r <<= 1) {
+            long v = al.coordinate(g, r);
+            if( v!= 0) {
+              autos.insert(context.getZMStar().genToPow(g, v));
+            }
+            v = al.coordinate(g, slots-r);
+            if( v!= 0) {
+              autos.insert(context.getZMStar().genToPow(g, v));
+            }
           }
         }
-      }
-      secret_key.setKeySwitchMap();
-
-    //addSome1DMatrices(secret_key);
-
-  } else if (expansion_len > 1) {
-    if (context.getZMStar().numOfGens() == 1) {
-      std::set<long> automVals;
-      long e = 1;
-      long ord = context.getZMStar().OrderOf(0);
-      bool native = context.getZMStar().SameOrd(0);
-      if(!native)
-        automVals.insert(context.getZMStar().genToPow(0, -ord));
-      while (e < expansion_len){
-        long atm = context.getZMStar().genToPow(0, ord-e);
-        automVals.insert(atm);
-        e <<=1;
-      }
-      addTheseMatrices(secret_key, automVals);
-    } else {
-      addSome1DMatrices(secret_key);
+
+      //addSome1DMatrices(secret_key);
+
+    } else if (expansion_len > 1) {
+      shift_automorphisms(autos, context.getZMStar(), 1, expansion_len);
+      if (d > 1 ) 
+        frobenius_automorphisms(autos, context.getZMStar()); //might be useful only when d > 1
     }
-    if (d > 1 ) 
-      addFrbMatrices(secret_key); //might be useful only when d > 1
+    secret_key.GenKeySWmatrices(autos);
+
+    if (!keys_dir.empty())
+      save_keys(keys_dir, keys_tag, context, secret_key);
   }
+  const SecKey& secret_key = stored_keys ? *stored_key : *generated_key;
 
   // create Comparator (initialize after buildModChain)
   Comparator comparator(context, type, d, expansion_len, secret_key, verbose);
+  if (!cache_size.empty())
+    comparator.set_constant_cache_size(atol(cache_size.c_str()));
+  comparator.set_capacity_check(auto_bits);
 
   //repeat experiments several times
   int runs = atoi(argv[7]);
   
   //test comparison circuit
-  if(type == PSM) {
+  if (argc > 9 && !strcmp(argv[9], "l")) {
+    // the planner comparison is available for all circuit types including P
+    comparator.test_level_planner(runs);
+  } else if(type == PSM) {
     comparator.test_compare_psm(runs);
+  } else if (argc > 9 && !strcmp(argv[9], "r")) {
+    comparator.test_in_range(runs);
+  } else if (argc > 10 && !strcmp(argv[9], "k")) {
+    comparator.test_bucketize(atol(argv[10]), runs);
+  } else if (argc > 9 && !strcmp(argv[9], "d")) {
+    comparator.test_digit_predicates(runs);
+  } else if (argc > 9 && !strcmp(argv[9], "s")) {
+    comparator.test_scratch_pool(runs);
+  } else if (argc > 10 && !strcmp(argv[9], "b")) {
+    comparator.test_compare_batch(atol(argv[10]), runs);
+  } else if (argc > 10 && !strcmp(argv[9], "m")) {
+    vector<long> batch_lengths;
+    for (char *len = strtok(argv[10], ","); len != nullptr; len = strtok(nullptr, ","))
+      batch_lengths.push_back(atol(len));
+    comparator.test_compare_layout(batch_lengths, runs);
+  } else if (argc > 10 && !strcmp(argv[9], "w")) {
+    comparator.test_compare_wide(atol(argv[10]), runs);
   } else {
     comparator.test_compare(runs);
   }
@@ -0,0 +1,148 @@
+#include "keystore.h"
+#include "tools.h"
+#include <fstream>
+#include <streambuf>
+#include <istream>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace he_cmp;
+
+// files of a key bundle
+static const char *TAG_FILE = "/tag.txt";
+static const char *CONTEXT_FILE = "/context.bin";
+static const char *SECKEY_FILE = "/seckey.bin";
+
+// read-only memory mapping of a file that can be read as an input stream
+class MappedFile : public streambuf
+{
+	void *m_data;
+	size_t m_size;
+
+public:
+	MappedFile(const string &path) : m_data(nullptr), m_size(0)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw helib::IOError("Cannot open " + path);
+
+		struct stat st;
+		if (fstat(fd, &st) < 0)
+		{
+			close(fd);
+			throw helib::IOError("Cannot read the size of " + path);
+		}
+		m_size = st.st_size;
+
+		if (m_size > 0)
+		{
+			m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (m_data == MAP_FAILED)
+			{
+				close(fd);
+				throw helib::IOError("Cannot map " + path);
+			}
+			// the keys are read once from the beginning to the end
+			madvise(m_data, m_size, MADV_SEQUENTIAL);
+		}
+		// the mapping stays valid after closing the descriptor
+		close(fd);
+
+		char *begin = static_cast<char *>(m_data);
+		setg(begin, begin, begin + m_size);
+	}
+
+	~MappedFile()
+	{
+		if (m_data != nullptr)
+			munmap(m_data, m_size);
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+};
+
+string he_cmp::take_keys_option(int &argc, char *argv[])
+{
+	return take_option(argc, argv, "--keys");
+}
+
+bool he_cmp::has_keys(const string &dir, const string &tag)
+{
+	ifstream tag_file(dir + TAG_FILE);
+	if (!tag_file)
+		return false;
+
+	string stored_tag;
+	getline(tag_file, stored_tag);
+	if (stored_tag != tag)
+	{
+		cout << "Keys in " << dir << " were generated for '" << stored_tag << "', generating new ones" << endl;
+		return false;
+	}
+
+	return ifstream(dir + CONTEXT_FILE).good() && ifstream(dir + SECKEY_FILE).good();
+}
+
+// create an empty file that only the owner can read and write (also if it existed with other permissions)
+static void create_private_file(const string &path)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		throw helib::IOError("Cannot create " + path);
+	if (fchmod(fd, 0600) < 0)
+	{
+		close(fd);
+		throw helib::IOError("Cannot restrict the permissions of " + path);
+	}
+	close(fd);
+}
+
+// write errors may only show up when the buffer is flushed
+static void close_file(ofstream &file, const string &path)
+{
+	file.close();
+	if (!file)
+		throw helib::IOError("Cannot write " + path);
+}
+
+void he_cmp::save_keys(const string &dir, const string &tag, const Context &context, const SecKey &sk)
+{
+	// the bundle holds the secret key, so a new directory is private
+	if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST)
+		throw helib::IOError("Cannot create " + dir);
+	remove((dir + TAG_FILE).c_str());
+
+	ofstream context_file(dir + CONTEXT_FILE, ios::binary);
+	context.writeTo(context_file);
+	close_file(context_file, dir + CONTEXT_FILE);
+
+	// the secret key includes the public key with all key-switching matrices
+	create_private_file(dir + SECKEY_FILE);
+	ofstream seckey_file(dir + SECKEY_FILE, ios::binary);
+	sk.writeTo(seckey_file);
+	close_file(seckey_file, dir + SECKEY_FILE);
+
+	// the tag is written last, so an interrupted run leaves no valid bundle
+	ofstream tag_file(dir + TAG_FILE);
+	tag_file << tag << endl;
+	close_file(tag_file, dir + TAG_FILE);
+}
+
+unique_ptr<Context> he_cmp::load_context(const string &dir)
+{
+	MappedFile buf(dir + CONTEXT_FILE);
+	istream str(&buf);
+	return unique_ptr<Context>(Context::readPtrFrom(str));
+}
+
+unique_ptr<SecKey> he_cmp::load_secret_key(const string &dir, const Context &context)
+{
+	MappedFile buf(dir + SECKEY_FILE);
+	istream str(&buf);
+	return make_unique<SecKey>(SecKey::readFrom(str, context));
+}
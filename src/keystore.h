@@ -0,0 +1,33 @@
+/*
+Key store: binary files with a BGV context and its keys to skip key generation in repeated runs
+*/
+
+#ifndef KEYSTORE_H
+#define KEYSTORE_H
+
+#include <memory>
+#include <string>
+#include <helib/helib.h>
+
+using namespace std;
+using namespace helib;
+
+namespace he_cmp{
+
+// remove the option '--keys <dir>' from the command line and return the directory (empty if the option is absent)
+string take_keys_option(int& argc, char* argv[]);
+
+// true if dir contains a key bundle written with the same tag (the parameters of the context and the key-switching matrices)
+bool has_keys(const string& dir, const string& tag);
+
+// write the context and the secret key with all key-switching matrices into dir (the secret key file is readable by the owner only)
+void save_keys(const string& dir, const string& tag, const Context& context, const SecKey& sk);
+
+// read the context of a key bundle
+unique_ptr<Context> load_context(const string& dir);
+
+// read the secret key with all key-switching matrices, context must be the one read from the same bundle
+unique_ptr<SecKey> load_secret_key(const string& dir, const Context& context);
+}
+
+#endif // #ifndef KEYSTORE_H
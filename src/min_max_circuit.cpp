@@ -19,6 +19,7 @@
 #include <helib/polyEval.h>
 #include "tools.h"
 #include "comparator.h"
+#include "keystore.h"
 
 using namespace std;
 using namespace NTL;
@@ -32,15 +33,23 @@ using namespace he_cmp;
 // argv[4] - the bitsize of the ciphertext modulus in ciphertexts (HElib increases it to fit the moduli chain). The modulus used for public-key generation
 // argv[5] - the length of vectors to be compared
 // argv[6] - the number of values in the input array
-// argv[7] - the number of tournament stages
+// argv[7] - the number of tournament stages (a - chosen automatically)
 // argv[8] - the number of experimental runs
 // argv[9] - print debug info (y/n)
+// argv[10] - the number of threads (optional, 1 by default)
+// argv[11] - s - test slot_min/slot_max over the first argv[6] slot batches of one ciphertext instead of the array minimum (optional)
+// --keys <dir> - read the context and the keys from dir if they were stored there for the same argv[1]-argv[5], otherwise store them there (optional, anywhere in the command line)
+// --cache <n> - the number of masks and constants kept as DoubleCRT (optional, anywhere in the command line, all of them at two prime sets by default)
 
 // some parameters for quick testing
 // 7 1 75 90 1 4 1 10 y
 // 7 1 300 90 1 6 2 10 y
 // 17 1 145 120 1 7 2 10 y
+// 17 1 145 120 1 7 a 10 y
+// 7 1 300 90 2 5 a 10 y 1 s
 int main(int argc, char *argv[]) {
+  string keys_dir = take_keys_option(argc, argv);
+  string cache_size = take_option(argc, argv, "--cache");
   if(argc < 10)
   {
    throw invalid_argument("There should be exactly 9 arguments\n");
@@ -50,6 +59,12 @@ int main(int argc, char *argv[]) {
   if (!strcmp(argv[9], "y"))
     verbose = true;
 
+  // independent comparisons are distributed among NTL threads
+  if (argc > 10)
+    SetNumThreads(atol(argv[10]));
+
+  bool slot_test = argc > 11 && !strcmp(argv[11], "s");
+
   //////////PARAMETER SET UP////////////////
   // Plaintext prime modulus
   unsigned long p = atol(argv[1]);
@@ -61,16 +76,31 @@ int main(int argc, char *argv[]) {
   unsigned long nb_primes = atol(argv[4]);
   // Number of columns of Key-Switching matrix (default = 2 or 3)
   unsigned long c = 3;
-  cout << "Initialising context object..." << endl;
-  // Intialise context
-  auto context = ContextBuilder<BGV>()
-            .m(m)
-            .p(p)
-            .r(1)
-            .bits(nb_primes)
-            .c(c)
-            .scale(6)
-            .build();
+
+  // the context and the keys are read from the key store if it holds them for the same parameters
+  string keys_tag = string("min_max_circuit ") + argv[1] + " " + argv[2] + " " + argv[3] + " " + argv[4] + " " + argv[5];
+  // the slot test needs additional shifts by multiples of the batch length
+  if (slot_test)
+    keys_tag += " s";
+  bool stored_keys = !keys_dir.empty() && has_keys(keys_dir, keys_tag);
+
+  unique_ptr<Context> context_ptr;
+  if (stored_keys) {
+    cout << "Reading context object from " << keys_dir << "..." << endl;
+    context_ptr = load_context(keys_dir);
+  } else {
+    cout << "Initialising context object..." << endl;
+    // Intialise context
+    context_ptr.reset(ContextBuilder<BGV>()
+              .m(m)
+              .p(p)
+              .r(1)
+              .bits(nb_primes)
+              .c(c)
+              .scale(6)
+              .buildPtr());
+  }
+  const Context& context = *context_ptr;
 
   // Print the security level
   cout << "Q size: " << context.logOfProduct(context.getCtxtPrimes())/log(2.0) << endl;
@@ -84,55 +114,57 @@ int main(int argc, char *argv[]) {
   //maximal number of digits in a number
   unsigned long expansion_len = atol(argv[5]);
 
-  // Secret key management
-  cout << "Creating secret key..." << endl;
-  // Create a secret key associated with the context
-  SecKey secret_key(context);
-  // Generate the secret key
-  secret_key.GenSecKey();
-  cout << "Generating key-switching matrices..." << endl;
-  // Compute key-switching matrices that we need
-  if (expansion_len > 1)
-  {
-    if (context.getZMStar().numOfGens() == 1)
-    {
-      std::set<long> automVals;
-      long e = 1;
-      long ord = context.getZMStar().OrderOf(0);
-      bool native = context.getZMStar().SameOrd(0);
-      if(!native)
-        automVals.insert(context.getZMStar().genToPow(0, -ord));
-      while (e < expansion_len){
-        long atm = context.getZMStar().genToPow(0, ord-e);
-        //cout << "Automorphism " << -e << " is " << atm << endl;
-        automVals.insert(atm);
-        e <<=1;
-      }
-      addTheseMatrices(secret_key, automVals);
-    }
-    else
-    {
-      addSome1DMatrices(secret_key);
-    }
+  unique_ptr<SecKey> stored_key;
+  unique_ptr<ParallelSecKey> generated_key;
+  if (stored_keys) {
+    cout << "Reading keys from " << keys_dir << "..." << endl;
+    stored_key = load_secret_key(keys_dir, context);
+  } else {
+    // Secret key management
+    cout << "Creating secret key..." << endl;
+    // Create a secret key associated with the context
+    generated_key = make_unique<ParallelSecKey>(context);
+    ParallelSecKey& secret_key = *generated_key;
+    // Generate the secret key
+    secret_key.GenSecKey();
+    cout << "Generating key-switching matrices..." << endl;
+    // Compute key-switching matrices that we need, they are generated concurrently
+    std::set<long> autos;
+    // the positions of the minimum are spread over their batches by shifts to the right
+    if (expansion_len > 1)
+      shift_automorphisms(autos, context.getZMStar(), 1, expansion_len, true);
+    // slot batches are compared with each other by shifts to the left and the result is copied by shifts to the right
+    if (slot_test)
+      shift_automorphisms(autos, context.getZMStar(), expansion_len, context.getZMStar().getNSlots(), true);
+
+    if (d > 1)
+      frobenius_automorphisms(autos, context.getZMStar()); //might be useful only when d > 1
+    secret_key.GenKeySWmatrices(autos);
+
+    if (!keys_dir.empty())
+      save_keys(keys_dir, keys_tag, context, secret_key);
   }
-
-  if (d > 1)
-    addFrbMatrices(secret_key); //might be useful only when d > 1
+  const SecKey& secret_key = stored_keys ? *stored_key : *generated_key;
 
   // create Comparator (initialize after buildModChain)
   Comparator comparator(context, UNI, d, expansion_len, secret_key, verbose);
+  if (!cache_size.empty())
+    comparator.set_constant_cache_size(atol(cache_size.c_str()));
 
   // number of values to be sorted
   int input_len = atoi(argv[6]);
 
   // levels of consecutive comparisons
-  long depth = atol(argv[7]); 
+  long depth = (string(argv[7]) == "a") ? -1 : atol(argv[7]);
 
   //repeat experiments 'runs' times
   int runs = atoi(argv[8]);
 
   //test sorting
-  comparator.test_array_min(input_len, depth, runs);
+  if (slot_test)
+    comparator.test_slot_min_max(input_len, runs);
+  else
+    comparator.test_array_min(input_len, depth, runs);
 
   printAllTimers(cout);
 
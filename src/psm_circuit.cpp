@@ -26,6 +26,7 @@
 #include "../../HElib/src/PrimeGenerator.h"
 #include "tools.h"
 #include "comparator.h"
+#include "keystore.h"
 
 using namespace std;
 using namespace NTL;
@@ -39,10 +40,15 @@ using namespace he_cmp;
 // argv[3] - the dimension of a vector space over a finite field
 // argv[4] - the order of the cyclotomic ring
 // argv[5] - the bitsize of the ciphertext modulus in ciphertexts (HElib increases it to fit the moduli chain). The modulus used for public-key generation
+//           (a - estimated from the circuit depth, the final capacity is then checked against the estimate)
 // argv[6] - the length of vectors to be compared
 // argv[7] - the number of strings to be compared
 // argv[8] - the number of experiment repetitions
 // argv[9] - print debug info (y/n)
+// argv[10] - the number of threads (optional, 1 by default)
+// argv[11] - compare the stage times without and with the level planner (l) instead of the plain test (optional)
+// --keys <dir> - read the context and the keys from dir if they were stored there for the same argv[1]-argv[7], otherwise store them there (optional, anywhere in the command line)
+// --cache <n> - the number of masks and constants kept as DoubleCRT (optional, anywhere in the command line, all of them at two prime sets by default)
 
 // some parameters for quick testing
 // String comparasion with UniSlot packing
@@ -61,6 +67,8 @@ void adjustingParameters(unsigned long& p, unsigned long& m, unsigned long nb_pr
 
 int main(int argc, char *argv[])
 {
+  string keys_dir = take_keys_option(argc, argv);
+  string cache_size = take_option(argc, argv, "--cache");
   if (argc < 10)
   {
     throw invalid_argument("There should be exactly 9 arguments\n");
@@ -84,6 +92,10 @@ int main(int argc, char *argv[])
   if (!strcmp(argv[9], "y"))
     verbose = true;
 
+  // key-switching matrices are generated on NTL threads
+  if (argc > 10)
+    SetNumThreads(atol(argv[10]));
+
   //////////PARAMETER SET UP////////////////
   // Plaintext prime modulus
   unsigned long p = atol(argv[2]);
@@ -91,8 +103,6 @@ int main(int argc, char *argv[])
   unsigned long d = atol(argv[3]);
   // Cyclotomic polynomial - defines phi(m)
   unsigned long m = atol(argv[4]);
-  // Number of ciphertext prime bits in the modulus chain
-  unsigned long nb_primes = atol(argv[5]);
   // Number of columns of Key-Switching matix (default = 2 or 3)
   unsigned long c = 3;
 
@@ -100,19 +110,42 @@ int main(int argc, char *argv[])
   unsigned long expansion_len = atol(argv[6]);
   unsigned long ss_size = atol(argv[7]);
 
-  adjustingParameters(p, m, nb_primes, d, (long)expansion_len*ss_size);
-  cout << "Parms: S " << p << " " << d << " " << m << " " << nb_primes << " " << argv[6] << " " << argv[7] << " " << argv[8] << endl;
-
-  cout << "Initialising context object..." << endl;
-  // Intialise context
-  auto context = ContextBuilder<BGV>()
-                     .m(m)
-                     .p(p)
-                     .r(1)
-                     .bits(nb_primes)
-                     .c(c)
-                     .scale(6)
-                     .build();
+  // Number of ciphertext prime bits in the modulus chain
+  bool auto_bits = !strcmp(argv[5], "a");
+  unsigned long nb_primes = auto_bits ? Comparator::modulus_bits(type, p, d, m, expansion_len, ss_size) : atol(argv[5]);
+
+  // the context and the keys are read from the key store if it holds them for the same parameters
+  string keys_tag = string("psm_circuit ") + argv[1] + " " + argv[2] + " " + argv[3] + " " + argv[4] + " " + argv[5] + " " + argv[6] + " " + argv[7];
+  bool stored_keys = !keys_dir.empty() && has_keys(keys_dir, keys_tag);
+
+  unique_ptr<Context> context_ptr;
+  if (stored_keys)
+  {
+    cout << "Reading context object from " << keys_dir << "..." << endl;
+    context_ptr = load_context(keys_dir);
+    // the stored context was built from the adjusted parameters
+    p = context_ptr->getP();
+    m = context_ptr->getM();
+  }
+  else
+  {
+    adjustingParameters(p, m, nb_primes, d, (long)expansion_len*ss_size);
+    if (auto_bits)
+      nb_primes = Comparator::modulus_bits(type, p, d, m, expansion_len, ss_size);
+    cout << "Parms: S " << p << " " << d << " " << m << " " << nb_primes << " " << argv[6] << " " << argv[7] << " " << argv[8] << endl;
+
+    cout << "Initialising context object..." << endl;
+    // Intialise context
+    context_ptr.reset(ContextBuilder<BGV>()
+                          .m(m)
+                          .p(p)
+                          .r(1)
+                          .bits(nb_primes)
+                          .c(c)
+                          .scale(6)
+                          .buildPtr());
+  }
+  const Context &context = *context_ptr;
   const EncryptedArray &ea = context.getEA();
   // Print the security level
   cout << "Ctx primes" << context.getCtxtPrimes() << endl;
@@ -127,44 +160,68 @@ int main(int argc, char *argv[])
 
 
 
-  // Secret key management
-  // Create a secret key associated with the context
-  SecKey secret_key(context);
-  // Generate the secret key
-  secret_key.GenSecKey();
-
-  const PAlgebra &al = ea.getPAlgebra();
-  unsigned long slots = al.getNSlots();
-  unsigned long enc_base = (p - 1) >> 1;
-  unsigned long maxsize = enc_base > slots ? slots : enc_base;
-
-  for (uint g = 0; g < al.numOfGens(); g++) {
-    for (uint r = 1; r < maxsize; r <<= 1) {
-      long v = al.coordinate(g, r);
-      if (v != 0) {
-        secret_key.GenKeySWmatrix(1, context.getZMStar().genToPow(g, v), 0, 0);
-      }
-      v = al.coordinate(g, slots - r);
-      if (v != 0) {
-        secret_key.GenKeySWmatrix(1, context.getZMStar().genToPow(g, v), 0, 0);
+  unique_ptr<SecKey> stored_key;
+  unique_ptr<ParallelSecKey> generated_key;
+  if (stored_keys)
+  {
+    cout << "Reading keys from " << keys_dir << "..." << endl;
+    stored_key = load_secret_key(keys_dir, context);
+  }
+  else
+  {
+    // Secret key management
+    // Create a secret key associated with the context
+    generated_key = make_unique<ParallelSecKey>(context);
+    ParallelSecKey &secret_key = *generated_key;
+    // Generate the secret key
+    secret_key.GenSecKey();
+
+    // automorphisms of the key-switching matrices that we need, they are generated concurrently
+    std::set<long> autos;
+
+    const PAlgebra &al = ea.getPAlgebra();
+    unsigned long slots = al.getNSlots();
+    unsigned long enc_base = (p - 1) >> 1;
+    unsigned long maxsize = enc_base > slots ? slots : enc_base;
+
+    for (uint g = 0; g < al.numOfGens(); g++) {
+      for (uint r = 1; r < maxsize; r <<= 1) {
+        long v = al.coordinate(g, r);
+        if (v != 0) {
+          autos.insert(context.getZMStar().genToPow(g, v));
+        }
+        v = al.coordinate(g, slots - r);
+        if (v != 0) {
+          autos.insert(context.getZMStar().genToPow(g, v));
+        }
       }
     }
-  }
-  secret_key.setKeySwitchMap();
 
-  // addSome1DMatrices(secret_key);
+    // addSome1DMatrices(secret_key);
 
-  if (d > 1 )
-    addFrbMatrices(secret_key); // might be useful only when d > 1
+    if (d > 1 )
+      frobenius_automorphisms(autos, context.getZMStar()); // might be useful only when d > 1
+    secret_key.GenKeySWmatrices(autos);
+
+    if (!keys_dir.empty())
+      save_keys(keys_dir, keys_tag, context, secret_key);
+  }
+  const SecKey &secret_key = stored_keys ? *stored_key : *generated_key;
 
   // create Comparator (initialize after buildModChain)
   Comparator comparator(context, type, d, expansion_len, secret_key, verbose, ss_size);
+  if (!cache_size.empty())
+    comparator.set_constant_cache_size(atol(cache_size.c_str()));
+  comparator.set_capacity_check(auto_bits);
 
   // repeat experiments several times
   int runs = atoi(argv[8]);
 
   // test comparison circuit
-  comparator.test_string_psm(runs);
+  if (argc > 11 && !strcmp(argv[11], "l"))
+    comparator.test_level_planner(runs);
+  else
+    comparator.test_string_psm(runs);
 
   cout << " SS: " << argv[7] << " S: " << context.securityLevel() << " - " << argv[0] << " " << argv[1] << " " << p << " " << d << " " << m << " " << nb_primes << " " << argv[6] << " " << argv[7] << " " << argv[8] << endl;
 
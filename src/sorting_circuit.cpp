@@ -19,6 +19,7 @@
 #include <helib/polyEval.h>
 #include "tools.h"
 #include "comparator.h"
+#include "keystore.h"
 
 using namespace std;
 using namespace NTL;
@@ -30,16 +31,24 @@ using namespace he_cmp;
 // argv[2] - the dimension of a vector space over a finite field
 // argv[3] - the order of the cyclotomic ring
 // argv[4] - the bitsize of the ciphertext modulus in ciphertexts (HElib increases it to fit the moduli chain). The modulus used for public-key generation
+//           (a - estimated from the circuit depth, the final capacity is then checked against the estimate)
 // argv[5] - the length of vectors to be compared
 // argv[6] - the number of values to be sorted
 // argv[7] - the number of experiment repetitions
 // argv[8] - print debug info (y/n)
+// argv[9] - the number of threads (optional, 1 by default)
+// argv[10] - the number of smallest values selected by top_k (optional, top_k is tested after sorting if given)
+// --keys <dir> - read the context and the keys from dir if they were stored there for the same argv[1]-argv[5], otherwise store them there (optional, anywhere in the command line)
+// --cache <n> - the number of masks and constants kept as DoubleCRT (optional, anywhere in the command line, all of them at two prime sets by default)
 
 // some parameters for quick testing
 // 7 1 75 90 1 4 10 y
 // 7 1 300 90 1 6 10 y
 // 17 1 145 120 1 7 10 y
+// 17 1 145 120 1 7 10 y 1 3
 int main(int argc, char *argv[]) {
+  string keys_dir = take_keys_option(argc, argv);
+  string cache_size = take_option(argc, argv, "--cache");
   if(argc < 9)
   {
    throw invalid_argument("There should be exactly 8 arguments\n");
@@ -49,6 +58,10 @@ int main(int argc, char *argv[]) {
   if (!strcmp(argv[8], "y"))
     verbose = true;
 
+  // key-switching matrices are generated on NTL threads
+  if (argc > 9)
+    SetNumThreads(atol(argv[9]));
+
   //////////PARAMETER SET UP////////////////
   // Plaintext prime modulus
   unsigned long p = atol(argv[1]);
@@ -57,19 +70,33 @@ int main(int argc, char *argv[]) {
   // Cyclotomic polynomial - defines phi(m)
   unsigned long m = atol(argv[3]);
   // Number of ciphertext prime bits in the modulus chain
-  unsigned long nb_primes = atol(argv[4]);
+  bool auto_bits = !strcmp(argv[4], "a");
+  unsigned long nb_primes = auto_bits ? Comparator::modulus_bits(UNI, p, d, m, atol(argv[5]), 1, atol(argv[6])) : atol(argv[4]);
   // Number of columns of Key-Switching matrix (default = 2 or 3)
   unsigned long c = 2;
-  cout << "Initialising context object..." << endl;
-  // Intialise context
-  auto context = ContextBuilder<BGV>()
-            .m(m)
-            .p(p)
-            .r(1)
-            .bits(nb_primes)
-            .c(c)
-            .scale(6)
-            .build();
+
+  // the context and the keys are read from the key store if it holds them for the same parameters
+  // the estimated modulus size also depends on the number of values to be sorted
+  string keys_tag = string("sorting_circuit ") + argv[1] + " " + argv[2] + " " + argv[3] + " " + argv[4] + " " + argv[5] + (auto_bits ? string(" ") + argv[6] : string());
+  bool stored_keys = !keys_dir.empty() && has_keys(keys_dir, keys_tag);
+
+  unique_ptr<Context> context_ptr;
+  if (stored_keys) {
+    cout << "Reading context object from " << keys_dir << "..." << endl;
+    context_ptr = load_context(keys_dir);
+  } else {
+    cout << "Initialising context object..." << endl;
+    // Intialise context
+    context_ptr.reset(ContextBuilder<BGV>()
+              .m(m)
+              .p(p)
+              .r(1)
+              .bits(nb_primes)
+              .c(c)
+              .scale(6)
+              .buildPtr());
+  }
+  const Context& context = *context_ptr;
 
   // Print the security level
   cout << "Q size: " << context.logOfProduct(context.getCtxtPrimes())/log(2.0) << endl;
@@ -83,43 +110,39 @@ int main(int argc, char *argv[]) {
   //maximal number of digits in a number
   unsigned long expansion_len = atol(argv[5]);
 
-  // Secret key management
-  cout << "Creating secret key..." << endl;
-  // Create a secret key associated with the context
-  SecKey secret_key(context);
-  // Generate the secret key
-  secret_key.GenSecKey();
-  cout << "Generating key-switching matrices..." << endl;
-  // Compute key-switching matrices that we need
-  if (expansion_len > 1)
-  {
-    if (context.getZMStar().numOfGens() == 1)
-    {
-      std::set<long> automVals;
-      long e = 1;
-      long ord = context.getZMStar().OrderOf(0);
-      bool native = context.getZMStar().SameOrd(0);
-      if(!native)
-        automVals.insert(context.getZMStar().genToPow(0, -ord));
-      while (e < expansion_len){
-        long atm = context.getZMStar().genToPow(0, ord-e);
-        //cout << "Automorphism " << -e << " is " << atm << endl;
-        automVals.insert(atm);
-        e <<=1;
-      }
-      addTheseMatrices(secret_key, automVals);
-    }
-    else
-    {
-      addSome1DMatrices(secret_key);
-    }
+  unique_ptr<SecKey> stored_key;
+  unique_ptr<ParallelSecKey> generated_key;
+  if (stored_keys) {
+    cout << "Reading keys from " << keys_dir << "..." << endl;
+    stored_key = load_secret_key(keys_dir, context);
+  } else {
+    // Secret key management
+    cout << "Creating secret key..." << endl;
+    // Create a secret key associated with the context
+    generated_key = make_unique<ParallelSecKey>(context);
+    ParallelSecKey& secret_key = *generated_key;
+    // Generate the secret key
+    secret_key.GenSecKey();
+    cout << "Generating key-switching matrices..." << endl;
+    // Compute key-switching matrices that we need, they are generated concurrently
+    std::set<long> autos;
+    if (expansion_len > 1)
+      shift_automorphisms(autos, context.getZMStar(), 1, expansion_len);
+
+    if (d > 1)
+      frobenius_automorphisms(autos, context.getZMStar()); //might be useful only when d > 1
+    secret_key.GenKeySWmatrices(autos);
+
+    if (!keys_dir.empty())
+      save_keys(keys_dir, keys_tag, context, secret_key);
   }
-
-  if (d > 1)
-    addFrbMatrices(secret_key); //might be useful only when d > 1
+  const SecKey& secret_key = stored_keys ? *stored_key : *generated_key;
 
   // create Comparator (initialize after buildModChain)
   Comparator comparator(context, UNI, d, expansion_len, secret_key, verbose);
+  if (!cache_size.empty())
+    comparator.set_constant_cache_size(atol(cache_size.c_str()));
+  comparator.set_capacity_check(auto_bits);
 
   // number of values to be sorted
   int num_to_sort = atoi(argv[6]);
@@ -130,6 +153,10 @@ int main(int argc, char *argv[]) {
   //test sorting
   comparator.test_sorting(num_to_sort, runs);
 
+  //test top-k selection
+  if (argc > 10)
+    comparator.test_top_k(num_to_sort, atol(argv[10]), runs);
+
   printAllTimers(cout);
 
   return 0;
@@ -1,4 +1,8 @@
 #include "tools.h"
+#include <functional>
+#include <fstream>
+#include <unistd.h>
+#include <atomic>
 
 void digit_decomp(vector<long>& decomp, unsigned long input, unsigned long base, int nslots)
 {
@@ -23,6 +27,292 @@ void digit_decomp(vector<long>& decomp, unsigned long input, unsigned long base,
     }
 }
 
+// Key-switching matrices for slot shifts by unit*2^i < max_shift to the left (and to the right if both_directions is set)
+void add_shift_matrices(SecKey& secret_key, long unit, long max_shift, bool both_directions)
+{
+  std::set<long> automVals;
+  shift_automorphisms(automVals, secret_key.getContext().getZMStar(), unit, max_shift, both_directions);
+  addTheseMatrices(secret_key, automVals);
+}
+
+long batch_rotation_dim(const PAlgebra& zms, long batch_len)
+{
+  if (zms.numOfGens() == 0)
+    return -1;
+
+  long dim = zms.numOfGens() - 1;
+  if (zms.OrderOf(dim) % batch_len != 0)
+    return -1;
+  return dim;
+}
+
+long rotation_key_switches(const PAlgebra& zms, long dim)
+{
+  if (dim >= 0)
+    return zms.SameOrd(dim) ? 1 : 2;
+
+  // HElib rotates along every dimension and corrects the carries with masks
+  long key_switches = 0;
+  for (long i = 0; i < zms.numOfGens(); i++)
+    key_switches += zms.SameOrd(i) && zms.numOfGens() == 1 ? 1 : 2;
+  return key_switches;
+}
+
+void shift_automorphisms(std::set<long>& autos, const PAlgebra& zms, long unit, long max_shift, bool both_directions)
+{
+  // shifts within batches of max_shift slots along one dimension, HElib combines 1D rotations otherwise
+  long dim = batch_rotation_dim(zms, max_shift);
+  if (zms.numOfGens() != 1)
+  {
+    some_1d_automorphisms(autos, zms);
+    if (dim < 0)
+      return;
+  }
+  else
+    dim = 0;
+
+  long ord = zms.OrderOf(dim);
+  bool native = zms.SameOrd(dim);
+  if (!native)
+    autos.insert(zms.genToPow(dim, -ord));
+  for (long e = unit; e < max_shift; e <<= 1)
+  {
+    // shift to the left by e
+    autos.insert(zms.genToPow(dim, ord - e));
+    // shift to the right by e
+    if (both_directions)
+      autos.insert(zms.genToPow(dim, e));
+  }
+}
+
+// all powers of the generator for small orders, baby steps and giant steps otherwise
+static void dim_automorphisms(std::set<long>& autos, long ord, bool native, long bound, const std::function<long(long)>& gen_to_pow)
+{
+  if (bound >= ord)
+  {
+    for (long j = 1; j < ord; j++)
+      autos.insert(gen_to_pow(j));
+  }
+  else
+  {
+    long g = KSGiantStepSize(ord);
+    for (long j = 1; j < g; j++)
+      autos.insert(gen_to_pow(j));
+    for (long j = g; j < ord; j += g)
+      autos.insert(gen_to_pow(j));
+  }
+
+  if (!native)
+    autos.insert(gen_to_pow(-ord));
+}
+
+void some_1d_automorphisms(std::set<long>& autos, const PAlgebra& zms, long bound)
+{
+  for (long i = 0; i < zms.numOfGens(); i++)
+    dim_automorphisms(autos, zms.OrderOf(i), zms.SameOrd(i), bound, [&zms, i](long j) { return zms.genToPow(i, j); });
+}
+
+void frobenius_automorphisms(std::set<long>& autos, const PAlgebra& zms, long bound)
+{
+  long m = zms.getM();
+  long p = zms.getP() % m;
+  dim_automorphisms(autos, zms.getOrdP(), true, bound, [p, m](long j) { return PowerMod(p, j, m); });
+}
+
+void ParallelSecKey::GenKeySWmatrices(const std::set<long>& autos)
+{
+  // matrices that are not there yet
+  vector<long> todo;
+  for (long k : autos)
+    if (!haveKeySWmatrix(1, k, 0, 0))
+      todo.push_back(k);
+
+  // GenKeySWmatrix appends to the list of matrices, so every thread works on its own copy of the key
+  // and the new matrices are collected afterwards. The existing matrices are moved out of the key
+  // while it is copied, so the copies only hold the secret key itself
+  vector<KeySwitch> existing = std::move(keySwitching);
+  keySwitching.clear();
+  vector<KeySwitch> generated(todo.size());
+  try
+  {
+    NTL_EXEC_RANGE(todo.size(), first, last)
+    ParallelSecKey local_key(*this);
+    for (long i = first; i < last; i++)
+    {
+      size_t local_num = local_key.keySwitching.size();
+      local_key.GenKeySWmatrix(1, todo[i], 0, 0);
+      if (local_key.keySwitching.size() != local_num + 1)
+        throw helib::LogicError("GenKeySWmatrix did not append a key-switching matrix");
+      generated[i] = std::move(local_key.keySwitching.back());
+    }
+    NTL_EXEC_RANGE_END
+  }
+  catch (...)
+  {
+    keySwitching = std::move(existing);
+    throw;
+  }
+
+  keySwitching = std::move(existing);
+  keySwitching.reserve(keySwitching.size() + generated.size());
+  for (KeySwitch& ks : generated)
+    keySwitching.push_back(std::move(ks));
+
+  setKeySwitchMap();
+}
+
+std::shared_ptr<const DoubleCRT> DoubleCRTCache::get(long id, const zzX& poly, const IndexSet& primes)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+      if (it->id == id && it->primes == primes)
+      {
+        m_hits++;
+        m_entries.splice(m_entries.begin(), m_entries, it);
+        return it->crt;
+      }
+    }
+    m_misses++;
+  }
+
+  // conversion outside of the lock, concurrent misses of the same constant only do the work twice
+  auto crt = std::make_shared<const DoubleCRT>(poly, m_context, primes);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.push_front(Entry{id, primes, crt});
+  // entries in use stay alive in their shared pointers
+  while (m_entries.size() > m_capacity)
+    m_entries.pop_back();
+  return crt;
+}
+
+void DoubleCRTCache::set_capacity(size_t capacity)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_capacity = capacity;
+  while (m_entries.size() > m_capacity)
+    m_entries.pop_back();
+}
+
+void DoubleCRTCache::print_stats(std::ostream& str) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  long bytes = 0;
+  for (const Entry& entry : m_entries)
+    bytes += entry.primes.card() * m_context.getPhiM() * sizeof(long);
+  str << "Constant cache: " << m_entries.size() << " of " << m_capacity << " entries, "
+      << bytes / 1024 << " KB, " << m_hits << " hits, " << m_misses << " misses" << endl;
+}
+
+// free scratch ciphertexts of this thread, the number is bounded to keep idle memory low
+static thread_local vector<std::unique_ptr<Ctxt>> scratch_pool;
+static const size_t SCRATCH_POOL_SIZE = 16;
+static std::atomic<bool> scratch_enabled(true);
+static std::atomic<long> scratch_allocated(0);
+static std::atomic<long> scratch_reused(0);
+
+ScratchCtxt::ScratchCtxt(const Ctxt& ctxt) : m_ctxt(nullptr)
+{
+  if (scratch_enabled)
+  {
+    // the most recently returned ciphertext of the same key (ciphertexts of different keys cannot be assigned)
+    for (auto it = scratch_pool.rbegin(); it != scratch_pool.rend(); ++it)
+    {
+      if (&(*it)->getPubKey() == &ctxt.getPubKey())
+      {
+        m_ctxt = it->release();
+        scratch_pool.erase(std::next(it).base());
+        *m_ctxt = ctxt;
+        scratch_reused++;
+        return;
+      }
+    }
+  }
+  m_ctxt = new Ctxt(ctxt);
+  scratch_allocated++;
+}
+
+ScratchCtxt::~ScratchCtxt()
+{
+  if (m_ctxt == nullptr)
+    return;
+  if (scratch_enabled && scratch_pool.size() < SCRATCH_POOL_SIZE)
+    scratch_pool.emplace_back(m_ctxt);
+  else
+    delete m_ctxt;
+}
+
+void ScratchCtxt::set_enabled(bool enabled)
+{
+  scratch_enabled = enabled;
+}
+
+void ScratchCtxt::get_stats(long& allocated, long& reused)
+{
+  allocated = scratch_allocated;
+  reused = scratch_reused;
+}
+
+void ScratchCtxt::reset_stats()
+{
+  scratch_allocated = 0;
+  scratch_reused = 0;
+}
+
+long resident_memory_kb()
+{
+  std::ifstream statm("/proc/self/statm");
+  long size = 0, resident = 0;
+  if (!(statm >> size >> resident))
+    return 0;
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+string take_option(int& argc, char* argv[], const string& name)
+{
+  string value;
+  for (int i = 1; i < argc; i++)
+  {
+    if (name != argv[i])
+      continue;
+
+    if (i + 1 >= argc)
+      throw invalid_argument(name + " needs a value\n");
+    value = argv[i + 1];
+
+    // shift the remaining arguments over the option
+    for (int j = i + 2; j < argc; j++)
+      argv[j - 2] = argv[j];
+    argc -= 2;
+    argv[argc] = nullptr;
+    break;
+  }
+  return value;
+}
+
+// Multiply ctxt by other. If lazy_relin is set, the product is not relinearized
+// and the inputs are relinearized only if they are not in canonical form
+void multiplyLazy(Ctxt& ctxt, const Ctxt& other, bool lazy_relin)
+{
+  if (!lazy_relin) {
+    ctxt.multiplyBy(other);
+    return;
+  }
+
+  if (!ctxt.inCanonicalForm())
+    ctxt.reLinearize();
+
+  if (!other.inCanonicalForm()) {
+    Ctxt tmp = other;
+    tmp.reLinearize();
+    ctxt.multLowLvl(tmp);
+    return;
+  }
+  ctxt.multLowLvl(other);
+}
+
 // Simple evaluation sum f_i * X^i, assuming that babyStep has enough powers
 void simplePolyEval(Ctxt& ret, const NTL::ZZX& poly, DynamicCtxtPowers& babyStep)
 {
@@ -34,13 +324,21 @@ void simplePolyEval(Ctxt& ret, const NTL::ZZX& poly, DynamicCtxtPowers& babyStep
 
   NTL::ZZ coef;
   NTL::ZZ p = NTL::to_ZZ(babyStep[0].getPtxtSpace());
+  std::unique_ptr<ScratchCtxt> tmp;
   for (long i=1; i<=deg(poly); i++) {
     rem(coef, coeff(poly,i),p);
     if (coef > p/2) coef -= p;
 
-    Ctxt tmp = babyStep.getPower(i); // X^i
-    tmp.multByConstant(coef);        // f_i X^i
-    ret += tmp;
+    if (IsZero(coef))
+      continue;
+
+    // the scratch ciphertext keeps its buffers from one power to the next
+    if (!tmp)
+      tmp.reset(new ScratchCtxt(babyStep.getPower(i))); // X^i
+    else
+      **tmp = babyStep.getPower(i);
+    (*tmp)->multByConstant(coef);    // f_i X^i
+    ret += **tmp;
   }
   // Add the free term
   rem(coef, ConstTerm(poly), p);
@@ -49,12 +347,149 @@ void simplePolyEval(Ctxt& ret, const NTL::ZZX& poly, DynamicCtxtPowers& babyStep
   //  if (verbose) checkPolyEval(ret, babyStep[0], poly);
 }
 
+// Evaluate several polynomials at the same ciphertext. The baby steps x, ..., x^k
+// and the giant steps x^k, x^{2k}, ... are computed once and shared by all polynomials
+void multiPolyEval(vector<Ctxt>& ret, const vector<NTL::ZZX>& polys, const Ctxt& x, long k, bool lazy_relin)
+{
+  vector<vector<Ctxt>> batch_ret;
+  batchPolyEval(batch_ret, polys, vector<Ctxt>(1, x), k, lazy_relin);
+  ret = batch_ret[0];
+}
+
+// Evaluate several polynomials at many ciphertexts. All ciphertexts follow the same
+// schedule of baby steps, giant steps and giant-step blocks, and every stage
+// is distributed over the NTL thread pool
+void batchPolyEval(vector<vector<Ctxt>>& ret, const vector<NTL::ZZX>& polys, const vector<Ctxt>& x, long k, bool lazy_relin)
+{
+  long n = x.size();
+  ret.assign(n, vector<Ctxt>());
+  if (n == 0)
+    return;
+
+  for (long i=0; i<n; i++)
+    ret[i].assign(polys.size(), Ctxt(x[i].getPubKey(), x[i].getPtxtSpace()));
+
+  long max_deg = 0;
+  for (size_t j=0; j<polys.size(); j++)
+    max_deg = max(max_deg, deg(polys[j]));
+
+  if (max_deg <= 0) { // constant polynomials
+    for (long i=0; i<n; i++)
+      for (size_t j=0; j<polys.size(); j++)
+        if (deg(polys[j]) == 0)
+          ret[i][j].addConstant(ConstTerm(polys[j]));
+    return;
+  }
+
+  // about sqrt(deg) baby steps minimize the number of multiplications
+  if (k <= 0)
+    k = static_cast<long>(ceil(sqrt(max_deg + 1.0)));
+  k = min(k, max_deg);
+  long giant_num = max(max_deg / k, 1L);
+
+  // the schedule: poly_j = sum_g B_{j,g}(x) * x^{gk} with deg(B_{j,g}) < k
+  vector<vector<NTL::ZZX>> blocks(polys.size());
+  for (size_t j=0; j<polys.size(); j++)
+    for (long g=0; g*k<=deg(polys[j]); g++)
+      blocks[j].push_back(trunc(RightShift(polys[j], g*k), k));
+
+  // baby steps of all ciphertexts
+  vector<DynamicCtxtPowers> babySteps;
+  babySteps.reserve(n);
+  for (long i=0; i<n; i++)
+    babySteps.emplace_back(x[i], k);
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i=first; i<last; i++)
+    for (long e=2; e<=k; e++)
+      babySteps[i].getPower(e);
+  NTL_EXEC_RANGE_END
+
+  // giant steps of all ciphertexts
+  vector<DynamicCtxtPowers> giantSteps;
+  giantSteps.reserve(n);
+  for (long i=0; i<n; i++)
+    giantSteps.emplace_back(babySteps[i].getPower(k), giant_num);
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i=first; i<last; i++)
+    for (long g=2; g<=giant_num; g++)
+      giantSteps[i].getPower(g);
+  NTL_EXEC_RANGE_END
+
+  // giant-step blocks, one block of all ciphertexts at a time
+  for (size_t j=0; j<polys.size(); j++) {
+    for (size_t g=0; g<blocks[j].size(); g++) {
+      const NTL::ZZX& block = blocks[j][g];
+      if (IsZero(block))
+        continue;
+
+      NTL_EXEC_RANGE(n, first, last)
+      for (long i=first; i<last; i++) {
+        Ctxt tmp(x[i].getPubKey(), x[i].getPtxtSpace());
+        if (g > 0 && deg(block) == 0) { // a constant times a giant step
+          tmp = giantSteps[i].getPower(g);
+          tmp.multByConstant(ConstTerm(block));
+        }
+        else {
+          simplePolyEval(tmp, block, babySteps[i]);
+          if (g > 0)
+            multiplyLazy(tmp, giantSteps[i].getPower(g), lazy_relin);
+        }
+        ret[i][j] += tmp;
+      }
+      NTL_EXEC_RANGE_END
+    }
+  }
+}
+
+long ceilLog2(long n)
+{
+  return (n <= 1) ? 0 : NTL::NumBits(n - 1);
+}
+
+long batchPolyEvalDepth(long max_deg, long k)
+{
+  if (max_deg <= 0)
+    return 0;
+
+  if (k <= 0)
+    k = static_cast<long>(ceil(sqrt(max_deg + 1.0)));
+  k = min(k, max_deg);
+  long giant_num = max(max_deg / k, 1L);
+
+  // block 0 uses the baby steps x, ..., x^{k-1}
+  long depth = ceilLog2(min(k - 1, max_deg));
+  for (long g = 1; g <= giant_num; g++) {
+    long block_deg = min(k - 1, max_deg - g * k);
+    if (block_deg < 0)
+      continue;
+    // x^{gk} is the gth power of the baby step x^k
+    long giant_depth = ceilLog2(k) + ceilLog2(g);
+    // a constant block only scales the giant step
+    if (block_deg == 0)
+      depth = max(depth, giant_depth);
+    else
+      depth = max(depth, max(ceilLog2(block_deg), giant_depth) + 1);
+  }
+  return depth;
+}
+
+long patersonStockmeyerDepth(long degree, long k)
+{
+  if (degree <= k)
+    return ceilLog2(degree);
+
+  // the blocks of degree <= k use the baby steps, every recursion level multiplies by one of the
+  // giant steps x^k, x^{2k}, x^{4k}, ...
+  long giant_num = (degree + k - 1) / k;
+  return ceilLog2(k) + ceilLog2(giant_num);
+}
+
 // The recursive procedure in the Paterson-Stockmeyer
 // polynomial-evaluation algorithm from SIAM J. on Computing, 1973.
 // This procedure assumes that poly is monic, deg(poly)=k*(2t-1)+delta
 // with t=2^e, and that babyStep contains >= k+delta powers
 void PatersonStockmeyer(Ctxt& ret, const NTL::ZZX& poly, long k, long t, long delta,
-		   DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep)
+		   DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep, bool lazy_relin)
 {
   if (deg(poly)<=babyStep.size()) { // Edge condition, use simple eval
     simplePolyEval(ret, poly, babyStep);
@@ -82,21 +517,22 @@ void PatersonStockmeyer(Ctxt& ret, const NTL::ZZX& poly, long k, long t, long de
   s.normalize();
 
   // Evaluate recursively poly = (c+X^{kt})*q + s'
-  PatersonStockmeyer(ret, q, k, t/2, delta, babyStep, giantStep);
+  PatersonStockmeyer(ret, q, k, t/2, delta, babyStep, giantStep, lazy_relin);
 
   Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
   simplePolyEval(tmp, c, babyStep);
   tmp += giantStep.getPower(t);
-  ret.multiplyBy(tmp);
+  multiplyLazy(ret, tmp, lazy_relin);
 
-  PatersonStockmeyer(tmp, s, k, t/2, delta, babyStep, giantStep);
+  // in the lazy mode, both products are relinearized together by the next multiplication
+  PatersonStockmeyer(tmp, s, k, t/2, delta, babyStep, giantStep, lazy_relin);
   ret += tmp;
 }
 
 // This procedure assumes that k*(2^e +1) > deg(poly) > k*(2^e -1),
 // and that babyStep contains >= k + (deg(poly) mod k) powers
 void degPowerOfTwo(Ctxt& ret, const NTL::ZZX& poly, long k,
-	      DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep)
+	      DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep, bool lazy_relin)
 {
   if (deg(poly)<=babyStep.size()) { // Edge condition, use simple eval
     simplePolyEval(ret, poly, babyStep);
@@ -109,20 +545,20 @@ void degPowerOfTwo(Ctxt& ret, const NTL::ZZX& poly, long k,
   SetCoeff(r, (n-1)*k);              // monic, degree == k(2^e-1)
   q -= 1;
 
-  PatersonStockmeyer(ret, r, k, n/2, 0,	babyStep, giantStep);
+  PatersonStockmeyer(ret, r, k, n/2, 0,	babyStep, giantStep, lazy_relin);
 
   Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
   simplePolyEval(tmp, q, babyStep); // evaluate q
 
   // multiply by X^{k(n-1)} with minimum depth
   for (long i=1; i<n; i*=2) {  
-    tmp.multiplyBy(giantStep.getPower(i));
+    multiplyLazy(tmp, giantStep.getPower(i), lazy_relin);
   }
   ret += tmp;
 }
 
 void recursivePolyEval(Ctxt& ret, const NTL::ZZX& poly, long k,
-		  DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep)
+		  DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep, bool lazy_relin)
 {
   if (deg(poly)<=babyStep.size()) { // Edge condition, use simple eval
     simplePolyEval(ret, poly, babyStep);
@@ -135,13 +571,13 @@ void recursivePolyEval(Ctxt& ret, const NTL::ZZX& poly, long k,
 
   // Special case for deg(poly) = k * 2^e +delta
   if (n==t) {
-    degPowerOfTwo(ret, poly, k, babyStep, giantStep);
+    degPowerOfTwo(ret, poly, k, babyStep, giantStep, lazy_relin);
     return;
   }
 
   // When deg(poly) = k*(2^e -1) we use the Paterson-Stockmeyer recursion
   if (n == t-1 && delta==0) {
-    PatersonStockmeyer(ret, poly, k, t/2, delta, babyStep, giantStep);
+    PatersonStockmeyer(ret, poly, k, t/2, delta, babyStep, giantStep, lazy_relin);
     return;
   }
 
@@ -157,14 +593,14 @@ void recursivePolyEval(Ctxt& ret, const NTL::ZZX& poly, long k,
   q -= 1;
   SetCoeff(r, u);              // degree == u
 
-  PatersonStockmeyer(ret, q, k, t/2, 0, babyStep, giantStep);
+  PatersonStockmeyer(ret, q, k, t/2, 0, babyStep, giantStep, lazy_relin);
 
   Ctxt tmp = giantStep.getPower(u/k);
   if (delta!=0) { // if u is not divisible by k then compute it
     tmp.multiplyBy(babyStep.getPower(delta));
   }
-  ret.multiplyBy(tmp);
+  multiplyLazy(ret, tmp, lazy_relin);
 
-  recursivePolyEval(tmp, r, k, babyStep, giantStep);
+  recursivePolyEval(tmp, r, k, babyStep, giantStep, lazy_relin);
   ret += tmp;
 }
\ No newline at end of file
@@ -11,6 +11,10 @@ Auxiliary functions for integer encoding
 #include <helib/helib.h>
 #include <helib/Ctxt.h>
 #include <helib/polyEval.h>
+#include <set>
+#include <list>
+#include <memory>
+#include <mutex>
 
 using namespace std;
 using namespace helib;
@@ -26,21 +30,142 @@ inline int intlog(unsigned long base, unsigned long input)
 
 void digit_decomp(vector<long>& decomp, unsigned long input, unsigned long base, int nslots);
 
+// Key-switching matrices for slot shifts by unit*2^i < max_shift to the left (and to the right if both_directions is set)
+void add_shift_matrices(SecKey& secret_key, long unit, long max_shift, bool both_directions = false);
+
+// Secret key that generates independent key-switching matrices on the NTL thread pool
+class ParallelSecKey : public SecKey
+{
+public:
+  explicit ParallelSecKey(const Context& context) : SecKey(context) {}
+
+  // Generate the matrices of the automorphisms X -> X^k for all k in autos concurrently
+  // and set the key-switching map once at the end. Matrices that already exist are kept and skipped
+  void GenKeySWmatrices(const std::set<long>& autos);
+};
+
+// Hypercube dimension along which batches of batch_len consecutive slots are shifted by 1D rotations, -1 if batches
+// do not fit into its rows. Only the last dimension keeps consecutive slots in one row.
+long batch_rotation_dim(const PAlgebra& zms, long batch_len);
+
+// Estimated number of key switches of a rotation along dimension dim (one for native dimensions, two otherwise)
+// or of a rotation of all slots if dim < 0
+long rotation_key_switches(const PAlgebra& zms, long dim);
+
+// Automorphisms of the matrices of add_shift_matrices
+void shift_automorphisms(std::set<long>& autos, const PAlgebra& zms, long unit, long max_shift, bool both_directions = false);
+
+// Automorphisms of the matrices of addSome1DMatrices (baby steps and giant steps for generators of order > bound)
+void some_1d_automorphisms(std::set<long>& autos, const PAlgebra& zms, long bound = 100);
+
+// Automorphisms of the matrices of addFrbMatrices
+void frobenius_automorphisms(std::set<long>& autos, const PAlgebra& zms, long bound = 100);
+
+// Bounded LRU cache of plaintext constants converted to DoubleCRT over the prime sets of the ciphertexts
+// they multiply. Constants are identified by the caller, e.g. by their position in a table. Thread-safe.
+class DoubleCRTCache
+{
+  struct Entry
+  {
+    long id;
+    IndexSet primes;
+    std::shared_ptr<const DoubleCRT> crt;
+  };
+
+  const Context& m_context;
+  size_t m_capacity;
+  // most recently used entries first
+  std::list<Entry> m_entries;
+  long m_hits;
+  long m_misses;
+  mutable std::mutex m_mutex;
+
+public:
+  DoubleCRTCache(const Context& context, size_t capacity) : m_context(context), m_capacity(capacity), m_hits(0), m_misses(0) {}
+
+  // DoubleCRT of the constant 'id' with coefficients poly over the given primes
+  std::shared_ptr<const DoubleCRT> get(long id, const zzX& poly, const IndexSet& primes);
+
+  // change the maximal number of entries
+  void set_capacity(size_t capacity);
+
+  void print_stats(std::ostream& str) const;
+};
+
+// Scratch ciphertext borrowed from a per-thread pool. A returned ciphertext keeps its DoubleCRT buffers,
+// so copying a ciphertext of the same size into it next time reuses them instead of allocating
+class ScratchCtxt
+{
+  Ctxt* m_ctxt;
+
+public:
+  // borrow a scratch ciphertext holding a copy of ctxt
+  explicit ScratchCtxt(const Ctxt& ctxt);
+  ScratchCtxt(ScratchCtxt&& other) noexcept : m_ctxt(other.m_ctxt) { other.m_ctxt = nullptr; }
+  ScratchCtxt(const ScratchCtxt&) = delete;
+  ScratchCtxt& operator=(const ScratchCtxt&) = delete;
+  // give the ciphertext back to the pool of this thread
+  ~ScratchCtxt();
+
+  Ctxt& operator*() const { return *m_ctxt; }
+  Ctxt* operator->() const { return m_ctxt; }
+
+  // switch the pools of all threads on/off (on by default), if off every scratch ciphertext is allocated
+  static void set_enabled(bool enabled);
+
+  // number of scratch ciphertexts allocated and reused since the last reset
+  static void get_stats(long& allocated, long& reused);
+  static void reset_stats();
+};
+
+// Resident memory of this process in KB (0 if /proc/self/statm is not available)
+long resident_memory_kb();
+
+// remove the option '<name> <value>' from the command line and return its value (empty if the option is absent)
+string take_option(int& argc, char* argv[], const string& name);
+
+// Multiply ctxt by other. If lazy_relin is set, the product is not relinearized
+// and the inputs are relinearized only if they are not in canonical form
+void multiplyLazy(Ctxt& ctxt, const Ctxt& other, bool lazy_relin);
+
 // Simple evaluation sum f_i * X^i, assuming that babyStep has enough powers
 void simplePolyEval(Ctxt& ret, const NTL::ZZX& poly, DynamicCtxtPowers& babyStep);
 
+// Evaluate several polynomials at the same ciphertext sharing the baby steps x, ..., x^k
+// and the giant steps x^k, x^{2k}, ... (k = ceil(sqrt(max degree + 1)) if k <= 0)
+// If lazy_relin is set, the products with giant steps of one polynomial are relinearized together
+// and the results may be not relinearized
+void multiPolyEval(vector<Ctxt>& ret, const vector<NTL::ZZX>& polys, const Ctxt& x, long k = 0, bool lazy_relin = false);
+
+// The same for many ciphertexts: ret[i][j] = polys[j](x[i]). All ciphertexts advance through the same
+// schedule of baby steps, giant steps and giant-step blocks, each stage runs on the NTL thread pool
+void batchPolyEval(vector<vector<Ctxt>>& ret, const vector<NTL::ZZX>& polys, const vector<Ctxt>& x, long k = 0, bool lazy_relin = false);
+
+// ceil(log2(n)), 0 for n <= 1
+long ceilLog2(long n);
+
+// Multiplicative depth of batchPolyEval and multiPolyEval for polynomials of degree at most max_deg
+// with the same choice of k and of the number of giant steps
+long batchPolyEvalDepth(long max_deg, long k = 0);
+
+// Multiplicative depth of the Paterson-Stockmeyer evaluation (degPowerOfTwo, recursivePolyEval)
+// of a polynomial of the given degree with k baby steps and ceil(degree/k) giant steps
+long patersonStockmeyerDepth(long degree, long k);
+
 // The recursive procedure in the Paterson-Stockmeyer
 // polynomial-evaluation algorithm from SIAM J. on Computing, 1973.
 // This procedure assumes that poly is monic, deg(poly)=k*(2t-1)+delta
 // with t=2^e, and that babyStep contains >= k+delta powers
-void PatersonStockmeyer(Ctxt& ret, const NTL::ZZX& poly, long k, long t, long delta, DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep);
+// If lazy_relin is set, products are relinearized only before they are multiplied again,
+// so products summed up are relinearized together and the result may be not relinearized
+void PatersonStockmeyer(Ctxt& ret, const NTL::ZZX& poly, long k, long t, long delta, DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep, bool lazy_relin = false);
 
 // This procedure assumes that k*(2^e +1) > deg(poly) > k*(2^e -1),
 // and that babyStep contains >= k + (deg(poly) mod k) powers
 void degPowerOfTwo(Ctxt& ret, const NTL::ZZX& poly, long k,
-        DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep);
+        DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep, bool lazy_relin = false);
 
 void recursivePolyEval(Ctxt& ret, const NTL::ZZX& poly, long k,
-      DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep);
+      DynamicCtxtPowers& babyStep, DynamicCtxtPowers& giantStep, bool lazy_relin = false);
 
 #endif // #ifndef TOOLS_H
\ No newline at end of file